@@ -0,0 +1,364 @@
+/*
+ * Executors under load: ThreadPool (every schedule, and post() instead of
+ * submit() on the shared queue), BasicExecutor with its queue picked at
+ * compile time instead, ThreadPoll, and the bare ThreadSafeQueue they are
+ * built on.
+ *
+ *   throughput     queue tasks-many empty tasks from one thread
+ *   latency        queue to start of execution, bursts of kBurst tasks
+ *   overhead       submit().get() round trip of an empty task
+ *   fan_out        a task queues kFanOut children, the caller waits for all
+ *   producers      1..N threads queueing onto 1..N workers at once
+ *   shedding       a backlog of tasks queued with submit_with_deadline(),
+ *                  expired by the time the workers start, dropped unrun
+ *   queue          1..N producers and as many consumers on ThreadSafeQueue:
+ *                  polling an unbounded one, blocking on a bounded one
+ *                  (kPipeline items) item by item and kPopBulk at a time
+ *   metrics        overhead and producers on ThreadPool, the backend named
+ *                  after the build: bench/executors_metrics is this bench
+ *                  built with -DTHREAD_POOL_METRICS, what the counters cost
+ *                  is the difference between its rows and ours
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <future>
+#include <vector>
+#include "harness.hpp"
+#include "thread_pool.hpp"
+#include "thread_pool_c11.hpp"
+#include "thread_safe_queue.hpp"
+
+static const size_t kBurst = 16;
+static const size_t kFanOut = 64;
+static const size_t kPipeline = 1024;
+static const size_t kPopBulk = 64;
+static const size_t kBacklog = 1 << 16;    // Fits the lock_free ring.
+
+#ifdef THREAD_POOL_METRICS
+static const char *const kBuild = "/instrumented";
+#else
+static const char *const kBuild = "/uninstrumented";
+#endif
+
+// Pool: ThreadPool, or any BasicExecutor, which ignores schedule.
+template <typename Pool = ThreadPool>
+class PoolBackend
+{
+public:
+    // fire_and_forget: post() through ThreadPool::post(), no future.
+    PoolBackend(size_t threads, ThreadPool::Schedule schedule, bool fire_and_forget = false)
+        : pool_((int)threads, schedule, 1 << 16), fire_and_forget_(fire_and_forget)
+    {
+        pool_.initialize();
+    }
+
+    ~PoolBackend() { pool_.shutdown(); }
+
+    template <typename Function>
+    void post(Function &&f)
+    {
+        if (fire_and_forget_)
+            pool_.post(std::forward<Function>(f));
+        else
+            pool_.submit(std::forward<Function>(f));
+    }
+
+    template <typename Function>
+    void run(Function &&f) { pool_.submit(std::forward<Function>(f)).get(); }
+
+private:
+    Pool pool_;
+    bool fire_and_forget_;
+};
+
+class PollBackend
+{
+public:
+    explicit PollBackend(size_t threads) : poll_(threads) { }
+
+    template <typename Function>
+    void post(Function &&f) { poll_.commit(std::forward<Function>(f)); }
+
+    template <typename Function>
+    void run(Function &&f) { poll_.commit(std::forward<Function>(f)).get(); }
+
+private:
+    ThreadPoll poll_;
+};
+
+template <typename Backend>
+static void bench_throughput(BenchReport &report, const std::string &name, size_t threads,
+        Backend &backend, const BenchOptions &options)
+{
+    Countdown done;
+    double submit_rate = 0;
+    double rate = median_of(options.repeat, [&] {
+        done.reset(options.tasks);
+        int64_t start = bench_now();
+        for (size_t i = 0; i < options.tasks; ++i)
+            backend.post([&done] { done.arrive(); });
+        int64_t queued = bench_now();
+        done.wait();
+        int64_t end = bench_now();
+        submit_rate = options.tasks * 1e9 / std::max(queued - start, (int64_t)1);
+        return options.tasks * 1e9 / std::max(end - start, (int64_t)1);
+    });
+    report.add("throughput", name, threads, "submit_rate", submit_rate, "tasks/s");
+    report.add("throughput", name, threads, "completion_rate", rate, "tasks/s");
+}
+
+template <typename Backend>
+static void bench_latency(BenchReport &report, const std::string &name, size_t threads,
+        Backend &backend, const BenchOptions &options)
+{
+    size_t n = options.tasks / kBurst * kBurst;
+    std::vector<int64_t> latency(n);
+    Countdown done;
+    for (size_t burst = 0; burst < n; burst += kBurst) {
+        done.reset(kBurst);
+        for (size_t i = burst; i < burst + kBurst; ++i) {
+            int64_t queued = bench_now();
+            int64_t *slot = &latency[i];
+            backend.post([&done, slot, queued] {
+                *slot = bench_now() - queued;
+                done.arrive();
+            });
+        }
+        done.wait();
+    }
+
+    report.add("latency", name, threads, "p50", percentile(latency, 0.5), "ns");
+    report.add("latency", name, threads, "p90", percentile(latency, 0.9), "ns");
+    report.add("latency", name, threads, "p99", percentile(latency, 0.99), "ns");
+    report.add("latency", name, threads, "p999", percentile(latency, 0.999), "ns");
+    report.add("latency", name, threads, "max", (double)latency.back(), "ns");
+}
+
+template <typename Backend>
+static void bench_overhead(BenchReport &report, const std::string &name, size_t threads,
+        Backend &backend, const BenchOptions &options, const char *benchmark = "overhead")
+{
+    size_t n = std::max(options.tasks / 10, (size_t)1);
+    double ns = median_of(options.repeat, [&] {
+        int64_t start = bench_now();
+        for (size_t i = 0; i < n; ++i)
+            backend.run([] { });
+        return (double)(bench_now() - start) / n;
+    });
+    report.add(benchmark, name, threads, "round_trip", ns, "ns/task");
+}
+
+template <typename Backend>
+static void bench_fan_out(BenchReport &report, const std::string &name, size_t threads,
+        Backend &backend, const BenchOptions &options)
+{
+    size_t rounds = std::max(options.tasks / kFanOut, (size_t)1);
+    Countdown done;
+    double ns = median_of(options.repeat, [&] {
+        int64_t start = bench_now();
+        for (size_t r = 0; r < rounds; ++r) {
+            done.reset(kFanOut);
+            backend.post([&backend, &done] {
+                for (size_t i = 0; i < kFanOut; ++i)
+                    backend.post([&done] { done.arrive(); });
+            });
+            done.wait();
+        }
+        return (double)(bench_now() - start) / rounds;
+    });
+    report.add("fan_out", name, threads, "round", ns, "ns/round");
+    report.add("fan_out", name, threads, "child", ns / kFanOut, "ns/task");
+}
+
+// threads producers queue onto a backend of threads workers.
+template <typename Backend>
+static void bench_producers(BenchReport &report, const std::string &name, size_t threads,
+        Backend &backend, const BenchOptions &options, const char *benchmark = "producers")
+{
+    size_t per_producer = std::max(options.tasks / threads, (size_t)1);
+    Countdown done;
+    double rate = median_of(options.repeat, [&] {
+        done.reset(per_producer * threads);
+        int64_t start = bench_now();
+        std::vector<std::thread> producers;
+        for (size_t p = 0; p < threads; ++p) {
+            producers.emplace_back([&backend, &done, per_producer] {
+                for (size_t i = 0; i < per_producer; ++i)
+                    backend.post([&done] { done.arrive(); });
+            });
+        }
+        for (size_t p = 0; p < producers.size(); ++p)
+            producers[p].join();
+        done.wait();
+        return per_producer * threads * 1e9 / std::max(bench_now() - start, (int64_t)1);
+    });
+    report.add(benchmark, name, threads, "completion_rate", rate, "tasks/s");
+}
+
+template <typename Backend>
+static void bench_backend(BenchReport &report, const std::string &name, size_t threads, Backend &backend,
+        const BenchOptions &options)
+{
+    bench_throughput(report, name, threads, backend, options);
+    bench_latency(report, name, threads, backend, options);
+    bench_overhead(report, name, threads, backend, options);
+    bench_fan_out(report, name, threads, backend, options);
+    bench_producers(report, name, threads, backend, options);
+}
+
+// How fast the pool clears work whose callers already gave up.
+static void bench_shedding(BenchReport &report, const std::string &name, size_t threads,
+        ThreadPool::Schedule schedule, const BenchOptions &options)
+{
+    size_t backlog = std::min(options.tasks, kBacklog);
+    double rate = median_of(options.repeat, [&] {
+        ThreadPool pool((int)threads, schedule, kBacklog);
+        std::vector<std::future<void>> futures;
+        futures.reserve(backlog);
+        ThreadPool::clock::time_point deadline = ThreadPool::clock::now();
+        for (size_t i = 0; i < backlog; ++i)
+            futures.push_back(pool.submit_with_deadline(deadline, [] { }));
+
+        int64_t start = bench_now();
+        pool.initialize();
+        for (size_t i = 0; i < futures.size(); ++i)
+            futures[i].wait();
+        int64_t end = bench_now();
+        pool.shutdown();
+        return backlog * 1e9 / std::max(end - start, (int64_t)1);
+    });
+    report.add("shedding", name, threads, "drop_rate", rate, "tasks/s");
+}
+
+static void bench_queue(BenchReport &report, size_t threads, const BenchOptions &options)
+{
+    size_t per_producer = std::max(options.tasks / threads, (size_t)1);
+    double rate = median_of(options.repeat, [&] {
+        ThreadSafeQueue<size_t> queue;
+        std::atomic<size_t> consumed(0);
+        size_t total = per_producer * threads;
+
+        int64_t start = bench_now();
+        std::vector<std::thread> workers;
+        for (size_t p = 0; p < threads; ++p) {
+            workers.emplace_back([&queue, per_producer] {
+                for (size_t i = 0; i < per_producer; ++i)
+                    queue.enqueue(i);
+            });
+            workers.emplace_back([&queue, &consumed, total] {
+                size_t item;
+                while (consumed.load(std::memory_order_relaxed) < total) {
+                    if (queue.dequeue(item))
+                        consumed.fetch_add(1, std::memory_order_relaxed);
+                    else
+                        std::this_thread::yield();
+                }
+            });
+        }
+        for (size_t i = 0; i < workers.size(); ++i)
+            workers[i].join();
+        return total * 1e9 / std::max(bench_now() - start, (int64_t)1);
+    });
+    report.add("queue", "ThreadSafeQueue", threads, "transfer_rate", rate, "items/s");
+}
+
+// Producers push into a bounded queue, closed once they are done;
+// consumers block until it is drained.
+static void bench_pipeline(BenchReport &report, size_t threads, size_t bulk, const BenchOptions &options)
+{
+    size_t per_producer = std::max(options.tasks / threads, (size_t)1);
+    double rate = median_of(options.repeat, [&] {
+        ThreadSafeQueue<size_t> queue(kPipeline);
+        int64_t start = bench_now();
+        std::vector<std::thread> producers, consumers;
+        for (size_t p = 0; p < threads; ++p) {
+            producers.emplace_back([&queue, per_producer] {
+                for (size_t i = 0; i < per_producer; ++i)
+                    queue.push(i);
+            });
+            consumers.emplace_back([&queue, bulk] {
+                std::vector<size_t> items(bulk);
+                if (bulk == 1) {
+                    while (queue.wait_pop(items[0]))
+                        ;
+                } else {
+                    while (queue.wait_pop_bulk(items.begin(), bulk))
+                        ;
+                }
+            });
+        }
+        for (size_t i = 0; i < producers.size(); ++i)
+            producers[i].join();
+        queue.close();
+        for (size_t i = 0; i < consumers.size(); ++i)
+            consumers[i].join();
+        return per_producer * threads * 1e9 / std::max(bench_now() - start, (int64_t)1);
+    });
+    report.add("queue", bulk == 1 ? "ThreadSafeQueue/bounded" : "ThreadSafeQueue/bulk",
+            threads, "transfer_rate", rate, "items/s");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options = BenchOptions::parse(argc, argv);
+    BenchReport report(options);
+
+    struct
+    {
+        const char *name;
+        ThreadPool::Schedule schedule;
+    } schedules[] = {
+        { "ThreadPool/shared_queue", ThreadPool::Schedule::shared_queue },
+        { "ThreadPool/lock_free", ThreadPool::Schedule::lock_free },
+        { "ThreadPool/work_stealing", ThreadPool::Schedule::work_stealing },
+        { "ThreadPool/priority", ThreadPool::Schedule::priority },
+    };
+
+    std::vector<size_t> counts = options.thread_counts();
+    for (size_t c = 0; c < counts.size(); ++c) {
+        for (size_t s = 0; s < sizeof(schedules) / sizeof(schedules[0]); ++s) {
+            PoolBackend<> backend(counts[c], schedules[s].schedule);
+            bench_backend(report, schedules[s].name, counts[c], backend, options);
+        }
+
+        {
+            PoolBackend<> backend(counts[c], ThreadPool::Schedule::shared_queue, true);
+            bench_backend(report, "ThreadPool/post", counts[c], backend, options);
+        }
+
+        {
+            PoolBackend<LockFreePool> backend(counts[c], ThreadPool::Schedule::lock_free);
+            bench_backend(report, "BasicExecutor/lock_free", counts[c], backend, options);
+        }
+
+        {
+            PoolBackend<WorkStealingPool> backend(counts[c], ThreadPool::Schedule::work_stealing);
+            bench_backend(report, "BasicExecutor/work_stealing", counts[c], backend, options);
+        }
+
+        for (size_t s = 0; s < sizeof(schedules) / sizeof(schedules[0]); ++s)
+            bench_shedding(report, schedules[s].name, counts[c], schedules[s].schedule, options);
+
+        {
+            PollBackend backend(counts[c]);
+            bench_backend(report, "ThreadPoll", counts[c], backend, options);
+        }
+
+        for (size_t s = 0; s < sizeof(schedules) / sizeof(schedules[0]); ++s) {
+            PoolBackend<> backend(counts[c], schedules[s].schedule, true);
+            std::string name = std::string(schedules[s].name) + kBuild;
+            bench_overhead(report, name, counts[c], backend, options, "metrics");
+            bench_producers(report, name, counts[c], backend, options, "metrics");
+        }
+
+        bench_queue(report, counts[c], options);
+        bench_pipeline(report, counts[c], 1, options);
+        bench_pipeline(report, counts[c], kPopBulk, options);
+    }
+
+    return report.save() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
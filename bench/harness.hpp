@@ -0,0 +1,197 @@
+#ifndef _BENCH_HARNESS_HPP_
+#define _BENCH_HARNESS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Shared bits of the benchmarks: command line, timing, and a result table
+ * printed as it fills and written out as CSV and JSON, one row per
+ * (benchmark, backend, threads, metric), so runs can be diffed between
+ * releases.
+ *
+ *     --csv=FILE  --json=FILE  --tasks=N  --threads=N  --repeat=N
+ *     --elements=N    largest input of the data-parallel benchmarks
+ */
+struct BenchOptions
+{
+    std::string csv;
+    std::string json;
+    size_t tasks = 100000;
+    size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t repeat = 3;      // Scalar metrics report the median of this many runs.
+    size_t elements = 10000000;
+
+    static BenchOptions parse(int argc, char **argv)
+    {
+        BenchOptions options;
+        for (int i = 1; i < argc; ++i) {
+            const char *arg = argv[i];
+            if (!strncmp(arg, "--csv=", 6))
+                options.csv = arg + 6;
+            else if (!strncmp(arg, "--json=", 7))
+                options.json = arg + 7;
+            else if (!strncmp(arg, "--tasks=", 8))
+                options.tasks = std::max(strtoul(arg + 8, nullptr, 10), 1ul);
+            else if (!strncmp(arg, "--threads=", 10))
+                options.max_threads = std::max(strtoul(arg + 10, nullptr, 10), 1ul);
+            else if (!strncmp(arg, "--repeat=", 9))
+                options.repeat = std::max(strtoul(arg + 9, nullptr, 10), 1ul);
+            else if (!strncmp(arg, "--elements=", 11))
+                options.elements = std::max(strtoul(arg + 11, nullptr, 10), 1ul);
+            else
+                fprintf(stderr, "ignoring unknown option %s\n", arg);
+        }
+        return options;
+    }
+
+    // 1, 2, 4, ... up to max_threads, max_threads always included.
+    std::vector<size_t> thread_counts() const
+    {
+        std::vector<size_t> counts;
+        for (size_t n = 1; n < max_threads; n *= 2)
+            counts.push_back(n);
+        counts.push_back(max_threads);
+        return counts;
+    }
+};
+
+inline int64_t bench_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Value below which p (0..1) of the samples fall, samples get sorted.
+inline double percentile(std::vector<int64_t> &samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t index = std::min((size_t)(p * samples.size()), samples.size() - 1);
+    return (double)samples[index];
+}
+
+template <typename Measure>
+double median_of(size_t repeat, Measure measure)
+{
+    std::vector<double> values;
+    for (size_t i = 0; i < repeat; ++i)
+        values.push_back(measure());
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// What the main thread waits on until the tasks it queued have run.
+class Countdown
+{
+public:
+    explicit Countdown(size_t n = 0) : left_(n) { }
+
+    void reset(size_t n) { left_.store(n, std::memory_order_relaxed); }
+    void arrive() { left_.fetch_sub(1, std::memory_order_release); }
+
+    void wait() const
+    {
+        while (left_.load(std::memory_order_acquire) != 0)
+            std::this_thread::yield();
+    }
+
+private:
+    std::atomic<size_t> left_;
+};
+
+class BenchReport
+{
+public:
+    explicit BenchReport(const BenchOptions &options) : options_(options)
+    {
+        printf("%-14s %-26s %7s %-16s %14s %s\n", "benchmark", "backend", "threads", "metric", "value", "unit");
+    }
+
+    void add(const char *benchmark, const std::string &backend, size_t threads,
+            const char *metric, double value, const char *unit)
+    {
+        Row row = { benchmark, backend, threads, metric, value, unit };
+        rows_.push_back(row);
+        printf("%-14s %-26s %7zu %-16s %14.1f %s\n", benchmark, backend.c_str(), threads, metric, value, unit);
+        fflush(stdout);
+    }
+
+    // Writes the files asked for on the command line, false on I/O errors.
+    bool save() const
+    {
+        bool ok = true;
+        if (!options_.csv.empty())
+            ok = write_csv(options_.csv) && ok;
+        if (!options_.json.empty())
+            ok = write_json(options_.json) && ok;
+        return ok;
+    }
+
+private:
+    struct Row
+    {
+        std::string benchmark;
+        std::string backend;
+        size_t threads;
+        std::string metric;
+        double value;
+        std::string unit;
+    };
+
+    bool write_csv(const std::string &path) const
+    {
+        FILE *fp = fopen(path.c_str(), "w");
+        if (!fp) {
+            perror(path.c_str());
+            return false;
+        }
+        fprintf(fp, "benchmark,backend,threads,metric,value,unit\n");
+        for (size_t i = 0; i < rows_.size(); ++i) {
+            const Row &r = rows_[i];
+            fprintf(fp, "%s,%s,%zu,%s,%.3f,%s\n", r.benchmark.c_str(), r.backend.c_str(), r.threads,
+                    r.metric.c_str(), r.value, r.unit.c_str());
+        }
+        return fclose(fp) == 0;
+    }
+
+    bool write_json(const std::string &path) const
+    {
+        FILE *fp = fopen(path.c_str(), "w");
+        if (!fp) {
+            perror(path.c_str());
+            return false;
+        }
+
+        char date[32];
+        time_t now = time(nullptr);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+        fprintf(fp, "{\n  \"date\": \"%s\",\n  \"compiler\": \"%s\",\n  \"hardware_threads\": %u,\n"
+                "  \"tasks\": %zu,\n  \"repeat\": %zu,\n  \"results\": [\n",
+                date, __VERSION__, std::thread::hardware_concurrency(), options_.tasks, options_.repeat);
+        for (size_t i = 0; i < rows_.size(); ++i) {
+            const Row &r = rows_[i];
+            fprintf(fp, "    { \"benchmark\": \"%s\", \"backend\": \"%s\", \"threads\": %zu, "
+                    "\"metric\": \"%s\", \"value\": %.3f, \"unit\": \"%s\" }%s\n",
+                    r.benchmark.c_str(), r.backend.c_str(), r.threads, r.metric.c_str(), r.value,
+                    r.unit.c_str(), i + 1 < rows_.size() ? "," : "");
+        }
+        fprintf(fp, "  ]\n}\n");
+        return fclose(fp) == 0;
+    }
+
+private:
+    const BenchOptions &options_;
+    std::vector<Row> rows_;
+};
+
+#endif //_BENCH_HARNESS_HPP_
@@ -0,0 +1,185 @@
+/*
+ * Cost of LOGD to the calling thread: synchronous, async, structured
+ * (formatted by the writer thread) and binary (never formatted) Logger.
+ *
+ *   call           1..N threads logging tasks-many lines between them,
+ *                  time per call seen by one caller
+ *   delivery       the same until the last line was handed to the sink
+ *   producer       the same in bursts that fit the caller's ring, the
+ *                  writer catching up in between, so only the caller's own
+ *                  work is timed: what a line costs when the writer has a
+ *                  core of its own
+ *   suppressed     a line the rate limiting and sampling macros leave out,
+ *                  next to one below the logger's level
+ *   hexdump        bytes a second through the hex dump kernel alone, and
+ *                  through Logger::dump() to the callback
+ *
+ * The sink is a callback dropping every line, or /dev/null for the binary
+ * stream, so only the logger is timed.
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include "harness.hpp"
+#include "log.hpp"
+
+static std::atomic<size_t> g_lines(0);
+
+static void sink(int, const char *, const void *)
+{
+    g_lines.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void bench_logger(BenchReport &report, const char *name, size_t threads, const BenchOptions &options)
+{
+    size_t per_thread = std::max(options.tasks / threads, (size_t)1);
+    double call = 0;
+    double delivery = median_of(options.repeat, [&] {
+        std::atomic<int64_t> busy(0);
+        std::vector<std::thread> callers;
+        int64_t start = bench_now();
+        for (size_t t = 0; t < threads; ++t) {
+            callers.emplace_back([&busy, per_thread, t] {
+                int64_t begin = bench_now();
+                for (size_t i = 0; i < per_thread; ++i)
+                    LOGD("caller %zu line %zu of %zu", t, i, per_thread);
+                busy.fetch_add(bench_now() - begin);
+            });
+        }
+        for (size_t t = 0; t < callers.size(); ++t)
+            callers[t].join();
+        LOG_FLUSH();
+        int64_t end = bench_now();
+
+        call = (double)busy.load() / (per_thread * threads);
+        return (double)(end - start) / (per_thread * threads);
+    });
+    report.add("call", name, threads, "latency", call, "ns/line");
+    report.add("delivery", name, threads, "latency", delivery, "ns/line");
+
+    const size_t kBurst = 100;
+    double producer = median_of(options.repeat, [&] {
+        std::atomic<int64_t> busy(0);
+        std::vector<std::thread> callers;
+        for (size_t t = 0; t < threads; ++t) {
+            callers.emplace_back([&busy, per_thread, t, kBurst] {
+                int64_t spent = 0;
+                for (size_t i = 0; i < per_thread; i += kBurst) {
+                    int64_t begin = bench_now();
+                    for (size_t j = i; j < std::min(i + kBurst, per_thread); ++j)
+                        LOGD("caller %zu line %zu of %zu", t, j, per_thread);
+                    spent += bench_now() - begin;
+                    LOG_FLUSH();
+                }
+                busy.fetch_add(spent);
+            });
+        }
+        for (size_t t = 0; t < callers.size(); ++t)
+            callers[t].join();
+        return (double)busy.load() / (per_thread * threads);
+    });
+    report.add("producer", name, threads, "latency", producer, "ns/line");
+}
+
+// Every call suppressed but for a handful of lines.
+template <typename Log>
+static void bench_suppressed(BenchReport &report, const char *name, size_t threads, const BenchOptions &options, Log log)
+{
+    size_t per_thread = std::max(options.tasks / threads, (size_t)1);
+    double call = median_of(options.repeat, [&] {
+        std::atomic<int64_t> busy(0);
+        std::vector<std::thread> callers;
+        for (size_t t = 0; t < threads; ++t) {
+            callers.emplace_back([&busy, &log, per_thread] {
+                int64_t begin = bench_now();
+                for (size_t i = 0; i < per_thread; ++i)
+                    log(i);
+                busy.fetch_add(bench_now() - begin);
+            });
+        }
+        for (size_t t = 0; t < callers.size(); ++t)
+            callers[t].join();
+        return (double)busy.load() / (per_thread * threads);
+    });
+    report.add("suppressed", name, threads, "latency", call, "ns/line");
+}
+
+static void bench_hexdump(BenchReport &report, const BenchOptions &options)
+{
+    std::vector<uint8_t> buffer(1 << 20);
+    for (size_t i = 0; i < buffer.size(); ++i)
+        buffer[i] = (uint8_t)(i * 131);
+    size_t rounds = std::max(options.tasks / 10000, (size_t)1);
+
+    std::string out;
+    double kernel = median_of(options.repeat, [&] {
+        int64_t start = bench_now();
+        for (size_t r = 0; r < rounds; ++r) {
+            out.clear();
+            log_hex_lines(out, buffer.data(), buffer.size(), 32);
+        }
+        return (double)(rounds * buffer.size()) * 1000 / (bench_now() - start);
+    });
+    report.add("hexdump", "log_hex_lines", 1, "throughput", kernel, "MB/s");
+
+    double logger = median_of(options.repeat, [&] {
+        int64_t start = bench_now();
+        for (size_t r = 0; r < rounds; ++r)
+            LOG_HEX_DUMP(buffer.data(), buffer.size());
+        LOG_FLUSH();
+        return (double)(rounds * buffer.size()) * 1000 / (bench_now() - start);
+    });
+    report.add("hexdump", "Logger/sync", 1, "throughput", logger, "MB/s");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options = BenchOptions::parse(argc, argv);
+    BenchReport report(options);
+    LOG_REDIRECT(sink, nullptr, false);
+
+    std::vector<size_t> counts = options.thread_counts();
+    for (size_t c = 0; c < counts.size(); ++c) {
+        LOG_ASYNC(false);
+        bench_logger(report, "Logger/sync", counts[c], options);
+
+        LOG_ASYNC(true);
+        bench_logger(report, "Logger/async", counts[c], options);
+
+        Logger::AsyncOptions structured;
+        structured.structured = true;
+        Logger::inst()->async(structured);
+        bench_logger(report, "Logger/structured", counts[c], options);
+
+        Logger::AsyncOptions binary;
+        binary.binary.path = "/dev/null";
+        Logger::inst()->async(binary);
+        bench_logger(report, "Logger/binary", counts[c], options);
+        LOG_ASYNC(false);
+
+        LOG_LEVEL(LOGGER_INFO);
+        bench_suppressed(report, "LOGD/level", counts[c], options, [](size_t i) {
+            LOGD("line %zu", i);
+        });
+        LOG_LEVEL(LOGGER_DEBUG);
+        bench_suppressed(report, "LOGD_EVERY_N", counts[c], options, [](size_t i) {
+            LOGD_EVERY_N(1 << 30, "line %zu", i);
+        });
+        bench_suppressed(report, "LOGD_FIRST_N", counts[c], options, [](size_t i) {
+            LOGD_FIRST_N(1, "line %zu", i);
+        });
+        bench_suppressed(report, "LOGD_RATE", counts[c], options, [](size_t i) {
+            LOGD_RATE(1, "line %zu", i);
+        });
+        bench_suppressed(report, "LOGD_SAMPLE", counts[c], options, [](size_t i) {
+            LOGD_SAMPLE(1e-9, "line %zu", i);
+        });
+    }
+
+    bench_hexdump(report, options);
+
+    return report.save() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,163 @@
+/*
+ * The algorithms of src/parallel.hpp against their serial std:: versions,
+ * on 1M, 10M, ... uint32_t elements up to --elements (1000000000 for the
+ * full 1M to 1B sweep, about 12 GB of memory):
+ *
+ *   for            x = x * 3 + 1 in place, against a plain loop
+ *   reduce         wrapping sum, against std::accumulate
+ *   transform      x ^ key in place, against std::transform
+ *   scan           inclusive prefix sum in place, against std::partial_sum
+ *   sort           random keys, against std::sort
+ *
+ * In millions of elements per second. The threads column is the pool
+ * size; the calling thread runs a share of the leaves too. Every parallel
+ * result is checked against the serial one.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "harness.hpp"
+#include "parallel.hpp"
+#include "thread_pool.hpp"
+
+typedef std::vector<uint32_t> Data;
+
+static void fill(Data &data)
+{
+    uint32_t x = 2463534242u;
+    for (size_t i = 0; i < data.size(); ++i) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        data[i] = x;
+    }
+}
+
+static uint64_t checksum(const Data &data)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < data.size(); ++i)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+static std::string label(const char *name, size_t n)
+{
+    char buf[64];
+    if (n % 1000000000 == 0)
+        snprintf(buf, sizeof(buf), "%s/%zuG", name, n / 1000000000);
+    else if (n % 1000000 == 0)
+        snprintf(buf, sizeof(buf), "%s/%zuM", name, n / 1000000);
+    else
+        snprintf(buf, sizeof(buf), "%s/%zu", name, n);
+    return buf;
+}
+
+/*
+ * One algorithm at one size: op(work) runs it on work, a fresh copy of
+ * input each time, and returns what it computed besides work, if anything.
+ * result gets that plus a checksum of work.
+ */
+template <typename Op>
+static double measure(const Data &input, Data &work, const BenchOptions &options, uint64_t &result, Op op)
+{
+    return median_of(options.repeat, [&] {
+        std::copy(input.begin(), input.end(), work.begin());
+        int64_t start = bench_now();
+        uint64_t value = op(work);
+        int64_t end = bench_now();
+        result = value + checksum(work);
+        return input.size() * 1e3 / std::max(end - start, (int64_t)1);
+    });
+}
+
+struct Algorithm
+{
+    const char *name;
+    std::function<uint64_t(Data &)> serial;
+    std::function<uint64_t(ThreadPool &, Data &)> parallel;
+};
+
+int main(int argc, char **argv)
+{
+    BenchOptions options = BenchOptions::parse(argc, argv);
+    BenchReport report(options);
+
+    const uint32_t key = 0x9e3779b9u;
+    Algorithm algorithms[] = {
+        { "for",
+            [](Data &d) {
+                for (size_t i = 0; i < d.size(); ++i)
+                    d[i] = d[i] * 3 + 1;
+                return (uint64_t)0;
+            },
+            [](ThreadPool &pool, Data &d) {
+                parallel_for(pool, 0, d.size(), [&d](size_t i) { d[i] = d[i] * 3 + 1; }, kParallelGrain);
+                return (uint64_t)0;
+            } },
+        { "reduce",
+            [](Data &d) { return (uint64_t)std::accumulate(d.begin(), d.end(), (uint32_t)1); },
+            [](ThreadPool &pool, Data &d) {
+                return (uint64_t)parallel_reduce(pool, d.begin(), d.end(), (uint32_t)1);
+            } },
+        { "transform",
+            [key](Data &d) {
+                std::transform(d.begin(), d.end(), d.begin(), [key](uint32_t x) { return x ^ key; });
+                return (uint64_t)0;
+            },
+            [key](ThreadPool &pool, Data &d) {
+                parallel_transform(pool, d.begin(), d.end(), d.begin(), [key](uint32_t x) { return x ^ key; });
+                return (uint64_t)0;
+            } },
+        { "scan",
+            [](Data &d) {
+                std::partial_sum(d.begin(), d.end(), d.begin());
+                return (uint64_t)0;
+            },
+            [](ThreadPool &pool, Data &d) {
+                parallel_scan(pool, d.begin(), d.end(), d.begin());
+                return (uint64_t)0;
+            } },
+        { "sort",
+            [](Data &d) {
+                std::sort(d.begin(), d.end());
+                return (uint64_t)0;
+            },
+            [](ThreadPool &pool, Data &d) {
+                parallel_sort(pool, d.begin(), d.end());
+                return (uint64_t)0;
+            } },
+    };
+
+    std::vector<size_t> counts = options.thread_counts();
+    for (size_t n = 1000000; n <= options.elements; n *= 10) {
+        Data input(n), work(n);
+        fill(input);
+
+        for (size_t a = 0; a < sizeof(algorithms) / sizeof(algorithms[0]); ++a) {
+            const Algorithm &algorithm = algorithms[a];
+            std::string name = label(algorithm.name, n);
+
+            uint64_t expected = 0;
+            double rate = measure(input, work, options, expected, algorithm.serial);
+            report.add(name.c_str(), "std", 1, "throughput", rate, "Melem/s");
+
+            for (size_t c = 0; c < counts.size(); ++c) {
+                ThreadPool pool((int)counts[c]);
+                pool.initialize();
+                uint64_t result = 0;
+                rate = measure(input, work, options, result, [&](Data &d) { return algorithm.parallel(pool, d); });
+                pool.shutdown();
+                if (result != expected)
+                    fprintf(stderr, "%s: parallel result differs at %zu threads\n", name.c_str(), counts[c]);
+                report.add(name.c_str(), "parallel", counts[c], "throughput", rate, "Melem/s");
+            }
+        }
+    }
+
+    return report.save() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,150 @@
+/*
+ * Heap allocations per submitted task.
+ *
+ * Counts every operator new while submitting small tasks and waiting on
+ * their futures, for the old std::function/packaged_task path and for the
+ * Task based ThreadPool and ThreadPoll, all given the same lambda; then
+ * without futures, through ThreadPool::post() and a TaskGroup. --tasks
+ * sets how many are counted, after a tenth as many to warm up.
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
+#include <new>
+#include "harness.hpp"
+#include "task_group.hpp"
+#include "thread_safe_queue.hpp"
+#include "thread_pool.hpp"
+#include "thread_pool_c11.hpp"
+
+static std::atomic<size_t> g_allocations(0);
+
+// GCC pairs the inlined replacement delete below with the library's new
+// and mistakes the free() for a mismatch.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static void add_to(std::atomic<int> &sum, int a, int b) { sum.fetch_add(a + b, std::memory_order_relaxed); }
+
+// What ThreadPool::submit() used to do for every task.
+template<typename Function, typename...Args>
+static auto legacy_submit(ThreadSafeQueue<std::function<void()>> &queue, Function &&f, Args&&... args)
+    -> std::future<decltype(f(args...))>
+{
+    std::function<decltype(f(args...))()> func = std::bind(std::forward<Function>(f), std::forward<Args>(args)...);
+    auto task_ptr = std::make_shared<std::packaged_task<decltype(f(args ...))()>>(func);
+    std::function<void()> wrapper_func = [task_ptr]() { (*task_ptr)(); };
+    queue.enqueue(wrapper_func);
+    return task_ptr->get_future();
+}
+
+// Allocations per task of run(n), after a warm-up run.
+template <typename Run>
+static void measure(BenchReport &report, const char *name, const BenchOptions &options, Run run)
+{
+    run(std::max(options.tasks / 10, (size_t)1));
+    size_t before = g_allocations.load();
+    run(options.tasks);
+    double allocations = (double)(g_allocations.load() - before) / options.tasks;
+    report.add("task_alloc", name, 1, "allocations", allocations, "allocations/task");
+}
+
+static void bench_legacy(BenchReport &report, const BenchOptions &options)
+{
+    ThreadSafeQueue<std::function<void()>> queue;
+    std::function<void()> func;
+    measure(report, "legacy/submit", options, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            int x = (int)i;
+            auto future = legacy_submit(queue, [x] { return x + 1; });
+            queue.dequeue(func);
+            func();
+            future.get();
+        }
+    });
+}
+
+static void bench_pool(BenchReport &report, const char *name, ThreadPool::Schedule schedule,
+        const BenchOptions &options)
+{
+    ThreadPool pool(1, schedule);
+    pool.initialize();
+    measure(report, name, options, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            int x = (int)i;
+            pool.submit([x] { return x + 1; }).get();
+        }
+    });
+    pool.shutdown();
+}
+
+static void bench_post(BenchReport &report, const BenchOptions &options)
+{
+    ThreadPool pool(1);
+    pool.initialize();
+    std::atomic<int> sum(0);
+    measure(report, "ThreadPool::post", options, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            int x = (int)i;
+            pool.post([&sum, x] { sum.fetch_add(x + 1, std::memory_order_relaxed); });
+        }
+        pool.wait_idle();
+    });
+    pool.shutdown();
+}
+
+static void bench_group(BenchReport &report, const BenchOptions &options)
+{
+    ThreadPool pool(1);
+    pool.initialize();
+    TaskGroup group(pool);
+    std::atomic<int> sum(0);
+    measure(report, "TaskGroup::run", options, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i)
+            group.run(add_to, std::ref(sum), (int)i, 1);
+        group.wait();
+    });
+    pool.shutdown();
+}
+
+static void bench_poll(BenchReport &report, const BenchOptions &options)
+{
+    ThreadPoll poll(1);
+    measure(report, "ThreadPoll::commit", options, [&](size_t n) {
+        for (size_t i = 0; i < n; ++i) {
+            int x = (int)i;
+            poll.commit([x] { return x + 1; }).get();
+        }
+    });
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options = BenchOptions::parse(argc, argv);
+    BenchReport report(options);
+
+    bench_legacy(report, options);
+    bench_pool(report, "ThreadPool/shared_queue", ThreadPool::Schedule::shared_queue, options);
+    bench_pool(report, "ThreadPool/lock_free", ThreadPool::Schedule::lock_free, options);
+    bench_pool(report, "ThreadPool/work_stealing", ThreadPool::Schedule::work_stealing, options);
+    bench_poll(report, options);
+    bench_post(report, options);
+    bench_group(report, options);
+
+    return report.save() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
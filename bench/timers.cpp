@@ -0,0 +1,129 @@
+/*
+ * Timers of ThreadPool::schedule_after() and schedule_every().
+ *
+ *   arm            schedule_after() of max(tasks, kMinTimers) timers due
+ *                  in 10 s to 1000 s, all pending at once
+ *   reschedule     moving each of them somewhere else in that range
+ *   cancel         cancelling each of them
+ *   fire           as many timers spread over kSpread ms, lateness of their
+ *                  run against the time asked for, at the default 1 ms tick
+ *   retry          kRetries retries, each kRetryDelay after the failure,
+ *                  until all of them ran: sleeping in a task, the old
+ *                  way, a worker per retry, against schedule_after()
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+#include "harness.hpp"
+#include "thread_pool.hpp"
+
+static const size_t kMinTimers = 100000;
+static const size_t kRetries = 64;
+static const std::chrono::milliseconds kRetryDelay(10);
+static const int64_t kSpread = 1000;    // ms the fire benchmark spreads its timers over.
+
+// Median of the values, which get sorted.
+static double middle(std::vector<double> &values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+static void bench_wheel(BenchReport &report, const BenchOptions &options)
+{
+    size_t n = std::max(options.tasks, kMinTimers);
+    std::vector<double> arm, reschedule, cancel;
+    for (size_t r = 0; r < options.repeat; ++r) {
+        ThreadPool pool(1);
+        pool.initialize();
+        std::vector<ThreadPool::Timer> timers(n);
+
+        int64_t start = bench_now();
+        for (size_t i = 0; i < n; ++i)
+            timers[i] = pool.schedule_after(std::chrono::milliseconds(10000 + i * 7919 % 990000), [] { });
+        int64_t armed = bench_now();
+        for (size_t i = 0; i < n; ++i)
+            timers[i].reschedule(std::chrono::milliseconds(10000 + i * 104729 % 990000));
+        int64_t moved = bench_now();
+        for (size_t i = 0; i < n; ++i)
+            timers[i].cancel();
+        int64_t end = bench_now();
+        pool.shutdown();
+
+        arm.push_back(n * 1e9 / std::max(armed - start, (int64_t)1));
+        reschedule.push_back(n * 1e9 / std::max(moved - armed, (int64_t)1));
+        cancel.push_back(n * 1e9 / std::max(end - moved, (int64_t)1));
+    }
+    report.add("arm", "ThreadPool", 1, "throughput", middle(arm), "timers/s");
+    report.add("reschedule", "ThreadPool", 1, "throughput", middle(reschedule), "timers/s");
+    report.add("cancel", "ThreadPool", 1, "throughput", middle(cancel), "timers/s");
+}
+
+static void bench_fire(BenchReport &report, size_t threads, const BenchOptions &options)
+{
+    size_t n = std::max(options.tasks, kMinTimers);
+    std::vector<int64_t> late(n);
+    Countdown done(n);
+    {
+        ThreadPool pool((int)threads);
+        pool.initialize();
+        int64_t start = bench_now() + 10000000 + (int64_t)n * 5000;     // Everything armed by then.
+        for (size_t i = 0; i < n; ++i) {
+            int64_t due = start + (int64_t)(i * kSpread * 1000000 / n);
+            pool.schedule_after(std::chrono::nanoseconds(due - bench_now()), [&late, &done, i, due] {
+                late[i] = bench_now() - due;
+                done.arrive();
+            });
+        }
+        done.wait();
+        pool.shutdown();
+    }
+    report.add("fire", "ThreadPool", threads, "late_p50", percentile(late, 0.5) / 1e3, "us");
+    report.add("fire", "ThreadPool", threads, "late_p99", percentile(late, 0.99) / 1e3, "us");
+}
+
+static void bench_retry(BenchReport &report, size_t threads, bool timers, const BenchOptions &options)
+{
+    double elapsed = median_of(options.repeat, [&] {
+        ThreadPool pool((int)threads);
+        pool.initialize();
+        Countdown done(kRetries);
+        int64_t start = bench_now();
+        for (size_t i = 0; i < kRetries; ++i) {
+            if (timers) {
+                pool.schedule_after(kRetryDelay, [&done] { done.arrive(); });
+            } else {
+                pool.post([&done] {
+                    std::this_thread::sleep_for(kRetryDelay);
+                    done.arrive();
+                });
+            }
+        }
+        done.wait();
+        int64_t end = bench_now();
+        pool.shutdown();
+        return (end - start) / 1e6;
+    });
+    report.add("retry", timers ? "schedule_after" : "sleep_for", threads, "elapsed", elapsed, "ms");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options = BenchOptions::parse(argc, argv);
+    BenchReport report(options);
+
+    bench_wheel(report, options);
+
+    std::vector<size_t> counts = options.thread_counts();
+    for (size_t c = 0; c < counts.size(); ++c) {
+        bench_fire(report, counts[c], options);
+        bench_retry(report, counts[c], false, options);
+        bench_retry(report, counts[c], true, options);
+    }
+
+    return report.save() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
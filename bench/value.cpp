@@ -0,0 +1,223 @@
+/*
+ * value (src/value.hpp) against the usual ways of holding a dynamic value:
+ *
+ *   value          16 bytes, short strings inline
+ *   std::variant   of the same alternatives, std::string and
+ *                  std::vector<uint8_t> by value (built with CXXSTD=c++17
+ *                  or later)
+ *   json-like      the layout of a typical JSON library value such as
+ *                  nlohmann::json: a type byte and an 8-byte union, every
+ *                  string or binary behind its own heap object
+ *
+ * on a mix of integers, doubles, booleans, short and long strings. Per
+ * value: its size, heap bytes, and the time to build, copy and relocate a
+ * vector of them. Relocation is what a growing vector does: memcpy for
+ * value, element-wise moves for the others.
+ *
+ *   pack           the mix encoded into and decoded out of a 64 MiB
+ *                  buffer (src/value_pack.hpp), against memcpy of the
+ *                  same buffer; the decoder's heap bytes per value
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <variant>
+#endif
+#include "harness.hpp"
+#include "value.hpp"
+#include "value_pack.hpp"
+
+static size_t g_heap = 0;   // Bytes allocated through operator new.
+
+void *operator new(size_t size)
+{
+    g_heap += size;
+    if (void *p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+static const char *const kShort = "task-42";
+static const char *const kLong = "a parameter string too long for any inline buffer";
+
+struct JsonLike
+{
+    value_t type = value_t::null;
+    union {
+        bool boolean;
+        int64_t integer;
+        uint64_t unsigned_integer;
+        double number;
+        std::string *string;
+        std::vector<uint8_t> *binary;
+    };
+
+    JsonLike() : integer(0) { }
+    JsonLike(int64_t v) : type(value_t::number_integer), integer(v) { }
+    JsonLike(uint64_t v) : type(value_t::number_unsigned), unsigned_integer(v) { }
+    JsonLike(double v) : type(value_t::number_float), number(v) { }
+    JsonLike(bool v) : type(value_t::boolean), boolean(v) { }
+    JsonLike(const char *s) : type(value_t::string), string(new std::string(s)) { }
+
+    JsonLike(const JsonLike &other) : type(other.type), integer(other.integer)
+    {
+        if (type == value_t::string)
+            string = new std::string(*other.string);
+        else if (type == value_t::binary)
+            binary = new std::vector<uint8_t>(*other.binary);
+    }
+
+    JsonLike(JsonLike &&other) noexcept : type(other.type), integer(other.integer) { other.type = value_t::null; }
+
+    ~JsonLike()
+    {
+        if (type == value_t::string)
+            delete string;
+        else if (type == value_t::binary)
+            delete binary;
+    }
+};
+
+#if __cplusplus >= 201703L
+typedef std::variant<std::monostate, bool, int64_t, uint64_t, double, std::string, std::vector<uint8_t>> Variant;
+#endif
+
+template <typename T>
+static T make_string(const char *s) { return T(s); }
+
+#if __cplusplus >= 201703L
+template <>
+Variant make_string<Variant>(const char *s) { return Variant(std::string(s)); }
+#endif
+
+// The i-th value of the mix.
+template <typename T>
+static T make_value(size_t i)
+{
+    switch (i % 6) {
+    case 0:     return T((int64_t)i);
+    case 1:     return T((double)i * 0.5);
+    case 2:     return T(i % 4 == 0);
+    case 3:     return make_string<T>(kShort);
+    case 4:     return make_string<T>(kLong);
+    default:    return T((uint64_t)i << 20);
+    }
+}
+
+template <typename T>
+static void relocate(T *to, T *from, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        new (to + i) T(std::move(from[i]));
+        from[i].~T();
+    }
+}
+
+static void relocate(value *to, value *from, size_t count) { value::relocate(to, from, count); }
+
+template <typename T>
+static void bench_value(BenchReport &report, const char *name, const BenchOptions &options)
+{
+    size_t n = options.tasks;
+    report.add("value", name, 1, "sizeof", (double)sizeof(T), "bytes");
+
+    std::vector<T> values;
+    values.reserve(n);
+    size_t heap = g_heap;
+    for (size_t i = 0; i < n; ++i)
+        values.push_back(make_value<T>(i));
+    report.add("value", name, 1, "heap", (double)(g_heap - heap) / n, "bytes/value");
+
+    double build = median_of(options.repeat, [&] {
+        std::vector<T> built;
+        built.reserve(n);
+        int64_t start = bench_now();
+        for (size_t i = 0; i < n; ++i)
+            built.push_back(make_value<T>(i));
+        return (double)(bench_now() - start) / n;
+    });
+    report.add("value", name, 1, "build", build, "ns/value");
+
+    double copy = median_of(options.repeat, [&] {
+        int64_t start = bench_now();
+        std::vector<T> copied(values);
+        return (double)(bench_now() - start) / n;
+    });
+    report.add("value", name, 1, "copy", copy, "ns/value");
+
+    double move = median_of(options.repeat, [&] {
+        T *to = static_cast<T *>(::operator new(n * sizeof(T)));
+        int64_t start = bench_now();
+        relocate(to, values.data(), n);
+        relocate(values.data(), to, n);
+        double ns = (double)(bench_now() - start) / (2 * n);
+        ::operator delete(to);
+        return ns;
+    });
+    report.add("value", name, 1, "relocate", move, "ns/value");
+}
+
+static void bench_pack(BenchReport &report, const BenchOptions &options)
+{
+    std::vector<value> values;
+    for (size_t i = 0; i < std::max(options.tasks, (size_t)6); ++i)
+        values.push_back(make_value<value>(i));
+    std::vector<char> buffer(64 << 20), copy(buffer.size());
+
+    size_t size = 0, count = 0;
+    double encode = median_of(options.repeat, [&] {
+        ValueEncoder encoder(buffer.data(), buffer.size());
+        int64_t start = bench_now();
+        for (count = 0; encoder.pack(values[count % values.size()]); ++count)
+            ;
+        size = encoder.size();
+        return (double)size * 1000 / (bench_now() - start);
+    });
+    report.add("pack", "encode", 1, "throughput", encode, "MB/s");
+
+    size_t heap = 0;
+    double decode = median_of(options.repeat, [&] {
+        ValueDecoder decoder(buffer.data(), size);
+        ValueView view;
+        size_t bytes = 0, n = 0;
+        size_t before = g_heap;
+        int64_t start = bench_now();
+        for (; decoder.next(view); ++n)
+            bytes += view.size;
+        double rate = (double)size * 1000 / (bench_now() - start);
+        heap = g_heap - before;
+        if (n != count || bytes == 0)
+            fprintf(stderr, "pack: decoded %zu of %zu values\n", n, count);
+        return rate;
+    });
+    report.add("pack", "decode", 1, "throughput", decode, "MB/s");
+    report.add("pack", "decode", 1, "heap", (double)heap / count, "bytes/value");
+
+    double bandwidth = median_of(options.repeat, [&] {
+        int64_t start = bench_now();
+        memcpy(copy.data(), buffer.data(), size);
+        return (double)size * 1000 / (bench_now() - start);
+    });
+    report.add("pack", "memcpy", 1, "throughput", bandwidth, "MB/s");
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions options = BenchOptions::parse(argc, argv);
+    BenchReport report(options);
+
+    bench_value<value>(report, "value", options);
+#if __cplusplus >= 201703L
+    bench_value<Variant>(report, "std::variant", options);
+#endif
+    bench_value<JsonLike>(report, "json-like", options);
+    bench_pack(report, options);
+
+    return report.save() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
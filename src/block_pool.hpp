@@ -0,0 +1,177 @@
+#ifndef _BLOCK_POOL_HPP_
+#define _BLOCK_POOL_HPP_
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/*
+ * Size-class block pool for small, short-lived objects such as the shared
+ * state behind a future.
+ *
+ * Every thread keeps its own free lists, so allocate/deallocate are a couple
+ * of pointer moves. Blocks freed on another thread than the one that
+ * allocated them (the usual case for a task: submitted here, finished on a
+ * worker) flow back through a global depot in batches, one lock per batch.
+ */
+class BlockPool
+{
+public:
+    static const size_t kClasses = 4;           // 32, 64, 128 and 256 bytes.
+    static const size_t kMaxBlockSize = 32 << (kClasses - 1);
+    static const size_t kBatch = 64;            // Blocks moved per depot trip.
+
+    static void *allocate(size_t size)
+    {
+        if (size > kMaxBlockSize)
+            return ::operator new(size);
+
+        return cache().pop(index(size));
+    }
+
+    static void deallocate(void *p, size_t size)
+    {
+        if (size > kMaxBlockSize) {
+            ::operator delete(p);
+            return;
+        }
+
+        cache().push(index(size), p);
+    }
+
+private:
+    struct Block
+    {
+        Block *next;
+    };
+
+    struct FreeList
+    {
+        Block *head = nullptr;
+        size_t count = 0;
+    };
+
+    // Batches of free blocks handed between threads.
+    class Depot
+    {
+    public:
+        bool take(size_t cls, FreeList &list)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (batches_[cls].empty())
+                return false;
+
+            list = batches_[cls].back();
+            batches_[cls].pop_back();
+            return true;
+        }
+
+        void give(size_t cls, const FreeList &list)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batches_[cls].push_back(list);
+        }
+
+    private:
+        std::mutex mutex_;
+        std::vector<FreeList> batches_[kClasses];
+    };
+
+    class Cache
+    {
+    public:
+        ~Cache()
+        {
+            for (size_t cls = 0; cls < kClasses; ++cls) {
+                if (lists_[cls].count)
+                    depot().give(cls, lists_[cls]);
+            }
+        }
+
+        void *pop(size_t cls)
+        {
+            FreeList &list = lists_[cls];
+            if (!list.head && !depot().take(cls, list))
+                return ::operator new(32 << cls);
+
+            Block *block = list.head;
+            list.head = block->next;
+            --list.count;
+            return block;
+        }
+
+        void push(size_t cls, void *p)
+        {
+            FreeList &list = lists_[cls];
+            Block *block = static_cast<Block *>(p);
+            block->next = list.head;
+            list.head = block;
+
+            // Keep one batch for ourselves, hand the next one back.
+            if (++list.count == 2 * kBatch) {
+                FreeList batch;
+                for (size_t i = 0; i < kBatch; ++i) {
+                    Block *b = list.head;
+                    list.head = b->next;
+                    b->next = batch.head;
+                    batch.head = b;
+                }
+                batch.count = kBatch;
+                list.count -= kBatch;
+                depot().give(cls, batch);
+            }
+        }
+
+    private:
+        FreeList lists_[kClasses];
+    };
+
+    static size_t index(size_t size)
+    {
+        size_t cls = 0;
+        while ((size_t)32 << cls < size)
+            ++cls;
+        return cls;
+    }
+
+    static Cache &cache()
+    {
+        static thread_local Cache cache;
+        return cache;
+    }
+
+    // Never destroyed: thread caches may still flush into it at exit.
+    static Depot &depot()
+    {
+        static Depot *depot = new Depot;
+        return *depot;
+    }
+};
+
+/*
+ * Standard allocator on top of BlockPool, e.g. for
+ * std::promise<T>(std::allocator_arg, PoolAllocator<T>()).
+ */
+template <typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+
+    PoolAllocator() { }
+    template <typename U> PoolAllocator(const PoolAllocator<U> &) { }
+
+    T *allocate(size_t n) { return static_cast<T *>(BlockPool::allocate(n * sizeof(T))); }
+    void deallocate(T *p, size_t n) { BlockPool::deallocate(p, n * sizeof(T)); }
+
+    template <typename U> struct rebind { using other = PoolAllocator<U>; };
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T> &, const PoolAllocator<U> &) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T> &, const PoolAllocator<U> &) { return false; }
+
+#endif //_BLOCK_POOL_HPP_
@@ -0,0 +1,223 @@
+#ifndef _CANCEL_HPP_
+#define _CANCEL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "task.hpp"
+
+/*
+ * Cooperative cancellation and expiring tasks.
+ *
+ *     CancelSource source;
+ *     auto a = pool.submit(source.token(), handle, request);
+ *     auto b = pool.submit_with_deadline(clock::now() + 50ms, handle, request);
+ *     source.cancel();
+ *
+ * A task whose token is cancelled, or whose deadline has passed, by the
+ * time a worker takes it is dropped: it does not run and its future throws
+ * TaskCancelled, or TaskExpired past the deadline. A task already running
+ * is never interrupted, it polls task_stop_requested() and gives up early
+ * if it wants to.
+ */
+
+class TaskCancelled : public std::runtime_error
+{
+public:
+    TaskCancelled() : std::runtime_error("task cancelled") { }
+
+protected:
+    explicit TaskCancelled(const char *what) : std::runtime_error(what) { }
+};
+
+class TaskExpired : public TaskCancelled
+{
+public:
+    TaskExpired() : TaskCancelled("task deadline expired") { }
+};
+
+/*
+ * Shared, read-only view of a CancelSource: one pointer, copies bump a
+ * reference count. A default constructed token is never cancelled.
+ */
+class CancelToken
+{
+public:
+    CancelToken() { }
+    CancelToken(const CancelToken &other) : state_(other.state_) { retain(); }
+    CancelToken(CancelToken &&other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+
+    CancelToken &operator=(CancelToken other) noexcept
+    {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+
+    ~CancelToken() { release(); }
+
+    bool cancelled() const { return state_ && state_->cancelled.load(std::memory_order_acquire); }
+
+    // False for a default constructed token, which nothing can cancel.
+    bool cancellable() const { return state_ != nullptr; }
+
+private:
+    friend class CancelSource;
+
+    struct State
+    {
+        std::atomic<uint32_t> refs { 1 };
+        std::atomic<bool> cancelled { false };
+    };
+
+    explicit CancelToken(State *state) : state_(state) { }
+
+    void retain()
+    {
+        if (state_)
+            state_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release()
+    {
+        if (state_ && state_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete state_;
+    }
+
+private:
+    State *state_ = nullptr;
+};
+
+// Cancels every token it handed out. Copies share the same state.
+class CancelSource
+{
+public:
+    CancelSource() : token_(new CancelToken::State) { }
+
+    CancelToken token() const { return token_; }
+
+    void cancel() { token_.state_->cancelled.store(true, std::memory_order_release); }
+
+    bool cancelled() const { return token_.cancelled(); }
+
+private:
+    CancelToken token_;
+};
+
+// What the task running on the calling thread can be stopped by.
+struct CancelScope
+{
+    const CancelToken *token;
+    std::chrono::steady_clock::time_point deadline;
+
+    static const CancelScope *&current()
+    {
+        static thread_local const CancelScope *scope = nullptr;
+        return scope;
+    }
+};
+
+// True once the task running on the calling thread has been cancelled or
+// is past its deadline. Always false outside cancellable tasks.
+inline bool task_stop_requested()
+{
+    const CancelScope *scope = CancelScope::current();
+    if (!scope)
+        return false;
+    return scope->token->cancelled() || (scope->deadline != std::chrono::steady_clock::time_point::max()
+            && std::chrono::steady_clock::now() >= scope->deadline);
+}
+
+/*
+ * A PromiseInvoker that checks its token and deadline before running.
+ * Dropped unrun, by a check or because the pool discarded it, it fails
+ * the future with TaskCancelled instead of leaving it broken.
+ *
+ * 56 bytes for a function pointer and two ints, so it still fits a Task
+ * inline: deadline_ doubles as the "not run yet" flag, kSettled once run
+ * or moved from.
+ */
+template <typename Invoker>
+class CancellableInvoker
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    CancellableInvoker(Invoker &&invoker, CancelToken &&token, clock::time_point deadline)
+        : invoker_(std::move(invoker)), token_(std::move(token)), deadline_(deadline)
+    { }
+
+    CancellableInvoker(CancellableInvoker &&other) noexcept(std::is_nothrow_move_constructible<Invoker>::value)
+        : invoker_(std::move(other.invoker_)), token_(std::move(other.token_)), deadline_(other.deadline_)
+    {
+        other.deadline_ = kSettled;
+    }
+
+    ~CancellableInvoker()
+    {
+        if (deadline_ != kSettled)
+            invoker_.fail(error<TaskCancelled>());
+    }
+
+    void operator()()
+    {
+        clock::time_point deadline = deadline_;
+        deadline_ = kSettled;
+        if (token_.cancelled()) {
+            invoker_.fail(error<TaskCancelled>());
+        } else if (deadline != clock::time_point::max() && clock::now() >= deadline) {
+            invoker_.fail(error<TaskExpired>());
+        } else {
+            CancelScope scope = { &token_, deadline };
+            const CancelScope *outer = CancelScope::current();
+            CancelScope::current() = &scope;
+            invoker_();
+            CancelScope::current() = outer;
+        }
+    }
+
+private:
+    static constexpr clock::time_point kSettled = clock::time_point::min();
+
+    // One exception object shared by every dropped task, shedding a backlog
+    // should not allocate per task.
+    template <typename Error>
+    static std::exception_ptr error()
+    {
+        static const std::exception_ptr error = std::make_exception_ptr(Error());
+        return error;
+    }
+
+    Invoker invoker_;
+    CancelToken token_;
+    clock::time_point deadline_;
+};
+
+template <typename Invoker>
+constexpr std::chrono::steady_clock::time_point CancellableInvoker<Invoker>::kSettled;
+
+/*
+ * package_task() for a task that may be dropped: cancelled through token,
+ * or expired at deadline (time_point::max() for none).
+ */
+template <typename TaskType, typename Function, typename...Args>
+auto package_cancellable_task(TaskType &task, CancelToken token, std::chrono::steady_clock::time_point deadline,
+        Function &&f, Args&&... args)
+    -> std::future<decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...)())>
+{
+    using bound_type = decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+    using return_type = decltype(std::declval<bound_type &>()());
+    using invoker_type = PromiseInvoker<return_type, bound_type>;
+
+    std::promise<return_type> promise(std::allocator_arg, PoolAllocator<char>());
+    std::future<return_type> future = promise.get_future();
+    task = TaskType(CancellableInvoker<invoker_type>(
+                invoker_type(std::bind(std::forward<Function>(f), std::forward<Args>(args)...), std::move(promise)),
+                std::move(token), deadline));
+    return future;
+}
+
+#endif //_CANCEL_HPP_
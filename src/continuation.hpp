@@ -0,0 +1,529 @@
+#ifndef _CONTINUATION_HPP_
+#define _CONTINUATION_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "task.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Futures that chain instead of block.
+ *
+ *     Async<int> a = async_on(pool, load, path);
+ *     Async<void> b = a.then([](const int &n) { store(n); });
+ *     when_all(parts).then(merge).wait();
+ *
+ * A continuation is queued by whichever thread completes its antecedent,
+ * usually a worker, so with Schedule::work_stealing it lands on that
+ * worker's own deque and runs while the data is still in its cache. Nobody
+ * sits blocked in get() in between.
+ *
+ * A task dropped unrun by shutdown() fails its Async with TaskCancelled,
+ * and so does everything chained after it.
+ *
+ * Executor is the pool's type, ThreadPool unless async_on() was given
+ * another BasicExecutor; continuations are that pool's own tasks.
+ */
+template <typename T, typename Executor = ThreadPool> class Async;
+
+// Storage for the result, nothing to store for void.
+template <typename T>
+class AsyncSlot
+{
+public:
+    ~AsyncSlot()
+    {
+        if (set_)
+            get().~T();
+    }
+
+    template <typename U>
+    void put(U &&value)
+    {
+        new (&storage_) T(std::forward<U>(value));
+        set_ = true;
+    }
+
+    const T &get() const { return *reinterpret_cast<const T *>(&storage_); }
+    T &get() { return *reinterpret_cast<T *>(&storage_); }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    bool set_ = false;
+};
+
+template <>
+class AsyncSlot<void>
+{
+public:
+    void get() const { }
+};
+
+/*
+ * Shared state of an Async: the result, or the exception, plus what to run
+ * once either is there. Continuations registered after completion are
+ * dispatched right away by the registering thread.
+ */
+template <typename T, typename Executor = ThreadPool>
+class AsyncState
+{
+public:
+    using task_type = typename Executor::task_type;
+
+    explicit AsyncState(Executor *pool) : pool_(pool) { }
+    AsyncState(const AsyncState &other) = delete;
+    void operator=(const AsyncState &other) = delete;
+
+    Executor *pool() const { return pool_; }
+
+    template <typename...U>
+    void set_value(U&&... value)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            put(slot_, std::forward<U>(value)...);
+        }
+        complete();
+    }
+
+    void set_exception(std::exception_ptr error)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = error;
+        }
+        complete();
+    }
+
+    // Inline continuations run on the completing thread and must be short
+    // (when_all bookkeeping), the others are queued on the pool.
+    void on_ready(task_type &&continuation, bool run_inline = false)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!ready_) {
+                continuations_.push_back(Continuation { std::move(continuation), run_inline });
+                return;
+            }
+        }
+        dispatch(continuation, run_inline);
+    }
+
+    bool ready() const { return ready_.load(std::memory_order_acquire); }
+
+    void wait()
+    {
+        if (ready())
+            return;
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return ready(); });
+    }
+
+    // Only valid once ready().
+    std::exception_ptr error() const { return error_; }
+    const AsyncSlot<T> &slot() const { return slot_; }
+
+private:
+    struct Continuation
+    {
+        task_type task;
+        bool run_inline;
+    };
+
+    template <typename U>
+    static void put(AsyncSlot<U> &slot, U &&value) { slot.put(std::move(value)); }
+    template <typename U>
+    static void put(AsyncSlot<U> &slot, const U &value) { slot.put(value); }
+    static void put(AsyncSlot<void> &) { }
+
+    void complete()
+    {
+        std::vector<Continuation> continuations;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready_.store(true, std::memory_order_release);
+            continuations.swap(continuations_);
+        }
+        cond_.notify_all();
+
+        for (size_t i = 0; i < continuations.size(); ++i)
+            dispatch(continuations[i].task, continuations[i].run_inline);
+    }
+
+    void dispatch(task_type &continuation, bool run_inline)
+    {
+        if (run_inline)
+            continuation();
+        else
+            pool_->enqueue(std::move(continuation));
+    }
+
+private:
+    Executor *pool_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::atomic<bool> ready_ { false };
+    std::exception_ptr error_;
+    AsyncSlot<T> slot_;
+    std::vector<Continuation> continuations_;
+};
+
+/*
+ * What a queued task completes its state through. Destroyed while still
+ * holding it, the task dropped unrun, it fails the state with TaskCancelled
+ * so that get() throws instead of blocking forever.
+ */
+template <typename T, typename Executor>
+class AsyncPromise
+{
+public:
+    explicit AsyncPromise(const std::shared_ptr<AsyncState<T, Executor>> &state) : state_(state) { }
+    AsyncPromise(AsyncPromise &&other) = default;
+    void operator=(const AsyncPromise &other) = delete;
+
+    ~AsyncPromise()
+    {
+        if (state_)
+            state_->set_exception(std::make_exception_ptr(TaskCancelled()));
+    }
+
+    // Hands the state to the task about to complete it.
+    std::shared_ptr<AsyncState<T, Executor>> release() { return std::move(state_); }
+
+private:
+    std::shared_ptr<AsyncState<T, Executor>> state_;
+};
+
+// Runs f(args...) and stores what it returns, or what it throws, in state.
+template <typename R>
+struct AsyncFulfill
+{
+    template <typename State, typename Function, typename...Args>
+    static void run(State &state, Function &f, Args&&... args)
+    {
+        try {
+            state.set_value(f(std::forward<Args>(args)...));
+        } catch (...) {
+            state.set_exception(std::current_exception());
+        }
+    }
+};
+
+template <>
+struct AsyncFulfill<void>
+{
+    template <typename State, typename Function, typename...Args>
+    static void run(State &state, Function &f, Args&&... args)
+    {
+        try {
+            f(std::forward<Args>(args)...);
+        } catch (...) {
+            state.set_exception(std::current_exception());
+            return;
+        }
+        state.set_value();
+    }
+};
+
+// What f returns when called with the result of an Async<T>.
+template <typename T, typename Function>
+struct ContinuationResult
+{
+    using type = decltype(std::declval<Function &>()(std::declval<const T &>()));
+};
+
+template <typename Function>
+struct ContinuationResult<void, Function>
+{
+    using type = decltype(std::declval<Function &>()());
+};
+
+// Body of then(): forwards the antecedent's exception, or feeds f its value.
+template <typename T, typename R, typename Function, typename Executor>
+struct ThenTask
+{
+    std::shared_ptr<AsyncState<T, Executor>> from;
+    AsyncPromise<R, Executor> promise;
+    Function func;
+
+    void operator()()
+    {
+        std::shared_ptr<AsyncState<R, Executor>> to = promise.release();
+        if (from->error())
+            to->set_exception(from->error());
+        else
+            AsyncFulfill<R>::run(*to, func, from->slot().get());
+    }
+};
+
+template <typename R, typename Function, typename Executor>
+struct ThenTask<void, R, Function, Executor>
+{
+    std::shared_ptr<AsyncState<void, Executor>> from;
+    AsyncPromise<R, Executor> promise;
+    Function func;
+
+    void operator()()
+    {
+        std::shared_ptr<AsyncState<R, Executor>> to = promise.release();
+        if (from->error())
+            to->set_exception(from->error());
+        else
+            AsyncFulfill<R>::run(*to, func);
+    }
+};
+
+/*
+ * Handle to a result that may not exist yet. Copies share the state, every
+ * copy may attach continuations.
+ */
+template <typename T, typename Executor>
+class Async
+{
+public:
+    using value_type = T;
+    using executor_type = Executor;
+
+    Async() { }
+    explicit Async(const std::shared_ptr<AsyncState<T, Executor>> &state) : state_(state) { }
+
+    bool valid() const { return state_ != nullptr; }
+    bool ready() const { return state_->ready(); }
+    void wait() const { state_->wait(); }
+
+    // Blocks until ready, then returns the result or rethrows the exception.
+    typename std::add_lvalue_reference<const T>::type get() const
+    {
+        state_->wait();
+        if (state_->error())
+            std::rethrow_exception(state_->error());
+        return state_->slot().get();
+    }
+
+    // Queues f(result) on the pool once this is ready; f(), for Async<void>.
+    // An exception skips f and travels down the chain instead.
+    template <typename Function>
+    Async<typename ContinuationResult<T, typename std::decay<Function>::type>::type, Executor> then(Function &&f) const
+    {
+        using Fn = typename std::decay<Function>::type;
+        using R = typename ContinuationResult<T, Fn>::type;
+
+        std::shared_ptr<AsyncState<R, Executor>> next = std::make_shared<AsyncState<R, Executor>>(state_->pool());
+        state_->on_ready(ThenTask<T, R, Fn, Executor> {
+                state_, AsyncPromise<R, Executor>(next), std::forward<Function>(f) });
+        return Async<R, Executor>(next);
+    }
+
+    const std::shared_ptr<AsyncState<T, Executor>> &state() const { return state_; }
+
+private:
+    std::shared_ptr<AsyncState<T, Executor>> state_;
+};
+
+template <typename R, typename Bound, typename Executor>
+struct AsyncTask
+{
+    AsyncPromise<R, Executor> promise;
+    Bound func;
+
+    void operator()() { AsyncFulfill<R>::run(*promise.release(), func); }
+};
+
+// Queues f(args...) on pool, the entry point of a chain.
+template <typename Executor, typename Function, typename...Args>
+auto async_on(Executor &pool, Function &&f, Args&&... args)
+    -> Async<decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...)()), Executor>
+{
+    using bound_type = decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+    using return_type = decltype(std::declval<bound_type &>()());
+    using state_type = AsyncState<return_type, Executor>;
+
+    std::shared_ptr<state_type> state = std::make_shared<state_type>(&pool);
+    pool.enqueue(AsyncTask<return_type, bound_type, Executor> {
+            AsyncPromise<return_type, Executor>(state),
+            std::bind(std::forward<Function>(f), std::forward<Args>(args)...) });
+    return Async<return_type, Executor>(state);
+}
+
+/*
+ * Outcomes of the inputs of when_all(), copied in as each input completes,
+ * so that nothing here refers back to the inputs: they hold this through
+ * their continuations, the other way round would be a cycle.
+ */
+template <typename T>
+struct WhenAllValues
+{
+    explicit WhenAllValues(size_t n) : slots(new AsyncSlot<T>[n]) { }
+
+    void put(size_t index, const AsyncSlot<T> &slot) { slots[index].put(slot.get()); }
+
+    template <typename State>
+    void publish(State &result, size_t n)
+    {
+        std::vector<T> values;
+        values.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+            values.push_back(std::move(slots[i].get()));
+        result.set_value(std::move(values));
+    }
+
+    std::unique_ptr<AsyncSlot<T>[]> slots;
+};
+
+template <>
+struct WhenAllValues<void>
+{
+    explicit WhenAllValues(size_t) { }
+
+    void put(size_t, const AsyncSlot<void> &) { }
+
+    template <typename State>
+    void publish(State &result, size_t) { result.set_value(); }
+};
+
+// Bookkeeping of when_all(), the last input to complete publishes.
+template <typename T, typename Result, typename Executor>
+struct WhenAllState
+{
+    WhenAllState(size_t n, Executor *pool)
+        : size(n), remaining(n), result(std::make_shared<AsyncState<Result, Executor>>(pool)), errors(n), values(n)
+    { }
+
+    void arrive()
+    {
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        for (size_t i = 0; i < size; ++i) {
+            if (errors[i]) {
+                result->set_exception(errors[i]);
+                return;
+            }
+        }
+        values.publish(*result, size);
+    }
+
+    size_t size;
+    std::atomic<size_t> remaining;
+    std::shared_ptr<AsyncState<Result, Executor>> result;
+    std::vector<std::exception_ptr> errors;
+    WhenAllValues<T> values;
+};
+
+// Inline continuation of input index. Dropped unrun, the input destroyed
+// before completing, it counts as a TaskCancelled input.
+template <typename T, typename Result, typename Executor>
+class WhenAllTask
+{
+public:
+    WhenAllTask(const std::shared_ptr<WhenAllState<T, Result, Executor>> &state,
+            const AsyncState<T, Executor> *input, size_t index)
+        : state_(state), input_(input), index_(index)
+    { }
+
+    WhenAllTask(WhenAllTask &&other) noexcept
+        : state_(std::move(other.state_)), input_(other.input_), index_(other.index_)
+    {
+        other.input_ = nullptr;
+    }
+
+    ~WhenAllTask()
+    {
+        if (input_) {
+            state_->errors[index_] = std::make_exception_ptr(TaskCancelled());
+            state_->arrive();
+        }
+    }
+
+    // Runs on the thread completing input, or registering on a ready one:
+    // either way input is alive and done.
+    void operator()()
+    {
+        const AsyncState<T, Executor> *input = input_;
+        input_ = nullptr;
+        if (input->error())
+            state_->errors[index_] = input->error();
+        else
+            state_->values.put(index_, input->slot());
+        state_->arrive();
+    }
+
+private:
+    std::shared_ptr<WhenAllState<T, Result, Executor>> state_;
+    const AsyncState<T, Executor> *input_;
+    size_t index_;
+};
+
+template <typename T>
+struct WhenAllResult
+{
+    using type = std::vector<T>;
+};
+
+template <>
+struct WhenAllResult<void>
+{
+    using type = void;
+};
+
+/*
+ * Ready once every input is: Async<vector<T>> holding the results in input
+ * order, Async<void> for void inputs. Carries the exception of the first
+ * failed input, by position. The inputs must share one pool.
+ */
+template <typename T, typename Executor>
+Async<typename WhenAllResult<T>::type, Executor> when_all(const std::vector<Async<T, Executor>> &inputs)
+{
+    using Result = typename WhenAllResult<T>::type;
+    using state_type = WhenAllState<T, Result, Executor>;
+
+    if (inputs.empty())
+        throw std::invalid_argument("when_all: no inputs");
+
+    std::shared_ptr<state_type> state = std::make_shared<state_type>(inputs.size(), inputs.front().state()->pool());
+
+    Async<Result, Executor> result(state->result);
+    for (size_t i = 0; i < inputs.size(); ++i)
+        inputs[i].state()->on_ready(WhenAllTask<T, Result, Executor>(state, inputs[i].state().get(), i), true);
+    return result;
+}
+
+template <typename Executor>
+struct WhenAnyTask
+{
+    std::shared_ptr<AsyncState<size_t, Executor>> result;
+    std::shared_ptr<std::atomic<bool>> done;
+    size_t index;
+
+    void operator()()
+    {
+        if (!done->exchange(true, std::memory_order_acq_rel))
+            result->set_value(index);
+    }
+};
+
+// Ready as soon as one input is, holding that input's index. A failed
+// input counts as ready: its get() rethrows.
+template <typename T, typename Executor>
+Async<size_t, Executor> when_any(const std::vector<Async<T, Executor>> &inputs)
+{
+    if (inputs.empty())
+        throw std::invalid_argument("when_any: no inputs");
+
+    std::shared_ptr<AsyncState<size_t, Executor>> result =
+        std::make_shared<AsyncState<size_t, Executor>>(inputs.front().state()->pool());
+    std::shared_ptr<std::atomic<bool>> done = std::make_shared<std::atomic<bool>>(false);
+    for (size_t i = 0; i < inputs.size(); ++i)
+        inputs[i].state()->on_ready(WhenAnyTask<Executor> { result, done, i }, true);
+    return Async<size_t, Executor>(result);
+}
+
+#endif //_CONTINUATION_HPP_
@@ -0,0 +1,232 @@
+#ifndef _CORO_HPP_
+#define _CORO_HPP_
+
+#if __cplusplus < 202002L
+#error "coro.hpp needs C++20, build with make CXXSTD=c++20"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <utility>
+#include "continuation.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Coroutines on top of ThreadPool, or any other BasicExecutor.
+ *
+ *     CoTask<Response> handle(ThreadPool &pool, Request request)
+ *     {
+ *         co_await pool.schedule();                      // now on a worker
+ *         Row row = co_await async_on(pool, query, request.id);
+ *         co_return render(row);
+ *     }
+ *
+ *     Async<Response> response = co_spawn(pool, handle(pool, request));
+ *
+ * A suspended coroutine holds no thread. Whatever wakes it (a finished
+ * Async, pool.schedule()) queues its handle as a Task, which fits in the
+ * task's inline storage: resuming allocates nothing. If shutdown() drops
+ * that task, the co_await throws TaskCancelled instead of never returning.
+ */
+template <typename T> class CoTask;
+
+// Resumes whoever awaits the finished coroutine, on the same thread.
+struct CoTaskFinal
+{
+    bool await_ready() const noexcept { return false; }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) const noexcept
+    {
+        std::coroutine_handle<> continuation = handle.promise().continuation;
+        return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() const noexcept { }
+};
+
+struct CoTaskPromiseBase
+{
+    std::suspend_always initial_suspend() const noexcept { return { }; }
+    CoTaskFinal final_suspend() const noexcept { return { }; }
+    void unhandled_exception() { error = std::current_exception(); }
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+};
+
+template <typename T>
+struct CoTaskPromise : CoTaskPromiseBase
+{
+    CoTask<T> get_return_object();
+
+    template <typename U>
+    void return_value(U &&value) { result.emplace(std::forward<U>(value)); }
+
+    T take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*result);
+    }
+
+    std::optional<T> result;
+};
+
+template <>
+struct CoTaskPromise<void> : CoTaskPromiseBase
+{
+    CoTask<void> get_return_object();
+
+    void return_void() { }
+
+    void take()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+/*
+ * Lazy coroutine: the body starts when the CoTask is awaited, and the
+ * awaiting coroutine resumes as soon as the body returns. Move-only, the
+ * frame dies with the CoTask.
+ */
+template <typename T>
+class CoTask
+{
+public:
+    using promise_type = CoTaskPromise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    CoTask() { }
+    explicit CoTask(handle_type handle) : handle_(handle) { }
+    CoTask(CoTask &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)) { }
+
+    CoTask &operator=(CoTask &&other) noexcept
+    {
+        if (this != &other) {
+            if (handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    CoTask(const CoTask &other) = delete;
+    CoTask &operator=(const CoTask &other) = delete;
+
+    ~CoTask()
+    {
+        if (handle_)
+            handle_.destroy();
+    }
+
+    bool valid() const { return handle_ != nullptr; }
+
+    struct Awaiter
+    {
+        handle_type handle;
+
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+
+        T await_resume() { return handle.promise().take(); }
+    };
+
+    Awaiter operator co_await() const & noexcept { return Awaiter { handle_ }; }
+
+private:
+    handle_type handle_;
+};
+
+template <typename T>
+CoTask<T> CoTaskPromise<T>::get_return_object()
+{
+    return CoTask<T>(std::coroutine_handle<CoTaskPromise<T>>::from_promise(*this));
+}
+
+inline CoTask<void> CoTaskPromise<void>::get_return_object()
+{
+    return CoTask<void>(std::coroutine_handle<CoTaskPromise<void>>::from_promise(*this));
+}
+
+/*
+ * co_await on an Async: the coroutine is queued on the Async's pool once
+ * the result is there, get() semantics otherwise (the exception is thrown
+ * at the co_await).
+ */
+template <typename T, typename Executor>
+struct AsyncAwaiter
+{
+    Async<T, Executor> async;
+    bool dropped = false;
+
+    bool await_ready() const { return async.ready(); }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        async.state()->on_ready(typename Executor::Resume(handle, &dropped));
+    }
+
+    decltype(auto) await_resume() const
+    {
+        if (dropped)
+            throw TaskCancelled();
+        return async.get();
+    }
+};
+
+template <typename T, typename Executor>
+AsyncAwaiter<T, Executor> operator co_await(const Async<T, Executor> &async)
+{
+    return AsyncAwaiter<T, Executor> { async, false };
+}
+
+// Fire-and-forget frame behind co_spawn(), freed when its body returns.
+struct CoDetached
+{
+    struct promise_type
+    {
+        CoDetached get_return_object() const noexcept { return { }; }
+        std::suspend_never initial_suspend() const noexcept { return { }; }
+        std::suspend_never final_suspend() const noexcept { return { }; }
+        void return_void() const noexcept { }
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+template <typename T, typename Executor>
+CoDetached co_spawn_run(Executor &pool, CoTask<T> task, std::shared_ptr<AsyncState<T, Executor>> state)
+{
+    try {
+        co_await pool.schedule();
+        if constexpr (std::is_void<T>::value) {
+            co_await task;
+            state->set_value();
+        } else {
+            state->set_value(co_await task);
+        }
+    } catch (...) {
+        state->set_exception(std::current_exception());
+    }
+}
+
+// Starts task on one of pool's workers. The Async carries its result,
+// so it can be waited for, chained with then(), or awaited.
+template <typename T, typename Executor>
+Async<T, Executor> co_spawn(Executor &pool, CoTask<T> task)
+{
+    std::shared_ptr<AsyncState<T, Executor>> state = std::make_shared<AsyncState<T, Executor>>(&pool);
+    co_spawn_run(pool, std::move(task), state);
+    return Async<T, Executor>(state);
+}
+
+#endif //_CORO_HPP_
@@ -0,0 +1,209 @@
+#ifndef _EVENT_COUNT_HPP_
+#define _EVENT_COUNT_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+// Tell the core we are spinning (frees the pipeline for the sibling hyperthread).
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/*
+ * Condition variable for lock-free data structures.
+ *
+ * Waiter:                              Notifier:
+ *     key = ec.prepare_wait();             make the condition true;
+ *     if (condition) {                     ec.notify();
+ *         ec.cancel_wait();
+ *     } else {
+ *         ec.wait(key);
+ *     }
+ *
+ * The state word packs the number of waiters (low half) and an epoch
+ * (high half). prepare_wait() registers and notify() reads the waiter
+ * count, each behind a seq_cst fence, so either the notifier sees the
+ * waiter and bumps the epoch, or the waiter's re-check sees the condition.
+ * wait() only sleeps while the epoch still equals the key, so a notify
+ * landing between the re-check and the sleep is never lost.
+ */
+class EventCount
+{
+public:
+    using Key = uint32_t;
+
+    EventCount() { }
+    EventCount(const EventCount &other) = delete;
+    void operator=(const EventCount &other) = delete;
+
+    Key prepare_wait()
+    {
+        uint64_t prev = state_.fetch_add(kAddWaiter, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return static_cast<Key>(prev >> kEpochShift);
+    }
+
+    void cancel_wait()
+    {
+        state_.fetch_sub(kAddWaiter, std::memory_order_seq_cst);
+    }
+
+    void wait(Key key)
+    {
+        while (static_cast<Key>(state_.load(std::memory_order_acquire) >> kEpochShift) == key)
+            sleep(key);
+        state_.fetch_sub(kAddWaiter, std::memory_order_seq_cst);
+    }
+
+    // Same as wait() but gives up after timeout; false when it did.
+    template <typename Rep, typename Period>
+    bool wait_for(Key key, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        bool notified = true;
+        while (static_cast<Key>(state_.load(std::memory_order_acquire) >> kEpochShift) == key) {
+            auto left = deadline - std::chrono::steady_clock::now();
+            if (left <= std::chrono::steady_clock::duration::zero()) {
+                notified = false;
+                break;
+            }
+            sleep_for(key, std::chrono::duration_cast<std::chrono::nanoseconds>(left));
+        }
+        state_.fetch_sub(kAddWaiter, std::memory_order_seq_cst);
+        return notified;
+    }
+
+    // Returns false when nobody was waiting.
+    bool notify(int n = 1)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t state = state_.load(std::memory_order_relaxed);
+        if ((state & kWaiterMask) == 0)
+            return false;
+
+        state = state_.fetch_add(kAddEpoch, std::memory_order_acq_rel);
+        if ((state & kWaiterMask) == 0)
+            return false;
+
+        wake(n);
+        return true;
+    }
+
+    bool notify_all() { return notify(INT_MAX); }
+
+private:
+    static const uint64_t kAddWaiter = 1;
+    static const uint64_t kWaiterMask = 0xffffffff;
+    static const int kEpochShift = 32;
+    static const uint64_t kAddEpoch = (uint64_t)1 << kEpochShift;
+
+#if defined(__linux__)
+    // The futex word is the epoch half of state_.
+    int *epoch()
+    {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        return reinterpret_cast<int *>(&state_) + 1;
+#else
+        return reinterpret_cast<int *>(&state_);
+#endif
+    }
+
+    void sleep(Key key)
+    {
+        syscall(SYS_futex, epoch(), FUTEX_WAIT_PRIVATE, static_cast<int>(key), nullptr, nullptr, 0);
+    }
+
+    void sleep_for(Key key, std::chrono::nanoseconds timeout)
+    {
+        struct timespec ts;
+        ts.tv_sec = timeout.count() / 1000000000;
+        ts.tv_nsec = timeout.count() % 1000000000;
+        syscall(SYS_futex, epoch(), FUTEX_WAIT_PRIVATE, static_cast<int>(key), &ts, nullptr, 0);
+    }
+
+    void wake(int n)
+    {
+        syscall(SYS_futex, epoch(), FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+    }
+#else
+    void sleep(Key key)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this, key] {
+            return static_cast<Key>(state_.load(std::memory_order_acquire) >> kEpochShift) != key;
+        });
+    }
+
+    void sleep_for(Key key, std::chrono::nanoseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait_for(lock, timeout, [this, key] {
+            return static_cast<Key>(state_.load(std::memory_order_acquire) >> kEpochShift) != key;
+        });
+    }
+
+    void wake(int)
+    {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        cond_.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+#endif
+
+private:
+    std::atomic<uint64_t> state_ { 0 };
+};
+
+/*
+ * What an idle thread does before it parks on an EventCount: poll spins
+ * times with cpu_relax(), then yields times with sched_yield. More polling
+ * means lower wakeup latency for bursty traffic, paid for in CPU time.
+ */
+struct IdlePolicy
+{
+    unsigned spins;
+    unsigned yields;
+
+    static IdlePolicy park() { return IdlePolicy { 0, 0 }; }
+    static IdlePolicy balanced() { return IdlePolicy { 256, 4 }; }
+    static IdlePolicy low_latency() { return IdlePolicy { 1 << 14, 64 }; }
+
+    // Returns true as soon as ready() does, false once the budget is spent.
+    template <typename Ready>
+    bool poll(Ready ready) const
+    {
+        for (unsigned i = 0; i < spins; ++i) {
+            if (ready())
+                return true;
+            cpu_relax();
+        }
+        for (unsigned i = 0; i < yields; ++i) {
+            if (ready())
+                return true;
+            std::this_thread::yield();
+        }
+        return false;
+    }
+};
+
+#endif //_EVENT_COUNT_HPP_
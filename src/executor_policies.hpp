@@ -0,0 +1,555 @@
+#ifndef _EXECUTOR_POLICIES_HPP_
+#define _EXECUTOR_POLICIES_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "event_count.hpp"
+#include "mpmc_queue.hpp"
+#include "priority_lanes.hpp"
+#include "task.hpp"
+#include "thread_safe_queue.hpp"
+#include "topology.hpp"
+#include "work_stealing_queue.hpp"
+
+/*
+ * The policies a BasicExecutor (thread_pool.hpp) is built from, picked at
+ * compile time so that its hot loop holds no virtual call and no branch
+ * for a backend it does not use.
+ *
+ * A queue policy is a class template over the task type:
+ *
+ *     Queue(const WorkerLayout &layout, const ExecutorOptions &options);
+ *     // False only for a bounded queue that is full, task left untouched.
+ *     // node: the NUMA node asked for or -1, set to the one to wake first.
+ *     bool push(T &&task, int worker, int &node, TaskPriority priority,
+ *             std::chrono::steady_clock::time_point deadline);
+ *     // How many of the n tasks went in, all of them unless bounded.
+ *     size_t push_bulk(T *tasks, size_t n, int worker, int &node);
+ *     bool pop(size_t worker, T &task);
+ *     bool empty();
+ *     size_t size();
+ *
+ * worker is the submitting worker's index, -1 for any other thread.
+ *
+ * A wait policy parks idle workers:
+ *
+ *     Wait(const WorkerLayout &layout, const ExecutorOptions &options);
+ *     // Returns once ready() does, or false after timeout when timed.
+ *     template <typename Ready>
+ *     bool wait(size_t node, Ready ready, bool timed, std::chrono::milliseconds timeout);
+ *     void notify(size_t n, int node);    // Up to n workers, those of node first.
+ *     void notify_all();
+ *
+ * A task policy names the task type: InlineTasks<N>.
+ */
+
+enum class ExecutorSchedule
+{
+    shared_queue,   // One queue for all workers.
+    lock_free,      // One bounded lock-free ring for all workers.
+    work_stealing,  // One deque per worker, idle workers steal.
+    priority        // Priority lanes, earliest deadline first in a lane.
+};
+
+enum class ExecutorPlacement
+{
+    none,           // Let the scheduler move workers around.
+    core,           // Pin each worker to its own physical core, nodes taken in turn.
+    node            // Pin each worker to the CPUs of one NUMA node, nodes taken in turn.
+};
+
+struct ExecutorOptions
+{
+    ExecutorSchedule schedule = ExecutorSchedule::shared_queue;   // Of ScheduledQueue only.
+    size_t capacity = 4096;             // Ring size of ExecutorSchedule::lock_free.
+    size_t starvation_limit = 16;       // ExecutorSchedule::priority: passes before a lower lane runs anyway.
+    IdlePolicy idle = IdlePolicy::balanced();   // Polling done by an idle worker before it parks.
+
+    // Elastic sizing, both 0 means fixed at the constructor's count.
+    size_t min_threads = 0;
+    size_t max_threads = 0;
+    size_t grow_depth = 2;              // Spawn when this many tasks wait per running worker,
+    std::chrono::milliseconds grow_delay { 10 };   // or every worker has been busy this long.
+    std::chrono::milliseconds idle_timeout { 30000 };  // Retire a worker above min idle this long.
+
+    // With work stealing, a placed pool also gets one queue per NUMA
+    // node and steals within the node before crossing to another.
+    ExecutorPlacement placement = ExecutorPlacement::none;
+
+    // Resolution of schedule_after() and schedule_every(), which never
+    // run a task early but may run it up to this late.
+    std::chrono::milliseconds timer_tick { 1 };
+};
+
+// Which CPUs and which node every worker slot gets, fixed at construction.
+struct WorkerLayout
+{
+    size_t nodes = 1;                       // NUMA nodes the workers are spread over.
+    std::vector<std::vector<int>> slot_cpus;    // Empty when not pinned.
+    std::vector<size_t> slot_node;
+
+    size_t slots() const { return slot_node.size(); }
+
+    static WorkerLayout plan(size_t slots, ExecutorPlacement placement)
+    {
+        const CpuTopology &topology = CpuTopology::inst();
+        WorkerLayout layout;
+        layout.nodes = placement == ExecutorPlacement::none ? 1 : topology.nodes();
+        layout.slot_cpus.resize(slots);
+        layout.slot_node.resize(slots, 0);
+        if (placement == ExecutorPlacement::none)
+            return layout;
+
+        // Cores interleaved across nodes: the k-th core of every node, then the next.
+        std::vector<int> cores;
+        for (size_t k = 0; cores.size() < topology.cores().size(); ++k) {
+            for (size_t node = 0; node < layout.nodes; ++node) {
+                std::vector<int> node_cores;
+                for (size_t i = 0; i < topology.cores().size(); ++i) {
+                    if (topology.node_of(topology.cores()[i]) == (int)node)
+                        node_cores.push_back(topology.cores()[i]);
+                }
+                if (k < node_cores.size())
+                    cores.push_back(node_cores[k]);
+            }
+        }
+
+        for (size_t i = 0; i < slots; ++i) {
+            if (placement == ExecutorPlacement::core) {
+                int cpu = cores[i % cores.size()];
+                layout.slot_cpus[i].push_back(cpu);
+                layout.slot_node[i] = topology.node_of(cpu);
+            } else {
+                layout.slot_node[i] = i % layout.nodes;
+                layout.slot_cpus[i] = topology.node_cpus(layout.slot_node[i]);
+            }
+        }
+        return layout;
+    }
+};
+
+/* Queue policies. */
+
+// One locked queue for all workers.
+template <typename T>
+class SharedQueue {
+public:
+    using clock = std::chrono::steady_clock;
+
+    SharedQueue(const WorkerLayout &, const ExecutorOptions &) { }
+
+    bool push(T &&t, int, int &, TaskPriority, clock::time_point)
+    {
+        queue_.enqueue(std::move(t));
+        return true;
+    }
+
+    size_t push_bulk(T *tasks, size_t n, int, int &)
+    {
+        queue_.enqueue_bulk(tasks, tasks + n);
+        return n;
+    }
+
+    bool pop(size_t, T &t) { return queue_.dequeue(t); }
+    bool empty() { return queue_.empty(); }
+    size_t size() { return queue_.size(); }
+
+private:
+    ThreadSafeQueue<T> queue_;
+};
+
+// One bounded lock-free ring of options.capacity for all workers.
+template <typename T>
+class LockFreeQueue {
+public:
+    using clock = std::chrono::steady_clock;
+
+    LockFreeQueue(const WorkerLayout &, const ExecutorOptions &options) : queue_(options.capacity) { }
+
+    bool push(T &&t, int, int &, TaskPriority, clock::time_point) { return queue_.try_enqueue(std::move(t)); }
+    size_t push_bulk(T *tasks, size_t n, int, int &) { return queue_.try_enqueue_bulk(tasks, n); }
+    bool pop(size_t, T &t) { return queue_.dequeue(t); }
+    bool empty() { return queue_.empty(); }
+    size_t size() { return queue_.size(); }
+
+private:
+    MPMCQueue<T> queue_;
+};
+
+// Priority lanes, earliest deadline first in a lane. A bulk goes in at
+// normal priority.
+template <typename T>
+class PriorityQueue {
+public:
+    using clock = std::chrono::steady_clock;
+
+    PriorityQueue(const WorkerLayout &, const ExecutorOptions &options) : lanes_(options.starvation_limit) { }
+
+    bool push(T &&t, int, int &, TaskPriority priority, clock::time_point deadline)
+    {
+        lanes_.push(std::move(t), priority, deadline);
+        return true;
+    }
+
+    size_t push_bulk(T *tasks, size_t n, int, int &)
+    {
+        lanes_.push_bulk(tasks, tasks + n);
+        return n;
+    }
+
+    bool pop(size_t, T &t) { return lanes_.pop(t); }
+    bool empty() { return lanes_.empty(); }
+    size_t size() { return lanes_.size(); }
+
+private:
+    PriorityLanes<T> lanes_;
+};
+
+/*
+ * One deque per worker slot, idle workers stealing from the others. A
+ * placed layout also gets one queue per node, where outsiders queue, and
+ * every worker steals within its node before crossing to another.
+ */
+template <typename T>
+class StealingQueues {
+public:
+    using clock = std::chrono::steady_clock;
+
+    StealingQueues(const WorkerLayout &layout, const ExecutorOptions &options)
+    {
+        for (size_t i = 0; i < layout.slots(); ++i)
+            local_queues_.emplace_back(new WorkStealingQueue<T>);
+        if (options.placement != ExecutorPlacement::none) {
+            for (size_t i = 0; i < layout.nodes; ++i)
+                node_queues_.emplace_back(new WorkStealingQueue<T>(0));
+        }
+        plan_stealing(layout);
+    }
+
+    bool push(T &&t, int worker, int &node, TaskPriority, clock::time_point)
+    {
+        if (!node_queues_.empty() && (node >= 0 || worker < 0)) {
+            // Outsiders queue on the node they run on.
+            if (node < 0)
+                node = current_node();
+            node_queues_[node]->push_shared(std::move(t));
+        } else if (worker >= 0) {
+            // Tasks submitted by one of our workers stay on its own deque.
+            local_queues_[worker]->push(std::move(t));
+        } else {
+            // Others are spread round robin.
+            size_t id = next_queue_.fetch_add(1, std::memory_order_relaxed) % local_queues_.size();
+            local_queues_[id]->push_shared(std::move(t));
+        }
+        return true;
+    }
+
+    size_t push_bulk(T *tasks, size_t n, int worker, int &node)
+    {
+        if (worker >= 0) {
+            local_queues_[worker]->push_bulk(tasks, tasks + n);
+        } else if (!node_queues_.empty()) {
+            node = current_node();
+            node_queues_[node]->push_shared_bulk(tasks, tasks + n);
+        } else {
+            // One contiguous slice per deque, one overflow lock each.
+            size_t slices = std::min(n, local_queues_.size());
+            size_t start = next_queue_.fetch_add(slices, std::memory_order_relaxed);
+            for (size_t i = 0; i < slices; ++i) {
+                local_queues_[(start + i) % local_queues_.size()]->push_shared_bulk(
+                        tasks + n * i / slices, tasks + n * (i + 1) / slices);
+            }
+        }
+        return n;
+    }
+
+    bool pop(size_t worker, T &t)
+    {
+        if (local_queues_[worker]->pop(t))
+            return true;
+
+        const std::vector<WorkStealingQueue<T> *> &victims = victims_[worker];
+        for (size_t i = 0; i < victims.size(); ++i) {
+            if (victims[i]->steal(t))
+                return true;
+        }
+        return false;
+    }
+
+    bool empty()
+    {
+        for (size_t i = 0; i < local_queues_.size(); ++i) {
+            if (!local_queues_[i]->empty())
+                return false;
+        }
+        for (size_t i = 0; i < node_queues_.size(); ++i) {
+            if (!node_queues_[i]->empty())
+                return false;
+        }
+        return true;
+    }
+
+    size_t size()
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < local_queues_.size(); ++i)
+            n += local_queues_[i]->size();
+        for (size_t i = 0; i < node_queues_.size(); ++i)
+            n += node_queues_[i]->size();
+        return n;
+    }
+
+private:
+    // Node queue for an outside submitter: the node it runs on if we know
+    // it, round robin otherwise.
+    int current_node()
+    {
+        int node = CpuTopology::inst().current_node();
+        if (node < 0 || (size_t)node >= node_queues_.size())
+            node = (int)(next_queue_.fetch_add(1, std::memory_order_relaxed) % node_queues_.size());
+        return node;
+    }
+
+    // Steal order of every worker: its node's queue and deques first, then
+    // the other nodes one by one.
+    void plan_stealing(const WorkerLayout &layout)
+    {
+        victims_.resize(local_queues_.size());
+        for (size_t id = 0; id < local_queues_.size(); ++id) {
+            for (size_t n = 0; n < layout.nodes; ++n) {
+                size_t node = (layout.slot_node[id] + n) % layout.nodes;
+                if (!node_queues_.empty())
+                    victims_[id].push_back(node_queues_[node].get());
+                for (size_t i = 1; i < local_queues_.size(); ++i) {
+                    size_t victim = (id + i) % local_queues_.size();
+                    if (layout.slot_node[victim] == node)
+                        victims_[id].push_back(local_queues_[victim].get());
+                }
+            }
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkStealingQueue<T>>> local_queues_;
+    std::vector<std::unique_ptr<WorkStealingQueue<T>>> node_queues_;
+    std::vector<std::vector<WorkStealingQueue<T> *>> victims_;
+    std::atomic<size_t> next_queue_ { 0 };
+};
+
+/*
+ * Any of the above, options.schedule choosing at runtime: what ThreadPool
+ * uses, so one binary can try every schedule. Each call pays a switch the
+ * queues above do without.
+ */
+template <typename T>
+class ScheduledQueue {
+public:
+    using clock = std::chrono::steady_clock;
+
+    ScheduledQueue(const WorkerLayout &layout, const ExecutorOptions &options)
+        : schedule_(options.schedule)
+    {
+        if (schedule_ == ExecutorSchedule::shared_queue)
+            shared_.reset(new SharedQueue<T>(layout, options));
+        if (schedule_ == ExecutorSchedule::lock_free)
+            bounded_.reset(new LockFreeQueue<T>(layout, options));
+        if (schedule_ == ExecutorSchedule::priority)
+            lanes_.reset(new PriorityQueue<T>(layout, options));
+        if (schedule_ == ExecutorSchedule::work_stealing)
+            stealing_.reset(new StealingQueues<T>(layout, options));
+    }
+
+    bool push(T &&t, int worker, int &node, TaskPriority priority, clock::time_point deadline)
+    {
+        if (schedule_ == ExecutorSchedule::shared_queue)
+            return shared_->push(std::move(t), worker, node, priority, deadline);
+        if (schedule_ == ExecutorSchedule::priority)
+            return lanes_->push(std::move(t), worker, node, priority, deadline);
+        if (schedule_ == ExecutorSchedule::lock_free)
+            return bounded_->push(std::move(t), worker, node, priority, deadline);
+        return stealing_->push(std::move(t), worker, node, priority, deadline);
+    }
+
+    size_t push_bulk(T *tasks, size_t n, int worker, int &node)
+    {
+        if (schedule_ == ExecutorSchedule::shared_queue)
+            return shared_->push_bulk(tasks, n, worker, node);
+        if (schedule_ == ExecutorSchedule::priority)
+            return lanes_->push_bulk(tasks, n, worker, node);
+        if (schedule_ == ExecutorSchedule::lock_free)
+            return bounded_->push_bulk(tasks, n, worker, node);
+        return stealing_->push_bulk(tasks, n, worker, node);
+    }
+
+    bool pop(size_t worker, T &t)
+    {
+        if (schedule_ == ExecutorSchedule::shared_queue)
+            return shared_->pop(worker, t);
+        if (schedule_ == ExecutorSchedule::priority)
+            return lanes_->pop(worker, t);
+        if (schedule_ == ExecutorSchedule::lock_free)
+            return bounded_->pop(worker, t);
+        return stealing_->pop(worker, t);
+    }
+
+    bool empty()
+    {
+        if (schedule_ == ExecutorSchedule::shared_queue)
+            return shared_->empty();
+        if (schedule_ == ExecutorSchedule::priority)
+            return lanes_->empty();
+        if (schedule_ == ExecutorSchedule::lock_free)
+            return bounded_->empty();
+        return stealing_->empty();
+    }
+
+    size_t size()
+    {
+        if (schedule_ == ExecutorSchedule::shared_queue)
+            return shared_->size();
+        if (schedule_ == ExecutorSchedule::priority)
+            return lanes_->size();
+        if (schedule_ == ExecutorSchedule::lock_free)
+            return bounded_->size();
+        return stealing_->size();
+    }
+
+private:
+    ExecutorSchedule schedule_;
+    std::unique_ptr<SharedQueue<T>> shared_;
+    std::unique_ptr<LockFreeQueue<T>> bounded_;
+    std::unique_ptr<PriorityQueue<T>> lanes_;
+    std::unique_ptr<StealingQueues<T>> stealing_;
+};
+
+/* Wait policies. */
+
+/*
+ * Polls with options.idle, then parks on an EventCount, one per node so
+ * that a task queued on a node wakes a worker of that node. Waking costs
+ * one fence and one load per node when nobody is parked.
+ */
+class ParkingIdle {
+public:
+    ParkingIdle(const WorkerLayout &layout, const ExecutorOptions &options) : poll_(options.idle)
+    {
+        for (size_t i = 0; i < layout.nodes; ++i)
+            events_.emplace_back(new EventCount);
+    }
+
+    template <typename Ready>
+    bool wait(size_t node, Ready ready, bool timed, std::chrono::milliseconds timeout)
+    {
+        if (poll_.poll(ready))
+            return true;
+
+        EventCount &event = *events_[node];
+        EventCount::Key key = event.prepare_wait();
+        if (ready()) {
+            event.cancel_wait();
+            return true;
+        }
+        if (!timed) {
+            event.wait(key);
+            return true;
+        }
+        return event.wait_for(key, timeout);
+    }
+
+    void notify(size_t n, int node)
+    {
+        if (node < 0 && events_.size() > 1)
+            node = CpuTopology::inst().current_node();
+
+        int count = n < (size_t)INT_MAX ? (int)n : INT_MAX;
+        size_t first = node < 0 ? 0 : (size_t)node % events_.size();
+        for (size_t i = 0; i < events_.size(); ++i) {
+            if (events_[(first + i) % events_.size()]->notify(count) && n == 1)
+                return;
+        }
+    }
+
+    void notify_all()
+    {
+        for (size_t i = 0; i < events_.size(); ++i)
+            events_[i]->notify_all();
+    }
+
+private:
+    IdlePolicy poll_;
+    std::vector<std::unique_ptr<EventCount>> events_;
+};
+
+/*
+ * Blocks on one mutex and condition variable, no polling and no nodes:
+ * the classic pool, for machines where a spinning worker costs more than
+ * a slower wakeup. notify() skips the mutex when nobody waits.
+ */
+class BlockingIdle {
+public:
+    BlockingIdle(const WorkerLayout &, const ExecutorOptions &) { }
+
+    template <typename Ready>
+    bool wait(size_t, Ready ready, bool timed, std::chrono::milliseconds timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Counted before ready() is checked, so a notifier either sees us
+        // or we see its task.
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool woken = true;
+        if (!timed)
+            cond_.wait(lock, ready);
+        else
+            woken = cond_.wait_for(lock, timeout, ready);
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+        return woken;
+    }
+
+    void notify(size_t n, int)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) == 0)
+            return;
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        if (n == 1)
+            cond_.notify_one();
+        else
+            cond_.notify_all();
+    }
+
+    void notify_all()
+    {
+        { std::lock_guard<std::mutex> lock(mutex_); }
+        cond_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::atomic<size_t> waiters_ { 0 };
+};
+
+/* Task policies. */
+
+// Tasks of BasicTask<InlineSize>: callables up to InlineSize bytes queue
+// without a heap allocation, and every queued task costs InlineSize + 8
+// (+ 8 more with THREAD_POOL_METRICS). InlineSize is a multiple of 8.
+template <size_t InlineSize = Task::kInlineSize>
+struct InlineTasks
+{
+    using task_type = BasicTask<InlineSize>;
+
+#ifndef THREAD_POOL_METRICS
+    static_assert(sizeof(task_type) == InlineSize + sizeof(void *), "a task is its storage and one pointer");
+#endif
+};
+
+#endif //_EXECUTOR_POLICIES_HPP_
@@ -5,11 +5,26 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdarg>
+#include <cerrno>
 #include <unistd.h>
 #include <sys/time.h>
 #include <syslog.h>
 #include <syscall.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "event_count.hpp"
+#include "log_file.hpp"
+#include "log_hex.hpp"
+#include "log_limit.hpp"
+#include "log_record.hpp"
+#include "log_ring.hpp"
 
 /*
  * LOG LEVEL DEFINITION
@@ -24,6 +39,12 @@
 #define LOGGER_INFO         6
 #define LOGGER_DEBUG        7
 
+// Lines above this level are compiled out: -DLOGGER_MIN_LEVEL=LOGGER_INFO
+// leaves no trace of LOGD, its arguments included, in an optimized build.
+#ifndef LOGGER_MIN_LEVEL
+#define LOGGER_MIN_LEVEL    LOGGER_DEBUG
+#endif
+
 #define __FILENAME__        strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__
 
 typedef void(*logger_cb_t)(int, const char *, const void *);
@@ -31,10 +52,36 @@ typedef void(*logger_cb_t)(int, const char *, const void *);
 class Logger
 {
 public:
-    static Logger *inst() { static Logger *self = 0; if (self == 0) self = new Logger; return self; }
+    // What a producer does when its ring is full in async mode.
+    enum class Overflow
+    {
+        block,      // Wait for the writer thread to make room.
+        drop,       // Lose the record.
+        count       // Lose the record, the writer logs how many were lost.
+    };
+
+    struct AsyncOptions
+    {
+        size_t ring_size = 64 << 10;        // Bytes per logging thread.
+        Overflow overflow = Overflow::block;
+        std::chrono::milliseconds flush_interval { 10 };    // Longest a record waits to be written.
+
+        // LOGF stores its call site and raw arguments, the writer formats them.
+        bool structured = false;
+
+        // Write a binary stream (src/log_record.hpp) to binary.path instead
+        // of text lines, read it back with tools/logdecode. Implies
+        // structured; callback, syslog and file() are then bypassed.
+        LogFile::Options binary;
+    };
+
+    static Logger *inst() { Logger *&self = instance(); if (self == 0) self = new Logger; return self; }
 
     ~Logger()
     {
+        this->async(false);
+        if (instance() == this)
+            instance() = 0;
         if (this->syslog_)  closelog();
         if (name_) free(name_);
     }
@@ -60,11 +107,7 @@ public:
         name_ = strdup(name);
     }
 
-    const char *category(int level)
-    {
-        static const char *levels[] = { "E", "A", "C", "E", "W", "N", "I", "D" }; 
-        return levels[level];
-    }
+    const char *category(int level) { return log_category(level); }
 
     void syslog(bool value)
     {
@@ -75,6 +118,99 @@ public:
             closelog();
     }
 
+    /*
+     * Async mode: a caller only formats its message into a ring of its own
+     * thread, no lock taken. One writer thread stamps the records, lays them
+     * out and writes them in batches, in time order. Switch modes while
+     * nothing is logging, a record racing async(false) may be lost.
+     */
+    void async(bool value)
+    {
+        if (value) {
+            this->async(AsyncOptions());
+        } else {
+            std::lock_guard<std::mutex> locker(this->mutex_);
+            this->stop_async();
+        }
+    }
+
+    void async(const AsyncOptions &options)
+    {
+        std::lock_guard<std::mutex> locker(this->mutex_);
+        this->stop_async();
+        this->start_async(options);
+    }
+
+    bool async() const { return this->async_.load(std::memory_order_relaxed); }
+
+    /*
+     * Text lines go to a file instead of stdout, without colors, rotated
+     * as options say; an empty path goes back to stdout. The async writer
+     * hands whole batches over, one writev() each, a synchronous logger
+     * writes every line as it comes. False when the file can not be
+     * opened, the logger then writes to stdout.
+     */
+    bool file(const LogFile::Options &options)
+    {
+        std::lock_guard<std::mutex> locker(this->mutex_);
+        bool async = this->writer_.joinable();
+        AsyncOptions async_options = this->options_;
+        this->stop_async();
+
+        this->file_.reset();
+        bool opened = true;
+        if (!options.path.empty()) {
+            this->file_.reset(new LogFile(options));
+            if (!this->file_->open()) {
+                fprintf(stderr, "logger: can not open %s: %s\n", options.path.c_str(), strerror(errno));
+                this->file_.reset();
+                opened = false;
+            }
+        }
+
+        if (async)
+            this->start_async(async_options);
+        return opened;
+    }
+
+    bool file(const std::string &path)
+    {
+        LogFile::Options options;
+        options.path = path;
+        return this->file(options);
+    }
+
+    // Returns once everything logged before the call has been written,
+    // and synced to disk unless the file's policy is Sync::none.
+    void flush()
+    {
+        std::lock_guard<std::mutex> locker(this->mutex_);
+        if (!this->writer_.joinable()) {
+            if (this->file_)
+                this->file_->flush(true);
+            else
+                fflush(stdout);
+            return;
+        }
+
+        std::unique_lock<std::mutex> flush_locker(this->flush_mutex_);
+        uint64_t ticket = this->flush_requested_.fetch_add(1) + 1;
+        this->event_.notify();
+        this->flush_cond_.wait(flush_locker, [this, ticket] {
+            return this->flushed_ >= ticket || this->writer_done_;
+        });
+    }
+
+    // Records lost to a full ring since the logger was created.
+    uint64_t dropped()
+    {
+        std::lock_guard<std::mutex> locker(this->producers_mutex_);
+        uint64_t n = this->lost_;
+        for (size_t i = 0; i < this->producers_.size(); ++i)
+            n += this->producers_[i]->dropped.load(std::memory_order_relaxed);
+        return n;
+    }
+
     void format(bool prefix, const char *fmt, ...)
     {
         va_list ap;
@@ -84,17 +220,23 @@ public:
     }
 
     void print(int level, const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        this->vprint(level, fmt, ap);
+        va_end(ap);
+    }
+
+    void vprint(int level, const char *fmt, va_list ap)
     {
         if (level > this->level_)
             return;
+        if (this->submit(LogKind::print, level, nullptr, nullptr, 0, "", "", fmt, ap))
+            return;
 
         std::lock_guard<std::mutex> locker(mutex_);
         char *msg = nullptr;
-
-        va_list ap;
-        va_start(ap, fmt);
         vasprintf(&msg, fmt, ap);
-        va_end(ap);
 
         if (cb_) {
             (*cb_)(level, msg, obj_);
@@ -104,7 +246,7 @@ public:
         }
 
         if (!this->syslog_)
-            fprintf(stdout, "%s\n", msg);
+            this->output("%s\n", msg);
         else
             ::syslog(LOG_USER | LOG_INFO, "%s", msg);
 
@@ -113,17 +255,24 @@ CLEANUP:
     }
 
     void log(int level, const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        this->vlog(level, fmt, ap);
+        va_end(ap);
+    }
+
+    void vlog(int level, const char *fmt, va_list ap)
     {
         if (level > this->level_)
             return;
-        
+        if (this->submit(LogKind::log, level, nullptr, nullptr, 0, this->prefix_, this->suffix_, fmt, ap))
+            return;
+
         std::lock_guard<std::mutex> locker(mutex_);
 
         char *msg;
-        va_list ap;
-        va_start(ap, fmt);
         vasprintf(&msg, fmt, ap);
-        va_end(ap);
 
         if (this->cb_) {
             char *log;
@@ -140,9 +289,9 @@ CLEANUP:
         }
 
         if (!this->syslog_)
-            fprintf(stdout, "%s[%s] %s [%ld] %s%s%s%s\n", level_color_start_[level], this->category(level),
+            this->output("%s[%s] %s [%ld] %s%s%s%s\n", this->color(level), this->category(level),
                 this->name_ ? this->name_ : LOGGER, syscall(SYS_gettid),
-                this->prefix_, msg, this->suffix_, level_color_end_);
+                this->prefix_, msg, this->suffix_, this->color_end());
 
         else
             ::syslog(LOG_USER | LOG_INFO, "%s%s%s", this->prefix_, msg, this->suffix_);
@@ -153,16 +302,49 @@ CLEANUP:
 
     void stamp(int level, const char *fmt, ...)
     {
-        if (level > this->level_) return;
+        va_list ap;
+        va_start(ap, fmt);
+        this->vstamp(level, this->prefix_, this->suffix_, fmt, ap);
+        va_end(ap);
+    }
 
-        std::lock_guard<std::mutex> locker(this->mutex_);
+    // What LOGF calls. In structured mode the site and the raw arguments
+    // are queued and formatted later, otherwise this is stamp_at().
+    template <typename... Args>
+    void record(const LogSite &site, Args... args)
+    {
+        if (site.level > this->level_) return;
+        if (this->encode(site, args...)) return;
+        this->stamp_at(site.level, site.func, log_basename(site.file), site.line, site.format, args...);
+    }
 
-        char *msg;
+    // stamp() for a call site: the function and location are passed along
+    // instead of going through the shared prefix_/suffix_.
+    void stamp_at(int level, const char *func, const char *file, int line, const char *fmt, ...)
+    {
+        if (level > this->level_) return;
 
         va_list ap;
         va_start(ap, fmt);
-        vasprintf(&msg, fmt, ap);
+        if (!this->submit(LogKind::stamp, level, func, file, line, "", "", fmt, ap)) {
+            char prefix[128], suffix[128];
+            snprintf(prefix, sizeof(prefix), "%s: ", func);
+            snprintf(suffix, sizeof(suffix), " (%s:%d)", file, line);
+            this->vstamp(level, prefix, suffix, fmt, ap);
+        }
         va_end(ap);
+    }
+
+    void vstamp(int level, const char *prefix, const char *suffix, const char *fmt, va_list ap)
+    {
+        if (level > this->level_) return;
+        if (this->submit(LogKind::stamp, level, nullptr, nullptr, 0, prefix, suffix, fmt, ap))
+            return;
+
+        std::lock_guard<std::mutex> locker(this->mutex_);
+
+        char *msg;
+        vasprintf(&msg, fmt, ap);
 
         struct timeval tv;
         gettimeofday(&tv, NULL);
@@ -175,7 +357,7 @@ CLEANUP:
             char *log;
             asprintf(&log, "[%s] [%s] %s [%ld]: %s%s%s", tmp,
                     this->category(level), this->name_ ? this->name_ : LOGGER,
-                    syscall(SYS_gettid), this->prefix_, msg, this->suffix_);
+                    syscall(SYS_gettid), prefix, msg, suffix);
 
             (*this->cb_)(level, log, this->obj_);
 
@@ -185,63 +367,519 @@ CLEANUP:
         }
 
         if (!this->syslog_)
-            fprintf(stdout, "%s[%s] [%s] %s [%ld]: %s%s%s%s\n", level_color_start_[level], tmp,
+            this->output("%s[%s] [%s] %s [%ld]: %s%s%s%s\n", this->color(level), tmp,
                     this->category(level), this->name_ ? this->name_ : LOGGER,
-                    syscall(SYS_gettid), this->prefix_, msg, this->suffix_, level_color_end_);
+                    syscall(SYS_gettid), prefix, msg, suffix, this->color_end());
         else
-            ::syslog(LOG_USER | LOG_INFO, "%s%s%s", this->prefix_, msg, this->suffix_);
+            ::syslog(LOG_USER | LOG_INFO, "%s%s%s", prefix, msg, suffix);
 
 CLEANUP:
         free(msg);
     }
 
-    void dump(const void *buf, uint16_t len)
+    /*
+     * Hex dump at debug level, 16 bytes a line, of a buffer of any size.
+     * Lines are laid out in blocks by src/log_hex.hpp, each block goes to
+     * the sink as one message.
+     */
+    void dump(const void *buf, size_t len)
     {
-
         if (LOGGER_DEBUG > this->level_) return;
 
-        std::lock_guard<std::mutex> locker(this->mutex_);
-
-        const size_t length = 16;
+        // Indented to line up with the text after a stamp() header.
         char prefix[64] = { 0 };
-        sprintf(prefix, "%s [%ld]", this->name_ ? this->name_ : LOGGER, syscall(SYS_gettid));
-        const size_t padding = 18 + strlen(prefix) + 1;
-        size_t index = 0;
-        char hex[padding + length * 4], str[length + 1];
+        snprintf(prefix, sizeof(prefix), "%s [%ld]", this->name_ ? this->name_ : LOGGER, syscall(SYS_gettid));
+        const size_t indent = 18 + strlen(prefix) + 1;
+
+        // As many lines as one async record holds, kDumpLines at most.
+        size_t lines = kDumpLines;
+        if (this->async_.load(std::memory_order_relaxed)) {
+            size_t room = this->options_.ring_size / 4 - 8 - sizeof(Entry) - 1;
+            lines = std::max(std::min(lines, room / log_hex_line_size(indent)), (size_t)1);
+        }
+
+        std::string block;
+        const uint8_t *bytes = static_cast<const uint8_t *>(buf);
+        for (size_t index = 0; index < len; index += lines * kLogHexBytes) {
+            block.clear();
+            log_hex_lines(block, bytes + index, std::min(len - index, lines * kLogHexBytes), indent);
+            block.resize(block.size() - 1);     // The sink ends the line.
+            this->print(LOGGER_DEBUG, "%s", block.c_str());
+        }
+    }
 
-        memset(hex, 0x20, padding);
+    void dump(const char *tag, const void *buf, size_t len)
+    {
+        this->stamp(LOGGER_DEBUG, "%s: %zu(bytes)", tag, len);
+        this->dump(buf, len);
+    }
 
-        auto bin_to_hex = [](char *hex, const uint8_t *bin, size_t bin_len, bool space, bool upper) {
-            for (size_t i = 0, j = 0; i < bin_len; i++) {
-                sprintf(hex + i * 2 + j, upper ? "%02X" : "%02x", bin[i]);
+private:
+    static const size_t kTextGuess = 256;   // Room reserved for a message before formatting it.
+    static const size_t kBatch = 64 << 10;  // Bytes of stdout output written in one go.
+    static const size_t kDumpLines = 64;    // Hex dump lines per message.
+
+    // Head of a record in a producer ring, the text follows.
+    struct Entry
+    {
+        int64_t time;           // Wall clock, microseconds.
+        const LogSite *site;    // LogKind::structured: the arguments follow instead of text.
+        const char *func;       // LOGF call site, nullptr when the text carries its own prefix and suffix.
+        const char *file;
+        int line;
+        int level;
+        LogKind kind;
+    };
+
+    struct Producer
+    {
+        explicit Producer(size_t size) : ring(size), tid(syscall(SYS_gettid)) { }
 
-                if (!space)  continue;
+        LogRing ring;
+        long tid;
+        std::atomic<uint64_t> dropped { 0 };    // Written by the producer only.
+        uint64_t reported = 0;                  // Drops the writer has already logged.
+        std::atomic<bool> closed { false };     // Its thread has exited.
+    };
 
-                strcat((char *)hex, " ");
-                j++;
+    // The calling thread's producer, tagged with the async run it belongs to.
+    struct ProducerRef
+    {
+        std::shared_ptr<Producer> producer;
+        unsigned generation = 0;
+
+        ~ProducerRef()
+        {
+            if (producer)
+                producer->closed.store(true, std::memory_order_release);
+        }
+    };
+
+    struct Pending
+    {
+        const Entry *entry;
+        const char *text;
+        size_t length;
+        long tid;
+    };
+
+    static Logger *&instance()
+    {
+        static Logger *self = 0;
+        return self;
+    }
+
+    static void stop_at_exit()
+    {
+        if (Logger *self = instance())
+            self->async(false);
+    }
+
+    static ProducerRef &producer_ref()
+    {
+        static thread_local ProducerRef ref;
+        return ref;
+    }
+
+    // Unique across loggers, so a thread never reuses a ring of a previous run.
+    static unsigned next_generation()
+    {
+        static std::atomic<unsigned> generation(0);
+        return ++generation;
+    }
+
+    // Binary streams and site ids are numbered process wide: sites are
+    // static, they outlive any logger.
+    static uint32_t next_stream()
+    {
+        static std::atomic<uint32_t> stream(0);
+        return ++stream;
+    }
+
+    static uint32_t next_site_id()
+    {
+        static std::atomic<uint32_t> id(0);
+        return id++;
+    }
+
+    // Escapes around a line on stdout, none in a file.
+    const char *color(int level) const { return this->file_ ? "" : this->level_color_start_[level]; }
+    const char *color_end() const { return this->file_ ? "" : this->level_color_end_; }
+
+    // Synchronous mode, mutex_ held: one line to the file or stdout.
+    void output(const char *fmt, ...)
+    {
+        va_list ap;
+        va_start(ap, fmt);
+        if (!this->file_) {
+            vfprintf(stdout, fmt, ap);
+            va_end(ap);
+            return;
+        }
+        char *line = nullptr;
+        int n = vasprintf(&line, fmt, ap);
+        va_end(ap);
+        if (n < 0)
+            return;
+
+        if (this->file_->due(n))
+            this->file_->rotate();
+        this->sync_line_.assign(line, (size_t)n);
+        free(line);
+        this->file_->write(this->sync_line_);
+        this->file_->flush(false);
+    }
+
+    // mutex_ held, the writer stopped.
+    void start_async(const AsyncOptions &options)
+    {
+        this->options_ = options;
+        this->options_.ring_size = std::max(options.ring_size, (size_t)4096);
+        this->options_.structured = options.structured || !options.binary.path.empty();
+        if (!options.binary.path.empty()) {
+            // Falls back to text lines when the file can not be opened.
+            this->binary_.reset(new LogFile(options.binary));
+            if (this->binary_->open()) {
+                this->start_stream();
+            } else {
+                fprintf(stderr, "logger: can not open %s: %s\n", options.binary.path.c_str(), strerror(errno));
+                this->binary_.reset();
             }
-        };
+        }
+        this->stop_ = false;
+        {
+            std::lock_guard<std::mutex> flush_locker(this->flush_mutex_);
+            this->writer_done_ = false;
+        }
+        this->generation_.store(next_generation(), std::memory_order_relaxed);
+        this->writer_ = std::thread(&Logger::write_loop, this);
+        this->async_.store(true, std::memory_order_release);
 
-        while (index < len) {
-            size_t line_len = len - index > length ? length : len - index;
-            bin_to_hex(hex + padding, (uint8_t *)buf + index, line_len, true, false);
-            if (line_len < length) for (size_t i = 0; i < length - line_len; i++) strcat(hex, "   ");
-            memcpy(str, (uint8_t *)buf + index, line_len);
-            for (size_t i = 0; i < length; i++) 
-                if ((uint8_t)str[i] < 0x20 || (uint8_t)str[i] > 0x7E)
-                    str[i] = 0x2E;
+        // inst() is never destroyed, what is still queued at exit is written then.
+        static bool registered = atexit(stop_at_exit) == 0;
+        (void)registered;
+    }
 
-            str[line_len] = '\0';
-            index += line_len;
+    Producer *producer()
+    {
+        ProducerRef &ref = producer_ref();
+        unsigned generation = this->generation_.load(std::memory_order_relaxed);
+        if (ref.generation != generation) {
+            if (ref.producer)
+                ref.producer->closed.store(true, std::memory_order_release);
+            ref.producer = std::make_shared<Producer>(this->options_.ring_size);
+            ref.generation = generation;
+
+            std::lock_guard<std::mutex> locker(this->producers_mutex_);
+            this->producers_.push_back(ref.producer);
+        }
+        return ref.producer.get();
+    }
 
-            this->print(LOGGER_DEBUG, "%s\t\t%s", hex, str);
+    // Async mode: formats the record straight into the calling thread's
+    // ring. False, ap left untouched, when the logger is synchronous.
+    bool submit(LogKind kind, int level, const char *func, const char *file, int line,
+            const char *prefix, const char *suffix, const char *fmt, va_list ap)
+    {
+        if (!this->async_.load(std::memory_order_acquire))
+            return false;
+
+        Producer *p = this->producer();
+        size_t prefix_len = strnlen(prefix, sizeof(this->prefix_));
+        size_t suffix_len = strnlen(suffix, sizeof(this->suffix_));
+        size_t fixed = sizeof(Entry) + prefix_len + suffix_len;
+        size_t size = std::min(fixed + kTextGuess, p->ring.max_record());
+        char *data = this->reserve(p, size);
+        if (!data)
+            return true;
+
+        va_list copy;
+        va_copy(copy, ap);
+        int n = vsnprintf(data + sizeof(Entry) + prefix_len, size - fixed, fmt, ap);
+        if (n >= (int)(size - fixed) && size < p->ring.max_record()) {
+            // Longer than guessed: take the room it needs and format again.
+            size = std::min(fixed + n + 1, p->ring.max_record());
+            data = this->reserve(p, size);
+            if (data)
+                n = vsnprintf(data + sizeof(Entry) + prefix_len, size - fixed, fmt, copy);
         }
+        va_end(copy);
+        if (!data)
+            return true;
+
+        size_t length = n < 0 ? 0 : std::min((size_t)n, size - fixed - 1);
+        char *text = data + sizeof(Entry);
+        memcpy(text, prefix, prefix_len);
+        memcpy(text + prefix_len + length, suffix, suffix_len);
+
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        Entry *entry = reinterpret_cast<Entry *>(data);
+        entry->time = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+        entry->site = nullptr;
+        entry->func = func;
+        entry->file = file;
+        entry->line = line;
+        entry->level = level;
+        entry->kind = kind;
+        p->ring.commit(sizeof(Entry) + prefix_len + length + suffix_len);
+
+        // The writer comes by every flush_interval, only hurry it when the ring fills up.
+        if (p->ring.filling())
+            this->event_.notify();
+        return true;
     }
 
-    void dump(const char *tag, const void *buf, uint16_t len)
+    // Structured mode: queues the site and the raw arguments, no formatting.
+    // False when the record has to go through stamp_at() instead.
+    template <typename... Args>
+    bool encode(const LogSite &site, const Args &... args)
     {
-        this->stamp(LOGGER_DEBUG, "%s: %d(bytes)", tag, len);
-        this->dump(buf, len);
+        if (!this->async_.load(std::memory_order_acquire) || !this->options_.structured)
+            return false;
+
+        size_t n;
+        const LogConversion *conversions = site.conversions(n);
+        if (!conversions)
+            return false;
+
+        Producer *p = this->producer();
+        size_t size = sizeof(Entry) + log_args_size(conversions, n, -1, args...);
+        if (size > p->ring.max_record())
+            return false;
+        char *data = this->reserve(p, size);
+        if (!data)
+            return true;
+
+        char *end = log_args_write(data + sizeof(Entry), conversions, n, -1, args...);
+        Entry *entry = reinterpret_cast<Entry *>(data);
+        entry->time = log_coarse_time();
+        entry->site = &site;
+        entry->func = site.func;
+        entry->file = site.file;
+        entry->line = site.line;
+        entry->level = site.level;
+        entry->kind = LogKind::structured;
+        p->ring.commit(end - data);
+
+        if (p->ring.filling())
+            this->event_.notify();
+        return true;
+    }
+
+    char *reserve(Producer *p, size_t size)
+    {
+        for (;;) {
+            if (char *data = p->ring.reserve(size))
+                return data;
+
+            if (this->options_.overflow != Overflow::block || !this->async_.load(std::memory_order_relaxed)) {
+                p->dropped.store(p->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            this->event_.notify();
+            std::this_thread::yield();
+        }
+    }
+
+    void stop_async()
+    {
+        if (!this->writer_.joinable())
+            return;
+
+        this->async_.store(false, std::memory_order_release);
+        this->stop_.store(true, std::memory_order_release);
+        this->event_.notify();
+        this->writer_.join();
+
+        std::lock_guard<std::mutex> locker(this->producers_mutex_);
+        for (size_t i = 0; i < this->producers_.size(); ++i)
+            this->lost_ += this->producers_[i]->dropped.load(std::memory_order_relaxed);
+        this->producers_.clear();
+
+        this->binary_.reset();
+        if (this->file_)
+            this->file_->flush(true);
+        this->out_.clear();
+    }
+
+    void write_loop()
+    {
+        for (;;) {
+            bool stop = this->stop_.load(std::memory_order_acquire);
+            uint64_t requested = this->flush_requested_.load(std::memory_order_acquire);
+            this->drain();
+
+            if (requested != this->flushed_) {
+                if (LogFile *sink = this->sink())
+                    sink->flush(true);
+                std::lock_guard<std::mutex> locker(this->flush_mutex_);
+                this->flushed_ = requested;
+                this->flush_cond_.notify_all();
+            }
+            if (stop)
+                break;
+
+            EventCount::Key key = this->event_.prepare_wait();
+            if (this->stop_.load() || this->flush_requested_.load() != requested)
+                this->event_.cancel_wait();
+            else
+                this->event_.wait_for(key, this->options_.flush_interval);
+        }
+
+        std::lock_guard<std::mutex> locker(this->flush_mutex_);
+        this->writer_done_ = true;
+        this->flush_cond_.notify_all();
+    }
+
+    // Writes out everything committed so far, merged by time across threads.
+    void drain()
+    {
+        std::lock_guard<std::mutex> locker(this->producers_mutex_);
+        this->batch_.clear();
+        this->positions_.clear();
+        this->closed_.clear();
+        for (size_t i = 0; i < this->producers_.size(); ++i) {
+            Producer *p = this->producers_[i].get();
+            this->closed_.push_back(p->closed.load(std::memory_order_acquire));
+            this->positions_.push_back(p->ring.read([this, p](char *data, size_t size) {
+                Pending pending = { reinterpret_cast<const Entry *>(data), data + sizeof(Entry),
+                    size - sizeof(Entry), p->tid };
+                this->batch_.push_back(pending);
+            }));
+        }
+
+        std::stable_sort(this->batch_.begin(), this->batch_.end(), [](const Pending &a, const Pending &b) {
+            return a.entry->time < b.entry->time;
+        });
+        for (size_t i = 0; i < this->batch_.size(); ++i)
+            this->write(*this->batch_[i].entry, this->batch_[i].text, this->batch_[i].length, this->batch_[i].tid);
+
+        for (size_t i = this->producers_.size(); i-- > 0;) {
+            Producer *p = this->producers_[i].get();
+            p->ring.release(this->positions_[i]);
+
+            uint64_t dropped = p->dropped.load(std::memory_order_relaxed);
+            if (dropped != p->reported && this->options_.overflow == Overflow::count) {
+                char text[64];
+                int n = snprintf(text, sizeof(text), "%llu log records dropped",
+                        (unsigned long long)(dropped - p->reported));
+                Entry entry = { 0, nullptr, nullptr, nullptr, 0, LOGGER_WARNING, LogKind::stamp };
+                struct timeval tv;
+                gettimeofday(&tv, NULL);
+                entry.time = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+                this->write(entry, text, (size_t)n, p->tid);
+                p->reported = dropped;
+            }
+
+            if (this->closed_[i]) {
+                this->lost_ += dropped;
+                this->producers_.erase(this->producers_.begin() + i);
+            }
+        }
+        this->write_out();
+        if (LogFile *sink = this->sink())
+            sink->flush(false);
+    }
+
+    void write(const Entry &entry, const char *text, size_t length, long tid)
+    {
+        const char *name = this->name_ ? this->name_ : LOGGER;
+        LogFile *sink = this->sink();
+        if (sink && sink->due(this->out_.size()))
+            this->rotate(sink);
+        if (this->binary_) {
+            this->write_binary(entry, text, length, tid, name);
+            return;
+        }
+
+        LogLine line = { entry.kind, entry.level, entry.time, tid, entry.func, entry.file, entry.line, text, length };
+        if (entry.kind == LogKind::structured) {
+            this->text_.clear();
+            log_format(this->text_, entry.site->format, text, length);
+            line.text = this->text_.data();
+            line.length = this->text_.size();
+        }
+
+        if (this->cb_) {
+            this->line_.clear();
+            this->layout_.append(this->line_, line, name);
+            (*this->cb_)(entry.level, this->line_.c_str(), this->obj_);
+
+            if (!this->copy_)
+                return;
+        }
+
+        if (this->syslog_) {
+            this->line_.clear();
+            line.kind = LogKind::print;
+            this->layout_.append(this->line_, line, name);
+            ::syslog(LOG_USER | LOG_INFO, "%s", this->line_.c_str());
+        } else {
+            this->layout_.append(this->out_, line, name, this->file_ ? nullptr : this->level_color_start_[entry.level],
+                    this->file_ ? nullptr : this->level_color_end_);
+            this->out_ += '\n';
+            if (this->out_.size() >= kBatch)
+                this->write_out();
+        }
+    }
+
+    void write_binary(const Entry &entry, const char *text, size_t length, long tid, const char *name)
+    {
+        if (this->stream_name_ != name) {
+            this->stream_name_ = name;
+            this->stream_writer_.name(this->out_, name);
+        }
+
+        if (entry.kind == LogKind::structured) {
+            LogSite &site = const_cast<LogSite &>(*entry.site);
+            if (site.stream != this->stream_) {
+                if (site.stream == 0)
+                    site.id = next_site_id();
+                site.stream = this->stream_;
+                this->stream_writer_.site(this->out_, site);
+            }
+            this->stream_writer_.message(this->out_, site, entry.time, tid, text, length);
+        } else {
+            LogLine line = { entry.kind, entry.level, entry.time, tid, entry.func, entry.file, entry.line, text, length };
+            this->stream_writer_.text(this->out_, line);
+        }
+
+        if (this->out_.size() >= kBatch)
+            this->write_out();
+    }
+
+    // Where the writer thread's output goes, nullptr for stdout.
+    LogFile *sink() const { return this->binary_ ? this->binary_.get() : this->file_.get(); }
+
+    // A new binary stream: sites and the name are defined again before use.
+    void start_stream()
+    {
+        this->stream_ = next_stream();
+        this->stream_name_.clear();
+        this->stream_writer_.header(this->out_);
+    }
+
+    void rotate(LogFile *sink)
+    {
+        this->write_out();
+        if (!sink->rotate())
+            fprintf(stderr, "logger: can not open %s: %s\n", sink->path().c_str(), strerror(errno));
+        if (sink == this->binary_.get())
+            this->start_stream();
+    }
+
+    void write_out()
+    {
+        if (this->out_.empty())
+            return;
+        if (LogFile *sink = this->sink()) {
+            sink->write(this->out_);    // Hands out_ over, gets an empty buffer back.
+            return;
+        }
+        fwrite(this->out_.data(), 1, this->out_.size(), stdout);
+        fflush(stdout);
+        this->out_.clear();
     }
 
 private:
@@ -270,6 +908,40 @@ private:
     const char *level_color_start_[8] = { "\033[31{m",/*EMERG red*/ "\033[31{m", /*ALERT red*/ "\033[31{m", /*CRIT red*/ "\033[31m", /*ERR red*/"\033[33m",/*WARN yellow*/ 
         "\033[35m", /*NOTICE purple*/ "\033[34m",/* INFO blue*/ "\033[36m" /* DEBUG green*/ };
     const char *level_color_end_     = "\033[0m";
+
+    std::unique_ptr<LogFile> file_;     // Instead of stdout, set by file().
+    std::string sync_line_;
+
+    // Async mode.
+    std::atomic<bool> async_ { false };
+    std::atomic<unsigned> generation_ { 0 };
+    AsyncOptions options_;
+    std::thread writer_;
+    std::atomic<bool> stop_ { false };
+    EventCount event_;                  // The writer parks here between batches.
+
+    std::mutex producers_mutex_;
+    std::vector<std::shared_ptr<Producer>> producers_;
+    uint64_t lost_ = 0;                 // Drops of producers already gone.
+
+    std::mutex flush_mutex_;
+    std::condition_variable flush_cond_;
+    std::atomic<uint64_t> flush_requested_ { 0 };
+    uint64_t flushed_ = 0;
+    bool writer_done_ = true;
+
+    // Writer thread only.
+    std::vector<Pending> batch_;
+    std::vector<size_t> positions_;
+    std::vector<bool> closed_;
+    std::string out_;
+    std::string line_;
+    std::string text_;
+    LogLayout layout_;
+    std::unique_ptr<LogFile> binary_;
+    LogStreamWriter stream_writer_;
+    uint32_t stream_ = 0;
+    std::string stream_name_;
 };
 
 /*
@@ -279,31 +951,75 @@ private:
 #define LOG_REDIRECT(callback_function, user_object, is_copy)     \
     Logger::inst()->redirect(callback_function, user_object, is_copy)
 
-#define LOG_LEVEL(level)                Logger::inst()->level(level)
+#define LOG_LEVEL(value)                Logger::inst()->level(value)
 #define LOG_NAME(n)                     Logger::inst()->name(n)
 #define LOG_CATEGORY(level)             Logger::inst()->category(level)
 #define LOG_SYS(is_syslog)              Logger::inst()->syslog(is_syslog)
+#define LOG_ASYNC(is_async)             Logger::inst()->async(is_async)
+#define LOG_FLUSH()                     Logger::inst()->flush()
+#define LOG_FILE(path)                  Logger::inst()->file(path)
 
 #define LOGM(fmt, ...)                                              \
     do {                                                            \
-        Logger::inst()->format(true, "");                           \
-        Logger::inst()->format(false, "");                          \
-        Logger::inst()->stamp(LOGGER_INFO, fmt, ##__VA_ARGS__);     \
+        if (LOGGER_INFO <= LOGGER_MIN_LEVEL) {                      \
+            Logger::inst()->format(true, "");                       \
+            Logger::inst()->format(false, "");                      \
+            Logger::inst()->stamp(LOGGER_INFO, fmt, ##__VA_ARGS__); \
+        }                                                           \
     } while(0)
 
+// level and fmt are stored in a static LogSite: level must be a constant,
+// fmt a string literal, which "" fmt "" enforces.
 #define LOGF(level, fmt, ...)                                       \
     do {                                                            \
-        Logger::inst()->format(true, "%s: ", __FUNCTION__);         \
-        Logger::inst()->format(false, " (%s:%d)", __FILENAME__, __LINE__);\
-        Logger::inst()->stamp(level, fmt, ##__VA_ARGS__);           \
+        if ((level) <= LOGGER_MIN_LEVEL) {                          \
+            static LogSite _log_site = { level, __LINE__, "" fmt "", __FILE__, __FUNCTION__, 0, 0, {0}, 0, {} };\
+            Logger::inst()->record(_log_site, ##__VA_ARGS__);       \
+        }                                                           \
     } while(0)
 
+// LOGF when a per-call-site Limit (src/log_limit.hpp) passes the line.
+// Lines below the logger's level never reach the limit.
+#define LOGF_LIMITED(log_level, Limit, arg, fmt, ...)               \
+    do {                                                            \
+        if ((log_level) <= LOGGER_MIN_LEVEL && (log_level) <= Logger::inst()->level()) {\
+            static Limit _log_limit;                                \
+            if (_log_limit.pass(arg))                               \
+                LOGF(log_level, fmt, ##__VA_ARGS__);                \
+        }                                                           \
+    } while(0)
+
+#define LOGF_EVERY_N(level, n, fmt, ...)        LOGF_LIMITED(level, LogEveryN, n, fmt, ##__VA_ARGS__)
+#define LOGF_FIRST_N(level, n, fmt, ...)        LOGF_LIMITED(level, LogFirstN, n, fmt, ##__VA_ARGS__)
+#define LOGF_RATE(level, per_sec, fmt, ...)     LOGF_LIMITED(level, LogRate, per_sec, fmt, ##__VA_ARGS__)
+#define LOGF_SAMPLE(level, p, fmt, ...)         LOGF_LIMITED(level, LogSample, p, fmt, ##__VA_ARGS__)
+
 
 #define LOGD(fmt, ...)                  LOGF(LOGGER_DEBUG, fmt, ##__VA_ARGS__)
 #define LOGI(fmt, ...)                  LOGF(LOGGER_INFO, fmt, ##__VA_ARGS__)
 #define LOGW(fmt, ...)                  LOGF(LOGGER_WARNING, fmt, ##__VA_ARGS__)
 #define LOGE(fmt, ...)                  LOGF(LOGGER_ERR, fmt, ##__VA_ARGS__)
 
+#define LOGD_EVERY_N(n, fmt, ...)       LOGF_EVERY_N(LOGGER_DEBUG, n, fmt, ##__VA_ARGS__)
+#define LOGI_EVERY_N(n, fmt, ...)       LOGF_EVERY_N(LOGGER_INFO, n, fmt, ##__VA_ARGS__)
+#define LOGW_EVERY_N(n, fmt, ...)       LOGF_EVERY_N(LOGGER_WARNING, n, fmt, ##__VA_ARGS__)
+#define LOGE_EVERY_N(n, fmt, ...)       LOGF_EVERY_N(LOGGER_ERR, n, fmt, ##__VA_ARGS__)
+
+#define LOGD_FIRST_N(n, fmt, ...)       LOGF_FIRST_N(LOGGER_DEBUG, n, fmt, ##__VA_ARGS__)
+#define LOGI_FIRST_N(n, fmt, ...)       LOGF_FIRST_N(LOGGER_INFO, n, fmt, ##__VA_ARGS__)
+#define LOGW_FIRST_N(n, fmt, ...)       LOGF_FIRST_N(LOGGER_WARNING, n, fmt, ##__VA_ARGS__)
+#define LOGE_FIRST_N(n, fmt, ...)       LOGF_FIRST_N(LOGGER_ERR, n, fmt, ##__VA_ARGS__)
+
+#define LOGD_RATE(per_sec, fmt, ...)    LOGF_RATE(LOGGER_DEBUG, per_sec, fmt, ##__VA_ARGS__)
+#define LOGI_RATE(per_sec, fmt, ...)    LOGF_RATE(LOGGER_INFO, per_sec, fmt, ##__VA_ARGS__)
+#define LOGW_RATE(per_sec, fmt, ...)    LOGF_RATE(LOGGER_WARNING, per_sec, fmt, ##__VA_ARGS__)
+#define LOGE_RATE(per_sec, fmt, ...)    LOGF_RATE(LOGGER_ERR, per_sec, fmt, ##__VA_ARGS__)
+
+#define LOGD_SAMPLE(p, fmt, ...)        LOGF_SAMPLE(LOGGER_DEBUG, p, fmt, ##__VA_ARGS__)
+#define LOGI_SAMPLE(p, fmt, ...)        LOGF_SAMPLE(LOGGER_INFO, p, fmt, ##__VA_ARGS__)
+#define LOGW_SAMPLE(p, fmt, ...)        LOGF_SAMPLE(LOGGER_WARNING, p, fmt, ##__VA_ARGS__)
+#define LOGE_SAMPLE(p, fmt, ...)        LOGF_SAMPLE(LOGGER_ERR, p, fmt, ##__VA_ARGS__)
+
 #define LOGM_WITH_RETURN(ret, fmt, ...)		do { LOGM(fmt, ##__VA_ARGS__); return ret; } while(0)
 
 #define LOGD_WITH_RETURN(ret, fmt, ...)		do { LOGD(fmt, ##__VA_ARGS__); return ret; } while(0)
@@ -316,13 +1032,18 @@ private:
 #define LOGW_WITH_GOTO(label, fmt, ...)		do { LOGW(fmt, ##__VA_ARGS__); goto label; } while(0)
 #define LOGE_WITH_GOTO(label, fmt, ...)		do { LOGE(fmt, ##__VA_ARGS__); goto label; } while(0)
 
-#define LOG_HEX_DUMP(x, y)                  Logger::inst()->dump(x, y)
+#define LOG_HEX_DUMP(x, y)                                          \
+    do {                                                            \
+        if (LOGGER_DEBUG <= LOGGER_MIN_LEVEL)                       \
+            Logger::inst()->dump(x, y);                             \
+    } while(0)
 
 #define LOG_HEX_DUMP_WITH_TAG(x, y, z)                              \
     do {                                                            \
         Logger::inst()->format(true, "%s: ", __FUNCTION__);         \
         Logger::inst()->format(false, " (%s:%d)", __FILENAME__, __LINE__); \
-        Logger::inst()->dump(x, y, z);                              \
+        if (LOGGER_DEBUG <= LOGGER_MIN_LEVEL)                       \
+            Logger::inst()->dump(x, y, z);                          \
     } while(0)
 
 #define LOG_EXP_CHECK(exp, ok, fmt, ...)                            \
@@ -0,0 +1,289 @@
+#ifndef _LOG_FILE_HPP_
+#define _LOG_FILE_HPP_
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/*
+ * Log file with rotation.
+ *
+ * Whole buffers are handed over, not copied, and written together with
+ * one writev() once buffer_size bytes are pending or on flush(): one
+ * syscall per batch instead of one per line. A full segment (max_size
+ * bytes, or open for max_age) is renamed path.1, the older ones shifted
+ * to path.2 ... path.keep, and a fresh path is opened. Rotated segments
+ * may be gzipped in the background: the segment is then only moved aside
+ * and one compressor thread, started on the first rotation, shifts the
+ * older ones and gzips it, so that the writer never waits for gzip.
+ */
+class LogFile
+{
+public:
+    // When written data is forced to disk with fdatasync().
+    enum class Sync
+    {
+        none,           // Left to the OS.
+        periodic,       // At most every sync_interval, and on flush(true).
+        always          // After every write.
+    };
+
+    struct Options
+    {
+        std::string path;                       // Empty: no file.
+        size_t max_size = 0;                    // Rotate past this many bytes, 0 never.
+        std::chrono::seconds max_age { 0 };     // Rotate a segment open this long, 0 never.
+        size_t keep = 5;                        // Rotated segments kept, path.1 being the newest.
+        bool compress = false;                  // gzip rotated segments in the background.
+        Sync sync = Sync::periodic;
+        std::chrono::milliseconds sync_interval { 1000 };
+        size_t buffer_size = 1 << 20;           // Bytes gathered before a writev().
+    };
+
+    explicit LogFile(const Options &options) : options_(options) { }
+
+    LogFile(const LogFile &other) = delete;
+    void operator=(const LogFile &other) = delete;
+
+    // Waits for the segments still queued for compression.
+    ~LogFile()
+    {
+        close();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        if (compressor_.joinable())
+            compressor_.join();
+    }
+
+    // False, errno set, when the file can not be opened.
+    bool open()
+    {
+        fd_ = ::open(options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+            return false;
+
+        struct stat st;
+        written_ = fstat(fd_, &st) == 0 ? (size_t)st.st_size : 0;
+        opened_ = time(nullptr);
+        synced_ = std::chrono::steady_clock::now();
+        return true;
+    }
+
+    const std::string &path() const { return options_.path; }
+
+    // Bytes in the current segment, written or pending.
+    size_t size() const { return written_ + pending_bytes_; }
+
+    // Takes buffer's contents over, leaving it empty but with room to
+    // fill the next batch.
+    void write(std::string &buffer)
+    {
+        if (buffer.empty())
+            return;
+
+        pending_bytes_ += buffer.size();
+        pending_.push_back(std::string());
+        pending_.back().swap(buffer);
+        if (!spare_.empty()) {
+            buffer.swap(spare_.back());
+            spare_.pop_back();
+        }
+
+        if (pending_bytes_ >= options_.buffer_size)
+            flush(false);
+    }
+
+    // Writes what is pending; durable forces it to disk unless Sync::none.
+    void flush(bool durable)
+    {
+        if (fd_ >= 0 && !pending_.empty())
+            write_pending();
+        recycle();
+
+        if (fd_ < 0 || options_.sync == Sync::none)
+            return;
+        auto now = std::chrono::steady_clock::now();
+        if (durable || options_.sync == Sync::always || now - synced_ >= options_.sync_interval) {
+            fdatasync(fd_);
+            synced_ = now;
+        }
+    }
+
+    // True when a record should start a new segment first; held counts
+    // bytes the caller has gathered but not handed over yet.
+    bool due(size_t held = 0) const
+    {
+        if (fd_ < 0)
+            return false;
+        if (options_.max_size && size() + held >= options_.max_size)
+            return true;
+        return options_.max_age.count() && time(nullptr) - opened_ >= options_.max_age.count();
+    }
+
+    // Closes the segment, shifts the rotated ones and opens a fresh one.
+    bool rotate()
+    {
+        close();
+
+        if (options_.keep == 0) {
+            unlink(options_.path.c_str());
+        } else if (options_.compress) {
+            // The compressor may be gzipping path.1 still: leave the
+            // shifting to it, behind the segments it has queued.
+            std::string aside = options_.path + ".rotated." + std::to_string(++rotated_);
+            rename(options_.path.c_str(), aside.c_str());
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(aside);
+            if (!compressor_.joinable())
+                compressor_ = std::thread(&LogFile::compress_loop, this);
+            cond_.notify_one();
+        } else {
+            shift(options_.path);
+        }
+        return open();
+    }
+
+    void close()
+    {
+        if (fd_ < 0)
+            return;
+        flush(options_.sync != Sync::none);
+        ::close(fd_);
+        fd_ = -1;
+    }
+
+private:
+    std::string segment(size_t n) const { return options_.path + "." + std::to_string(n); }
+
+    void remove_segment(size_t n) const
+    {
+        unlink(segment(n).c_str());
+        unlink((segment(n) + ".gz").c_str());
+    }
+
+    // Moves the rotated segments one up, dropping the oldest, and renames
+    // from to path.1.
+    void shift(const std::string &from) const
+    {
+        remove_segment(options_.keep);
+        for (size_t i = options_.keep; i > 1; --i) {
+            rename((segment(i - 1)).c_str(), segment(i).c_str());
+            rename((segment(i - 1) + ".gz").c_str(), (segment(i) + ".gz").c_str());
+        }
+        rename(from.c_str(), segment(1).c_str());
+    }
+
+    // Compressor thread: one queued segment after the other, until the
+    // queue is empty on destruction.
+    void compress_loop()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            std::string aside = std::move(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            shift(aside);
+            gzip(segment(1));
+            lock.lock();
+        }
+    }
+
+    void write_pending()
+    {
+        std::vector<struct iovec> iov(pending_.size());
+        for (size_t i = 0; i < pending_.size(); ++i) {
+            iov[i].iov_base = &pending_[i][0];
+            iov[i].iov_len = pending_[i].size();
+        }
+
+        size_t first = 0;
+        while (first < iov.size()) {
+            int count = (int)std::min(iov.size() - first, (size_t)IOV_MAX);
+            ssize_t n = writev(fd_, &iov[first], count);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "logger: write %s: %s\n", options_.path.c_str(), strerror(errno));
+                break;
+            }
+            written_ += n;
+            // Step over what went out, a short write leaves part of one buffer.
+            while (first < iov.size() && (size_t)n >= iov[first].iov_len)
+                n -= iov[first++].iov_len;
+            if (first < iov.size()) {
+                iov[first].iov_base = (char *)iov[first].iov_base + n;
+                iov[first].iov_len -= n;
+            }
+        }
+    }
+
+    // Written buffers become spares for write() to hand back.
+    void recycle()
+    {
+        for (size_t i = 0; i < pending_.size(); ++i) {
+            pending_[i].clear();
+            if (spare_.size() < kSpares)
+                spare_.push_back(std::move(pending_[i]));
+        }
+        pending_.clear();
+        pending_bytes_ = 0;
+    }
+
+    static void gzip(std::string path)
+    {
+        const char *argv[] = { "gzip", "-f", path.c_str(), nullptr };
+        pid_t pid;
+        if (posix_spawnp(&pid, "gzip", nullptr, nullptr, const_cast<char **>(argv), environ) != 0)
+            return;     // No gzip, the segment stays as it is.
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+            ;
+    }
+
+private:
+    static const size_t kSpares = 8;
+
+    Options options_;
+    int fd_ = -1;
+    size_t written_ = 0;
+    time_t opened_ = 0;
+    std::chrono::steady_clock::time_point synced_;
+
+    std::vector<std::string> pending_;
+    size_t pending_bytes_ = 0;
+    std::vector<std::string> spare_;
+
+    // Segments moved aside for the compressor thread, oldest first.
+    size_t rotated_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::string> queue_;
+    bool stop_ = false;
+    std::thread compressor_;
+};
+
+#endif //_LOG_FILE_HPP_
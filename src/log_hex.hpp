@@ -0,0 +1,184 @@
+#ifndef _LOG_HEX_HPP_
+#define _LOG_HEX_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Hex dump lines, 16 bytes each:
+ *
+ *     <indent>xx xx xx ... xx \t\t<printable ASCII, '.' otherwise>
+ *
+ * Full lines go through a vector kernel picked at compile time: AVX2
+ * does two lines per step, SSSE3 one, SSE2 converts the nibbles and
+ * the ASCII column in vector registers and spaces the pairs out with
+ * scalar stores. -mavx2 or -march=native selects the wider ones; any
+ * other target and the short last line take the scalar path.
+ */
+
+static const size_t kLogHexBytes = 16;                  // Input bytes per line.
+static const size_t kLogHexWidth = kLogHexBytes * 3;    // "xx " per byte.
+
+// Length of a full line, newline included.
+inline size_t log_hex_line_size(size_t indent) { return indent + kLogHexWidth + 2 + kLogHexBytes + 1; }
+
+// One line of size bytes (at most 16) at out, which must have room for
+// log_hex_line_size(indent). Returns the end of the line.
+inline char *log_hex_line(char *out, const uint8_t *bytes, size_t size, size_t indent)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    memset(out, ' ', indent + kLogHexWidth);
+    char *hex = out + indent;
+    char *text = hex + kLogHexWidth + 2;
+    hex[kLogHexWidth] = '\t';
+    hex[kLogHexWidth + 1] = '\t';
+    for (size_t i = 0; i < size; ++i) {
+        hex[i * 3] = digits[bytes[i] >> 4];
+        hex[i * 3 + 1] = digits[bytes[i] & 0x0f];
+        text[i] = bytes[i] >= 0x20 && bytes[i] <= 0x7e ? (char)bytes[i] : '.';
+    }
+    text[size] = '\n';
+    return text + size + 1;
+}
+
+/*
+ * Appends lines for size bytes at data, the last one possibly short.
+ * out grows once, by the exact size of the lines.
+ */
+inline void log_hex_lines(std::string &out, const void *data, size_t size, size_t indent)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    size_t lines = (size + kLogHexBytes - 1) / kLogHexBytes;
+    size_t line_size = log_hex_line_size(indent);
+    size_t start = out.size();
+    out.resize(start + lines * line_size);
+    char *p = &out[start];
+    const uint8_t *end = bytes + size / kLogHexBytes * kLogHexBytes;
+
+#if defined(__SSE2__)
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i dot = _mm_set1_epi8('.');
+    const __m128i below = _mm_set1_epi8(0x1f);
+    const __m128i above = _mm_set1_epi8(0x7f);
+#if defined(__SSSE3__)
+    // The 48 hex characters of a line, 16 at a time: byte 3i is the high
+    // nibble digit of input byte i, 3i + 1 the low one, 3i + 2 a space.
+    const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7',
+            '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i hi_mask[3] = {
+        _mm_setr_epi8(0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128, 5),
+        _mm_setr_epi8(-128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10, -128),
+        _mm_setr_epi8(-128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128, -128),
+    };
+    const __m128i lo_mask[3] = {
+        _mm_setr_epi8(-128, 0, -128, -128, 1, -128, -128, 2, -128, -128, 3, -128, -128, 4, -128, -128),
+        _mm_setr_epi8(5, -128, -128, 6, -128, -128, 7, -128, -128, 8, -128, -128, 9, -128, -128, 10),
+        _mm_setr_epi8(-128, -128, 11, -128, -128, 12, -128, -128, 13, -128, -128, 14, -128, -128, 15, -128),
+    };
+    const __m128i space_mask[3] = {
+        _mm_setr_epi8(0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0),
+        _mm_setr_epi8(0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0),
+        _mm_setr_epi8(' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' ', 0, 0, ' '),
+    };
+#endif
+
+#if defined(__AVX2__)
+    const __m256i nibble2 = _mm256_set1_epi8(0x0f);
+    const __m256i dot2 = _mm256_set1_epi8('.');
+    const __m256i below2 = _mm256_set1_epi8(0x1f);
+    const __m256i above2 = _mm256_set1_epi8(0x7f);
+    const __m256i digits2 = _mm256_broadcastsi128_si256(digits);
+    __m256i hi_mask2[3], lo_mask2[3], space_mask2[3];
+    for (int k = 0; k < 3; ++k) {
+        hi_mask2[k] = _mm256_broadcastsi128_si256(hi_mask[k]);
+        lo_mask2[k] = _mm256_broadcastsi128_si256(lo_mask[k]);
+        space_mask2[k] = _mm256_broadcastsi128_si256(space_mask[k]);
+    }
+
+    // Two lines a step, one per 128-bit lane.
+    for (; end - bytes >= 32; bytes += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bytes));
+        __m256i hi = _mm256_shuffle_epi8(digits2, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble2));
+        __m256i lo = _mm256_shuffle_epi8(digits2, _mm256_and_si256(v, nibble2));
+        __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(v, below2), _mm256_cmpgt_epi8(above2, v));
+        __m256i text = _mm256_or_si256(_mm256_and_si256(printable, v), _mm256_andnot_si256(printable, dot2));
+
+        char *second = p + line_size;
+        for (int k = 0; k < 3; ++k) {
+            __m256i chunk = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(hi, hi_mask2[k]),
+                    _mm256_shuffle_epi8(lo, lo_mask2[k])), space_mask2[k]);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(p + indent + k * 16), _mm256_castsi256_si128(chunk));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(second + indent + k * 16), _mm256_extracti128_si256(chunk, 1));
+        }
+        for (char *line = p; line != second + line_size; line += line_size) {
+            memset(line, ' ', indent);
+            line[indent + kLogHexWidth] = '\t';
+            line[indent + kLogHexWidth + 1] = '\t';
+            line[line_size - 1] = '\n';
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(p + line_size - 1 - kLogHexBytes), _mm256_castsi256_si128(text));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(second + line_size - 1 - kLogHexBytes), _mm256_extracti128_si256(text, 1));
+        p = second + line_size;
+    }
+#endif
+
+    for (; bytes != end; bytes += kLogHexBytes) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bytes));
+        __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmplt_epi8(v, above));
+        __m128i text = _mm_or_si128(_mm_and_si128(printable, v), _mm_andnot_si128(printable, dot));
+        memset(p, ' ', indent);
+        char *hex = p + indent;
+#if defined(__SSSE3__)
+        __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+        for (int k = 0; k < 3; ++k) {
+            __m128i chunk = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(hi, hi_mask[k]),
+                    _mm_shuffle_epi8(lo, lo_mask[k])), space_mask[k]);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(hex + k * 16), chunk);
+        }
+#else
+        // '0' + n, and 'a' - '0' - 10 more past 9.
+        const __m128i zero = _mm_set1_epi8('0');
+        const __m128i nine = _mm_set1_epi8(9);
+        const __m128i letter = _mm_set1_epi8('a' - '0' - 10);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+        __m128i lo = _mm_and_si128(v, nibble);
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter));
+        // Pairs interleaved, then spaced out three bytes apart.
+        char pairs[32];
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pairs), _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pairs + 16), _mm_unpackhi_epi8(hi, lo));
+        for (size_t i = 0; i < kLogHexBytes; ++i) {
+            memcpy(hex + i * 3, pairs + i * 2, 2);
+            hex[i * 3 + 2] = ' ';
+        }
+#endif
+        hex[kLogHexWidth] = '\t';
+        hex[kLogHexWidth + 1] = '\t';
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(hex + kLogHexWidth + 2), text);
+        hex[kLogHexWidth + 2 + kLogHexBytes] = '\n';
+        p += line_size;
+    }
+#else
+    for (; bytes != end; bytes += kLogHexBytes)
+        p = log_hex_line(p, bytes, kLogHexBytes, indent);
+#endif
+
+    if (bytes != static_cast<const uint8_t *>(data) + size)
+        p = log_hex_line(p, bytes, static_cast<const uint8_t *>(data) + size - bytes, indent);
+    out.resize(p - out.data());
+}
+
+#endif //_LOG_HEX_HPP_
@@ -0,0 +1,91 @@
+#ifndef _LOG_LIMIT_HPP_
+#define _LOG_LIMIT_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+/*
+ * Per-call-site limits for the LOG*_EVERY_N, _FIRST_N, _RATE and _SAMPLE
+ * macros. Each is a static of its call site, zero-initialized at load
+ * time, shared by every thread without a lock. A suppressed line costs
+ * one relaxed atomic operation, or none for sampling, and is never
+ * formatted.
+ */
+
+// Lines 1, n + 1, 2n + 1 ... of the call site.
+struct LogEveryN
+{
+    std::atomic<uint64_t> count;
+
+    bool pass(uint64_t n) { return count.fetch_add(1, std::memory_order_relaxed) % (n ? n : 1) == 0; }
+};
+
+// The first n lines of the call site; a plain load once they are spent.
+struct LogFirstN
+{
+    std::atomic<uint64_t> count;
+
+    bool pass(uint64_t n)
+    {
+        return count.load(std::memory_order_relaxed) < n && count.fetch_add(1, std::memory_order_relaxed) < n;
+    }
+};
+
+/*
+ * At most per_sec lines a second, a burst of up to per_sec of them
+ * included. Keeps the time the next line is due (GCRA): a line passes
+ * unless that time is more than a second ahead, and pushes it on by one
+ * interval.
+ */
+struct LogRate
+{
+    std::atomic<int64_t> due;       // Microseconds of the coarse monotonic clock.
+
+    bool pass(double per_sec)
+    {
+        if (per_sec <= 0)
+            return false;
+
+        int64_t now = clock();
+        int64_t interval = (int64_t)(1000000 / per_sec);
+        int64_t t = due.load(std::memory_order_relaxed);
+        do {
+            if (t - now > 1000000 - interval)
+                return false;
+        } while (!due.compare_exchange_weak(t, (t > now ? t : now) + interval, std::memory_order_relaxed));
+        return true;
+    }
+
+    static int64_t clock()
+    {
+        struct timespec ts;
+#if defined(CLOCK_MONOTONIC_COARSE)
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+};
+
+// Each line with the given probability, drawn from a generator of the
+// calling thread: no shared state at all.
+struct LogSample
+{
+    bool pass(double probability)
+    {
+        static thread_local uint64_t state = 0;
+        if (state == 0)
+            state = (((uint64_t)(uintptr_t)&state * 0x9e3779b97f4a7c15ull) ^ (uint64_t)LogRate::clock()) | 1;
+
+        // xorshift64*
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        uint64_t x = state * 0x2545f4914f6cdd1dull;
+        return (double)(x >> 11) * (1.0 / 9007199254740992.0) < probability;
+    }
+};
+
+#endif //_LOG_LIMIT_HPP_
@@ -0,0 +1,892 @@
+#ifndef _LOG_RECORD_HPP_
+#define _LOG_RECORD_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <sys/time.h>
+
+/*
+ * Deferred-format log records.
+ *
+ * In structured mode a log call stores its call site, a static LogSite
+ * holding the format string, location and level, and the raw bytes of its
+ * arguments. Formatting happens later, in Logger's writer thread or in the
+ * offline logdecode tool. A binary log stream is:
+ *
+ *     header  "LOGB", version byte
+ *     'N'     str name                     logger name of the lines that follow
+ *     'S'     var id, var level, var line, str format, str file, str function
+ *     'M'     var site, svar time, var tid, str arguments
+ *     'T'     var kind, var level, svar time, var tid, var line, str function, str file, str text
+ *
+ * var is an unsigned LEB128 varint, svar a zigzag one, str a var length
+ * and the bytes. time is in microseconds since the previous 'M' or 'T'
+ * record, since the epoch for the first one. A site is defined once per
+ * stream, before its first message. Streams may follow one another in a
+ * file, each from its header on, as a restarted logger appends them.
+ * Every argument is a tag byte and its
+ * value, doubles in host byte order:
+ *
+ *     'i' svar    'u' var    'd' double    'p' var pointer    's' str    'n' null string
+ *
+ * A C string is encoded from what its conversion makes of it, as printf
+ * would: a pointer for %p, at most the precision's bytes for %.Ns and %.*s.
+ */
+
+enum class LogKind : uint8_t
+{
+    print,          // The bare message.
+    log,            // Level, name and thread.
+    stamp,          // Time, level, name and thread.
+    structured      // A LogSite and its arguments, laid out as stamp once formatted.
+};
+
+// What the format does with one argument.
+struct LogConversion
+{
+    static const int kNoPrecision = -1;
+    static const int kPrecisionArg = -2;    // %.*s: the argument before.
+
+    char conversion = 0;    // As written, 'd' for a '*'; 0 when no conversion takes the argument.
+    int precision = kNoPrecision;
+};
+
+/*
+ * Conversions of format in argument order, '*' ones included, as
+ * log_format() replays them. Returns how many, -1 when there are more
+ * than max.
+ */
+inline int log_parse_conversions(const char *format, LogConversion *out, size_t max)
+{
+    size_t n = 0;
+    auto add = [&](char conversion, int precision) {
+        if (n < max) {
+            out[n].conversion = conversion;
+            out[n].precision = precision;
+        }
+        ++n;
+    };
+
+    for (const char *p = strchr(format, '%'); p; p = strchr(p, '%')) {
+        if (*++p == '%') {
+            ++p;
+            continue;
+        }
+        while (*p && strchr("-+ #0'", *p))
+            ++p;
+        if (*p == '*') {
+            add('d', LogConversion::kNoPrecision);
+            ++p;
+        }
+        while (*p >= '0' && *p <= '9')
+            ++p;
+        int precision = LogConversion::kNoPrecision;
+        if (*p == '.') {
+            ++p;
+            if (*p == '*') {
+                add('d', LogConversion::kNoPrecision);
+                precision = LogConversion::kPrecisionArg;
+                ++p;
+            } else {
+                precision = 0;
+                while (*p >= '0' && *p <= '9')
+                    precision = std::min(precision * 10 + (*p++ - '0'), INT_MAX / 10);
+            }
+        }
+        while (*p && strchr("hlLqjzt", *p))
+            ++p;
+        if (!*p)
+            break;
+        if (*p != 'n')
+            add(*p, precision);
+        ++p;
+    }
+    return n <= max ? (int)n : -1;
+}
+
+// Static data of one LOGF call; the format string must be a literal.
+struct LogSite
+{
+    static const size_t kMaxConversions = 16;
+
+    int level;
+    int line;
+    const char *format;
+    const char *file;
+    const char *func;
+
+    // Writer thread only: id in the binary stream, and the stream it was defined in.
+    uint32_t id;
+    uint32_t stream;
+
+    // Producer side, format parsed by the first call that needs it.
+    mutable std::atomic<int> parsed;        // 0 not yet, 1 under way, 2 done.
+    mutable int count;
+    mutable LogConversion table[kMaxConversions];
+
+    // The conversions of format, count set to how many; nullptr when
+    // there are too many to keep, the call then formats as text.
+    const LogConversion *conversions(size_t &n) const
+    {
+        if (parsed.load(std::memory_order_acquire) != 2) {
+            int expected = 0;
+            if (parsed.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+                count = log_parse_conversions(format, table, kMaxConversions);
+                parsed.store(2, std::memory_order_release);
+            } else {
+                while (parsed.load(std::memory_order_acquire) != 2)
+                    std::this_thread::yield();
+            }
+        }
+        n = count < 0 ? 0 : (size_t)count;
+        return count < 0 ? nullptr : table;
+    }
+};
+
+inline const char *log_category(int level)
+{
+    static const char *levels[] = { "E", "A", "C", "E", "W", "N", "I", "D" };
+    return levels[level & 7];
+}
+
+inline const char *log_basename(const char *file)
+{
+    const char *slash = file ? strrchr(file, '/') : nullptr;
+    return slash ? slash + 1 : file;
+}
+
+// Wall clock in microseconds, to a few milliseconds where the OS has a
+// cheap coarse clock. Enough to order lines written seconds apart.
+inline int64_t log_coarse_time()
+{
+#if defined(CLOCK_REALTIME_COARSE)
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+inline char *log_put_var(char *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (char)v;
+    return p;
+}
+
+inline uint64_t log_zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+inline int64_t log_unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/*
+ * Argument encoding, picked by type at compile time, C strings also by
+ * their conversion. size() is an upper bound, write() returns where the
+ * argument actually ended. precision() is what the argument stands for
+ * as the '*' precision of the next one, -1 for none.
+ */
+template <typename T, typename Enable = void>
+struct LogArg
+{
+    static_assert(std::is_arithmetic<T>::value || std::is_pointer<T>::value,
+            "log arguments must be numbers, pointers or C strings");
+};
+
+template <typename T>
+struct LogArg<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>
+{
+    static size_t size(T, const LogConversion &, long long) { return 11; }
+    static long long precision(T value) { return (long long)value; }
+
+    static char *write(char *p, T value, const LogConversion &, long long)
+    {
+        bool is_signed = std::is_enum<T>::value || std::is_signed<T>::value;
+        *p = is_signed ? 'i' : 'u';
+        return log_put_var(p + 1, is_signed ? log_zigzag((int64_t)value) : (uint64_t)value);
+    }
+};
+
+template <typename T>
+struct LogArg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static size_t size(T, const LogConversion &, long long) { return 9; }
+    static long long precision(T) { return -1; }
+
+    static char *write(char *p, T value, const LogConversion &, long long)
+    {
+        double d = (double)value;
+        *p = 'd';
+        memcpy(p + 1, &d, 8);
+        return p + 9;
+    }
+};
+
+template <typename T>
+struct LogArg<T *, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+    static size_t size(T *, const LogConversion &, long long) { return 11; }
+    static long long precision(T *) { return -1; }
+
+    static char *write(char *p, T *value, const LogConversion &, long long)
+    {
+        *p = 'p';
+        return log_put_var(p + 1, (uint64_t)(uintptr_t)value);
+    }
+};
+
+template <typename T>
+struct LogArg<T *, typename std::enable_if<std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+    static size_t size(T *value, const LogConversion &conversion, long long precision)
+    {
+        return 11 + (value && conversion.conversion == 's' ? length(value, conversion, precision) : 0);
+    }
+
+    static long long precision(T *) { return -1; }
+
+    // Anything but %s only prints the pointer, if anything.
+    static char *write(char *p, T *value, const LogConversion &conversion, long long precision)
+    {
+        if (conversion.conversion != 's')
+            return LogArg<const void *>::write(p, value, conversion, precision);
+        if (!value) {
+            *p = 'n';
+            return p + 1;
+        }
+        size_t length = LogArg::length(value, conversion, precision);
+        *p = 's';
+        p = log_put_var(p + 1, length);
+        memcpy(p, value, length);
+        return p + length;
+    }
+
+private:
+    // What printf reads of value: up to the precision when there is one,
+    // so an unterminated buffer is never read past it.
+    static size_t length(T *value, const LogConversion &conversion, long long precision)
+    {
+        if (conversion.precision >= 0)
+            return strnlen(value, (size_t)conversion.precision);
+        if (conversion.precision == LogConversion::kPrecisionArg && precision >= 0)
+            return strnlen(value, (size_t)precision);
+        return strlen(value);
+    }
+};
+
+template <>
+struct LogArg<std::nullptr_t>
+{
+    static size_t size(std::nullptr_t, const LogConversion &, long long) { return 11; }
+    static long long precision(std::nullptr_t) { return -1; }
+
+    static char *write(char *p, std::nullptr_t, const LogConversion &conversion, long long precision)
+    {
+        return LogArg<const void *>::write(p, nullptr, conversion, precision);
+    }
+};
+
+/*
+ * Sizes and writes the arguments, the i-th one converted by conversions[i]
+ * while there are n of them, by no conversion past that. last: precision()
+ * of the argument before.
+ */
+inline size_t log_args_size(const LogConversion *, size_t, long long) { return 0; }
+
+template <typename T, typename... Rest>
+size_t log_args_size(const LogConversion *conversions, size_t n, long long last, const T &value,
+        const Rest &... rest)
+{
+    return LogArg<T>::size(value, n ? *conversions : LogConversion(), last)
+        + log_args_size(n ? conversions + 1 : conversions, n ? n - 1 : 0, LogArg<T>::precision(value), rest...);
+}
+
+inline char *log_args_write(char *p, const LogConversion *, size_t, long long) { return p; }
+
+template <typename T, typename... Rest>
+char *log_args_write(char *p, const LogConversion *conversions, size_t n, long long last, const T &value,
+        const Rest &... rest)
+{
+    return log_args_write(LogArg<T>::write(p, value, n ? *conversions : LogConversion(), last),
+            n ? conversions + 1 : conversions, n ? n - 1 : 0, LogArg<T>::precision(value), rest...);
+}
+
+// Walks encoded arguments, strings come back pointing into them.
+class LogArgReader
+{
+public:
+    LogArgReader(const char *args, size_t size) : p_(args), end_(args + size) { }
+
+    bool next(char &tag, uint64_t &bits, const char *&text, size_t &length)
+    {
+        if (p_ >= end_)
+            return false;
+        tag = *p_++;
+        if (tag == 'n') {
+            tag = 's';
+            text = "(null)";
+            length = 6;
+            return true;
+        }
+        if (tag == 'd') {
+            if (end_ - p_ < 8)
+                return false;
+            memcpy(&bits, p_, 8);
+            p_ += 8;
+            return true;
+        }
+        if (!var(bits))
+            return false;
+        if (tag == 'i') {
+            bits = (uint64_t)log_unzigzag(bits);
+        } else if (tag == 's') {
+            if (bits > (uint64_t)(end_ - p_))
+                return false;
+            text = p_;
+            length = (size_t)bits;
+            p_ += bits;
+        }
+        return true;
+    }
+
+private:
+    bool var(uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; p_ < end_ && shift < 64; shift += 7) {
+            uint8_t byte = (uint8_t)*p_++;
+            v |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    const char *p_;
+    const char *end_;
+};
+
+// Digits of value in base 8, 10 or 16 after out, as %llo, %llu, %llx or %llX.
+inline void log_append_unsigned(std::string &out, unsigned long long value, unsigned base, bool upper = false)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buffer[24];
+    char *end = buffer + sizeof(buffer);
+    char *p = end;
+    do {
+        *--p = digits[value % base];
+        value /= base;
+    } while (value);
+    out.append(p, end - p);
+}
+
+// snprintf() after out, for what log_format() does not convert itself.
+template <typename T>
+void log_append_printf(std::string &out, const char *spec, T value)
+{
+    char buffer[128];
+    int n = snprintf(buffer, sizeof(buffer), spec, value);
+    if (n < 0)
+        return;
+    if (n < (int)sizeof(buffer)) {
+        out.append(buffer, n);
+        return;
+    }
+    size_t at = out.size();
+    out.resize(at + n + 1);
+    snprintf(&out[at], n + 1, spec, value);
+    out.resize(at + n);
+}
+
+/*
+ * Replays printf over encoded arguments: every conversion of the format
+ * takes the next argument, converted to what the conversion expects.
+ * Missing arguments leave the conversion as written. Strings, characters
+ * and integers without flags, width or precision are converted in place,
+ * the rest through snprintf(). Widths and precisions are capped at 64K.
+ */
+inline void log_format(std::string &out, const char *format, const char *args, size_t size)
+{
+    static const long long kMaxWidth = 1 << 16;
+
+    LogArgReader reader(args, size);
+    const char *text = nullptr;
+    size_t length = 0;
+    char tag = 0;
+    uint64_t bits = 0;
+
+    auto integer = [&]() -> long long {
+        if (tag == 'd') {
+            double d;
+            memcpy(&d, &bits, 8);
+            return (long long)d;
+        }
+        return (long long)bits;
+    };
+    auto real = [&]() -> double {
+        if (tag == 'd') {
+            double d;
+            memcpy(&d, &bits, 8);
+            return d;
+        }
+        return tag == 'i' ? (double)(int64_t)bits : (double)bits;
+    };
+    auto number = [&](const char *&q) -> long long {
+        long long value = 0;
+        while (*q >= '0' && *q <= '9')
+            value = std::min(value * 10 + (*q++ - '0'), kMaxWidth);
+        return value;
+    };
+
+    const char *p = format;
+    while (*p) {
+        const char *percent = strchr(p, '%');
+        if (!percent) {
+            out += p;
+            break;
+        }
+        out.append(p, percent - p);
+        if (percent[1] == '%') {
+            out += '%';
+            p = percent + 2;
+            continue;
+        }
+
+        // Flags, width and precision, '*' ones taken from the arguments: a
+        // negative width means '-', a negative precision none at all.
+        const char *q = percent + 1;
+        const char *flags = q;
+        while (*q && strchr("-+ #0'", *q))
+            ++q;
+        size_t flag_count = std::min((size_t)(q - flags), (size_t)8);
+        bool left = memchr(flags, '-', flag_count) != nullptr;
+        long long width = -1;
+        long long precision = -1;
+        bool missing = false;
+        if (*q == '*') {
+            ++q;
+            if (reader.next(tag, bits, text, length)) {
+                width = std::min(std::max(integer(), -kMaxWidth), kMaxWidth);
+                if (width < 0) {
+                    left = true;
+                    width = -width;
+                }
+            } else {
+                missing = true;
+            }
+        } else if (*q >= '0' && *q <= '9') {
+            width = number(q);
+        }
+        if (*q == '.') {
+            ++q;
+            if (*q == '*') {
+                ++q;
+                if (reader.next(tag, bits, text, length))
+                    precision = std::min(std::max(integer(), -1LL), kMaxWidth);
+                else
+                    missing = true;
+            } else {
+                precision = number(q);
+            }
+        }
+        while (*q && strchr("hlLqjzt", *q))
+            ++q;
+
+        char conversion = *q;
+        if (!conversion) {
+            out.append(percent);
+            break;
+        }
+        p = ++q;
+
+        if (conversion == 'n')
+            continue;
+        if (missing || !strchr("diouxXcseEfFgGaAp", conversion) || !reader.next(tag, bits, text, length)) {
+            out.append(percent, q - percent);
+            continue;
+        }
+
+        // Strings and characters, padded by hand.
+        if (conversion == 's' || conversion == 'c') {
+            char buffer[64];
+            if (conversion == 'c') {
+                buffer[0] = (char)integer();
+                text = buffer;
+                length = 1;
+            } else if (tag != 's') {
+                int n;
+                if (tag == 'p')
+                    n = snprintf(buffer, sizeof(buffer), "%p", (void *)(uintptr_t)bits);
+                else if (tag == 'd')
+                    n = snprintf(buffer, sizeof(buffer), "%g", real());
+                else
+                    n = snprintf(buffer, sizeof(buffer), "%lld", integer());
+                text = buffer;
+                length = std::min(std::max(n, 0), (int)sizeof(buffer) - 1);
+            }
+            if (conversion == 's' && precision >= 0)
+                length = std::min(length, (size_t)precision);
+            size_t fill = width > (long long)length ? (size_t)width - length : 0;
+            if (!left)
+                out.append(fill, ' ');
+            out.append(text, length);
+            if (left)
+                out.append(fill, ' ');
+            continue;
+        }
+
+        bool plain = flag_count == 0 && width < 0 && precision < 0;
+        if (plain && strchr("diouxX", conversion)) {
+            long long value = integer();
+            if (conversion == 'd' || conversion == 'i') {
+                if (value < 0)
+                    out += '-';
+                log_append_unsigned(out, value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value, 10);
+            } else {
+                unsigned base = conversion == 'o' ? 8 : conversion == 'u' ? 10 : 16;
+                log_append_unsigned(out, (unsigned long long)value, base, conversion == 'X');
+            }
+            continue;
+        }
+
+        // Rebuild the conversion with our own length modifier.
+        char spec[32];
+        char *s = spec;
+        *s++ = '%';
+        s = std::copy(flags, flags + flag_count, s);
+        if (left && !memchr(flags, '-', flag_count))
+            *s++ = '-';
+        if (width >= 0)
+            s += snprintf(s, 8, "%lld", width);
+        if (precision >= 0)
+            s += snprintf(s, 8, ".%lld", precision);
+        switch (conversion) {
+        case 'd': case 'i':
+            strcpy(s, "lld");
+            log_append_printf(out, spec, integer());
+            break;
+        case 'o': case 'u': case 'x': case 'X':
+            s[0] = 'l';
+            s[1] = 'l';
+            s[2] = conversion;
+            s[3] = 0;
+            log_append_printf(out, spec, (unsigned long long)integer());
+            break;
+        case 'p':
+            strcpy(s, "p");
+            log_append_printf(out, spec, (void *)(uintptr_t)bits);
+            break;
+        default:
+            s[0] = conversion;
+            s[1] = 0;
+            log_append_printf(out, spec, real());
+            break;
+        }
+    }
+}
+
+/*
+ * Lays a record out the way Logger prints it.
+ */
+struct LogLine
+{
+    LogKind kind;
+    int level;
+    int64_t time;
+    long tid;
+    const char *func;       // nullptr when the text carries its own prefix and suffix.
+    const char *file;
+    int line;
+    const char *text;
+    size_t length;
+};
+
+class LogLayout
+{
+public:
+    // Escapes around the line, or nullptr for none.
+    void append(std::string &out, const LogLine &line, const char *name,
+            const char *color_start = nullptr, const char *color_end = nullptr)
+    {
+        char head[192];
+        int n = 0;
+        const char *start = color_start ? color_start : "";
+        if (line.kind == LogKind::stamp || line.kind == LogKind::structured)
+            n = snprintf(head, sizeof(head), "%s[%s] [%s] %s [%ld]: ", start, time_text(line.time),
+                    log_category(line.level), name, line.tid);
+        else if (line.kind == LogKind::log)
+            n = snprintf(head, sizeof(head), "%s[%s] %s [%ld] ", start, log_category(line.level), name, line.tid);
+        out.append(head, std::min(std::max(n, 0), (int)sizeof(head) - 1));
+
+        if (line.func) {
+            out += line.func;
+            out += ": ";
+        }
+        out.append(line.text, line.length);
+        if (line.func) {
+            n = snprintf(head, sizeof(head), " (%s:%d)", log_basename(line.file), line.line);
+            out.append(head, std::min(std::max(n, 0), (int)sizeof(head) - 1));
+        }
+        if (color_end && line.kind != LogKind::print)
+            out += color_end;
+    }
+
+private:
+    // strftime() once per second of log time.
+    const char *time_text(int64_t time)
+    {
+        time_t sec = (time_t)(time / 1000000);
+        if (sec != time_sec_) {
+            struct tm tm;
+            localtime_r(&sec, &tm);
+            strftime(time_text_, sizeof(time_text_), "%y-%m-%d %H:%M:%S", &tm);
+            time_sec_ = sec;
+        }
+        return time_text_;
+    }
+
+private:
+    time_t time_sec_ = -1;
+    char time_text_[32] = { 0 };
+};
+
+/*
+ * Stream writing, appended to a buffer the caller writes out.
+ */
+class LogStreamWriter
+{
+public:
+    static const uint8_t kVersion = 1;
+
+    void header(std::string &out)
+    {
+        out.append("LOGB", 4);
+        out += (char)kVersion;
+        last_time_ = 0;
+    }
+
+    void name(std::string &out, const char *name)
+    {
+        out += 'N';
+        str(out, name);
+    }
+
+    void site(std::string &out, const LogSite &site)
+    {
+        out += 'S';
+        var(out, site.id);
+        var(out, (uint64_t)site.level);
+        var(out, (uint64_t)site.line);
+        str(out, site.format);
+        str(out, site.file);
+        str(out, site.func);
+    }
+
+    void message(std::string &out, const LogSite &site, int64_t time, long tid, const char *args, size_t size)
+    {
+        out += 'M';
+        var(out, site.id);
+        this->time(out, time);
+        var(out, (uint64_t)tid);
+        str(out, args, size);
+    }
+
+    void text(std::string &out, const LogLine &line)
+    {
+        out += 'T';
+        var(out, (uint64_t)line.kind);
+        var(out, (uint64_t)line.level);
+        time(out, line.time);
+        var(out, (uint64_t)line.tid);
+        var(out, (uint64_t)line.line);
+        str(out, line.func);
+        str(out, line.file);
+        str(out, line.text, line.length);
+    }
+
+private:
+    static void var(std::string &out, uint64_t v)
+    {
+        char buffer[10];
+        out.append(buffer, log_put_var(buffer, v) - buffer);
+    }
+
+    static void str(std::string &out, const char *s, size_t length)
+    {
+        var(out, length);
+        out.append(s, length);
+    }
+
+    static void str(std::string &out, const char *s) { str(out, s ? s : "", s ? strlen(s) : 0); }
+
+    void time(std::string &out, int64_t time)
+    {
+        var(out, log_zigzag(time - last_time_));
+        last_time_ = time;
+    }
+
+private:
+    int64_t last_time_ = 0;
+};
+
+/*
+ * Reads a binary log stream back into lines.
+ */
+class LogDecoder
+{
+public:
+    explicit LogDecoder(FILE *fp) : fp_(fp) { }
+
+    // False when the stream does not start with a header we can read.
+    bool open()
+    {
+        char magic[4];
+        if (fread(magic, 1, 4, fp_) != 4 || memcmp(magic, "LOGB", 4) != 0) {
+            error_ = "not a binary log";
+            return false;
+        }
+        if (fgetc(fp_) != LogStreamWriter::kVersion) {
+            error_ = "unsupported version";
+            return false;
+        }
+        return true;
+    }
+
+    // Appends the next line to out, false at the end of the stream or on
+    // a damaged one (error() tells which).
+    bool next(std::string &out)
+    {
+        for (;;) {
+            int type = fgetc(fp_);
+            if (type == EOF)
+                return false;
+
+            uint64_t kind, level, tid, line_no, id;
+            if (type == 'L') {
+                // A header again: the logger restarted and appended a new stream.
+                char magic[3];
+                if (fread(magic, 1, 3, fp_) != 3 || memcmp(magic, "OGB", 3) != 0
+                        || fgetc(fp_) != LogStreamWriter::kVersion)
+                    return fail();
+                sites_.clear();
+                name_.clear();
+                time_ = 0;
+            } else if (type == 'N') {
+                if (!str(name_))
+                    return fail();
+            } else if (type == 'S') {
+                Site site;
+                if (!var(id) || !var(level) || !var(line_no) || !str(site.format) || !str(site.file)
+                        || !str(site.func) || id > kMaxSites)
+                    return fail();
+                site.level = (int)level;
+                site.line = (int)line_no;
+                if (sites_.size() <= id)
+                    sites_.resize(id + 1);
+                sites_[id] = site;
+            } else if (type == 'M') {
+                if (!var(id) || !time() || !var(tid) || !str(args_) || id >= sites_.size())
+                    return fail();
+
+                const Site &site = sites_[id];
+                text_.clear();
+                log_format(text_, site.format.c_str(), args_.data(), args_.size());
+                LogLine line = { LogKind::structured, site.level, time_, (long)tid, site.func.c_str(),
+                    site.file.c_str(), site.line, text_.data(), text_.size() };
+                layout_.append(out, line, name());
+                return true;
+            } else if (type == 'T') {
+                if (!var(kind) || !var(level) || !time() || !var(tid) || !var(line_no)
+                        || !str(func_) || !str(file_) || !str(text_))
+                    return fail();
+                LogLine line = { (LogKind)kind, (int)level, time_, (long)tid, func_.empty() ? nullptr : func_.c_str(),
+                    file_.c_str(), (int)line_no, text_.data(), text_.size() };
+                layout_.append(out, line, name());
+                return true;
+            } else {
+                return fail();
+            }
+        }
+    }
+
+    const char *error() const { return error_; }
+
+private:
+    static const uint64_t kMaxSites = 1 << 24;
+
+    struct Site
+    {
+        int level = 0;
+        int line = 0;
+        std::string format;
+        std::string file;
+        std::string func;
+    };
+
+    bool var(uint64_t &v)
+    {
+        v = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = fgetc(fp_);
+            if (byte == EOF)
+                return false;
+            v |= (uint64_t)(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    bool str(std::string &s)
+    {
+        uint64_t length;
+        if (!var(length) || length > ((uint64_t)1 << 32))
+            return false;
+        s.resize((size_t)length);
+        return length == 0 || fread(&s[0], 1, (size_t)length, fp_) == length;
+    }
+
+    bool time()
+    {
+        uint64_t delta;
+        if (!var(delta))
+            return false;
+        time_ += log_unzigzag(delta);
+        return true;
+    }
+
+    bool fail()
+    {
+        error_ = "truncated or damaged stream";
+        return false;
+    }
+
+    const char *name() const { return name_.empty() ? "logger" : name_.c_str(); }
+
+private:
+    FILE *fp_;
+    const char *error_ = nullptr;
+    std::vector<Site> sites_;
+    int64_t time_ = 0;
+    std::string name_;
+    std::string args_;
+    std::string text_;
+    std::string func_;
+    std::string file_;
+    LogLayout layout_;
+};
+
+#endif //_LOG_RECORD_HPP_
@@ -0,0 +1,148 @@
+#ifndef _LOG_RING_HPP_
+#define _LOG_RING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE     64
+#endif
+
+/*
+ * Single-producer/single-consumer ring of variable-length records.
+ *
+ * The producer reserves contiguous room, writes the record in place and
+ * commits it, possibly shorter than reserved; the consumer walks every
+ * committed record and releases them all with one store. Records never
+ * wrap: one that does not fit before the end of the buffer is preceded by
+ * a skip marker sending the reader back to the start. Head and tail are
+ * free-running byte counts, each written by one side only.
+ */
+class LogRing
+{
+public:
+    // capacity is rounded up to a power of two.
+    explicit LogRing(size_t capacity) : mask_(round_up(capacity) - 1)
+    {
+        buffer_ = static_cast<char *>(::operator new(mask_ + 1));
+    }
+
+    LogRing(const LogRing &other) = delete;
+    void operator=(const LogRing &other) = delete;
+
+    ~LogRing() { ::operator delete(buffer_); }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Biggest record reserve() may ever hand out.
+    size_t max_record() const { return capacity() / 4 - kHeader; }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Producer side.
+     */
+
+    // Room for size bytes, nullptr while the consumer has not freed enough.
+    char *reserve(size_t size)
+    {
+        if (size > max_record())
+            return nullptr;
+
+        size_t total = align(kHeader + size);
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t offset = head & mask_;
+        size_t skip = offset + total > capacity() ? capacity() - offset : 0;
+
+        if (head + skip + total - cached_tail_ > capacity()) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head + skip + total - cached_tail_ > capacity())
+                return nullptr;
+        }
+
+        if (skip)
+            header(offset)[0] = kSkip;
+        record_ = head + skip;
+        return buffer_ + (record_ & mask_) + kHeader;
+    }
+
+    // Publishes the last reserve(), size being at most what was reserved.
+    void commit(size_t size)
+    {
+        uint32_t *h = header(record_ & mask_);
+        h[0] = (uint32_t)align(kHeader + size);
+        h[1] = (uint32_t)size;
+        head_.store(record_ + h[0], std::memory_order_release);
+    }
+
+    // True once unread records take half the ring, worth waking the consumer.
+    bool filling()
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - cached_tail_ <= capacity() / 2)
+            return false;
+        cached_tail_ = tail_.load(std::memory_order_acquire);
+        return head - cached_tail_ > capacity() / 2;
+    }
+
+    /*
+     * Consumer side.
+     */
+
+    // Calls visit(data, size) on every committed record, oldest first, and
+    // returns the position to release() once they are no longer needed.
+    template <typename Visitor>
+    size_t read(Visitor visit)
+    {
+        size_t head = head_.load(std::memory_order_acquire);
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        while (pos != head) {
+            size_t offset = pos & mask_;
+            uint32_t *h = header(offset);
+            if (h[0] == kSkip) {
+                pos += capacity() - offset;
+                continue;
+            }
+            visit(buffer_ + offset + kHeader, (size_t)h[1]);
+            pos += h[0];
+        }
+        return head;
+    }
+
+    void release(size_t pos) { tail_.store(pos, std::memory_order_release); }
+
+private:
+    static const size_t kHeader = 8;        // Record size, payload size.
+    static const uint32_t kSkip = 0xffffffff;
+
+    static size_t align(size_t size) { return (size + 7) & ~(size_t)7; }
+
+    static size_t round_up(size_t value)
+    {
+        size_t power = 256;
+        while (power < value)
+            power <<= 1;
+        return power;
+    }
+
+    uint32_t *header(size_t offset) { return reinterpret_cast<uint32_t *>(buffer_ + offset); }
+
+private:
+    const size_t mask_;
+    char *buffer_;
+    char pad0_[CACHE_LINE_SIZE];
+    std::atomic<size_t> head_ { 0 };
+    size_t cached_tail_ = 0;    // Producer's last view of tail_.
+    size_t record_ = 0;         // Producer's pending reservation.
+    char pad1_[CACHE_LINE_SIZE];
+    std::atomic<size_t> tail_ { 0 };
+    char pad2_[CACHE_LINE_SIZE];
+};
+
+#endif //_LOG_RING_HPP_
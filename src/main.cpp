@@ -44,7 +44,7 @@ void example()
     // 提交乘法操作，总共30个。
     for (int i = 1; i <= 3; ++i) {
         for (int j = 1; j <= 10; ++j) {
-            pool.submit(multiply, i, j);
+            pool.post(multiply, i, j);
         }
     }
 
@@ -61,6 +61,9 @@ void example()
     int res = future2.get();
     LOGD("Last operation result is equals to %d.", res);
 
+    // 等待所有乘法完成
+    pool.wait_idle();
+
     // 关闭线程池
     pool.shutdown();
 
@@ -89,6 +92,48 @@ void example_1()
     pool.shutdown();
 }
 
+void example_timer()
+{
+    ThreadPool pool(2);
+    pool.initialize();
+
+    // 每秒刷新一次，等待期间不占用工作线程
+    ThreadPool::Timer flush = pool.schedule_every(std::chrono::seconds(1), [] { LOGD("flush"); });
+    // 500毫秒后重试一次
+    pool.schedule_after(std::chrono::milliseconds(500), multiply, 6, 7);
+
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    flush.cancel();
+    pool.wait_idle();
+    pool.shutdown();
+}
+
+#if __cplusplus >= 202002L
+#include "coro.hpp"
+
+// 协程版本：每次co_await都不占用线程
+CoTask<int> multiply_twice(ThreadPool &pool, const int a, const int b)
+{
+    co_await pool.schedule();
+    int res = co_await async_on(pool, multiply_return, a, b);
+    co_return co_await async_on(pool, multiply_return, res, 2);
+}
+
+void example_coroutine()
+{
+    ThreadPool pool(2);
+    pool.initialize();
+
+    std::vector<Async<int>> results;
+    for (int i = 1; i <= 10; ++i)
+        results.push_back(co_spawn(pool, multiply_twice(pool, i, i)));
+    for (size_t i = 0; i < results.size(); ++i)
+        LOGD("coroutine %zu result is %d.", i, results[i].get());
+
+    pool.shutdown();
+}
+#endif
+
 std::mutex g_mutex;
 std::condition_variable g_cv;
 std::string data;
@@ -145,6 +190,8 @@ int main(int argc, char **argv)
     std::cout << "hello, world" << std::endl; 
     LOG_NAME("demo");
     //LOG_SYS(true);
+    //LOG_ASYNC(true);
+    //LOG_FILE("demo.log");
     LOGD("hello, world\n");
     LOGE("hello, world\n");
     LOGW("hello, world\n");
@@ -152,6 +199,10 @@ int main(int argc, char **argv)
     LOGD("hello, world\n");
     int number_of_threads = std::thread::hardware_concurrency();
     std::cout << "max number of threads:" << number_of_threads << std::endl;
+    example_timer();
+#if __cplusplus >= 202002L
+    example_coroutine();
+#endif
     example_1();
     //example_condition_var();
     return EXIT_SUCCESS;
@@ -0,0 +1,205 @@
+#ifndef _MPMC_QUEUE_HPP_
+#define _MPMC_QUEUE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE     64
+#endif
+
+/*
+ * Bounded lock-free multi-producer/multi-consumer queue.
+ *
+ * A ring of cells, each one tagged with a sequence number telling whether
+ * it is ready to be written (sequence == position) or read (sequence ==
+ * position + 1). Producers and consumers claim a position with a single
+ * CAS and never wait on each other unless the ring is full or empty.
+ * All the memory is allocated by the constructor.
+ */
+template <typename T>
+class MPMCQueue {
+private:
+    using const_type_ref = const T &;
+    using type_ref = T &;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T *data() { return reinterpret_cast<T *>(&storage); }
+    };
+
+    // Round every cell up to whole cache lines so neighbours never share one.
+    static constexpr size_t cell_size()
+    {
+        return (sizeof(Cell) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+    }
+
+    static size_t round_up(size_t value)
+    {
+        size_t power = 2;
+        while (power < value)
+            power <<= 1;
+        return power;
+    }
+
+public:
+    explicit MPMCQueue(size_t capacity) : mask_(round_up(capacity) - 1)
+    {
+        buffer_ = static_cast<char *>(::operator new(cell_size() * (mask_ + 1) + CACHE_LINE_SIZE));
+        cells_ = buffer_ + (CACHE_LINE_SIZE - reinterpret_cast<uintptr_t>(buffer_) % CACHE_LINE_SIZE);
+        for (size_t i = 0; i <= mask_; ++i)
+            new (cell(i)) Cell;
+        for (size_t i = 0; i <= mask_; ++i)
+            cell(i)->sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MPMCQueue(const MPMCQueue &other) = delete;
+    void operator=(const MPMCQueue &other) = delete;
+
+    ~MPMCQueue()
+    {
+        size_t tail = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t head = enqueue_pos_.load(std::memory_order_relaxed);
+        for (size_t pos = tail; pos != head; ++pos)
+            cell(pos)->data()->~T();
+        for (size_t i = 0; i <= mask_; ++i)
+            cell(i)->~Cell();
+        ::operator delete(buffer_);
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    // Approximate when other threads are running, exact otherwise.
+    size_t size() const
+    {
+        size_t tail = dequeue_pos_.load(std::memory_order_relaxed);
+        size_t head = enqueue_pos_.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    bool try_enqueue(const_type_ref t) { return emplace(t); }
+    bool try_enqueue(T &&t) { return emplace(std::move(t)); }
+
+    // Same contract as ThreadSafeQueue::enqueue: returns once the item is in,
+    // yielding while the ring is full.
+    void enqueue(const_type_ref t)
+    {
+        while (!emplace(t))
+            std::this_thread::yield();
+    }
+
+    void enqueue(T &&t)
+    {
+        while (!emplace(std::move(t)))
+            std::this_thread::yield();
+    }
+
+    // Claims, with a single CAS, the run of free cells at the head, up to
+    // count of them, and moves items in. Returns how many went in: less than
+    // count when the ring is short of room, a cell whose consumer is still
+    // moving out counting as taken, so that producers never wait on one.
+    size_t try_enqueue_bulk(T *items, size_t count)
+    {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t n;
+        for (;;) {
+            for (n = 0; n < count; ++n) {
+                if (cell(pos + n)->sequence.load(std::memory_order_acquire) != pos + n)
+                    break;
+            }
+            if (n == 0) {
+                size_t seq = cell(pos)->sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos) < 0)
+                    return 0;   // Full.
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            } else if (enqueue_pos_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < n; ++i) {
+            Cell *c = cell(pos + i);
+            new (c->data()) T(std::move(items[i]));
+            c->sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    bool dequeue(type_ref t)
+    {
+        Cell *c;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            c = cell(pos);
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;   // Empty.
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        t = std::move(*c->data());
+        c->data()->~T();
+        c->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    Cell *cell(size_t pos) const
+    {
+        return reinterpret_cast<Cell *>(cells_ + (pos & mask_) * cell_size());
+    }
+
+    template <typename U>
+    bool emplace(U &&u)
+    {
+        Cell *c;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        for (;;) {
+            c = cell(pos);
+            size_t seq = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;   // Full.
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (c->data()) T(std::forward<U>(u));
+        c->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    char pad0_[CACHE_LINE_SIZE];
+    const size_t mask_;
+    char *buffer_;
+    char *cells_;
+    char pad1_[CACHE_LINE_SIZE];
+    std::atomic<size_t> enqueue_pos_ { 0 };
+    char pad2_[CACHE_LINE_SIZE];
+    std::atomic<size_t> dequeue_pos_ { 0 };
+    char pad3_[CACHE_LINE_SIZE];
+};
+
+#endif //_MPMC_QUEUE_HPP_
@@ -0,0 +1,279 @@
+#ifndef _PARALLEL_HPP_
+#define _PARALLEL_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <numeric>
+#include <utility>
+#include <vector>
+#include "task_group.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Data-parallel algorithms on a ThreadPool, or any other BasicExecutor.
+ *
+ *     parallel_for(pool, 0, n, [&](size_t i) { y[i] = a * x[i] + y[i]; });
+ *     double sum = parallel_reduce(pool, v.begin(), v.end(), 0.0, std::plus<double>());
+ *     parallel_sort(pool, v.begin(), v.end());
+ *
+ * A range is halved recursively, the right half queued as a task and the
+ * left one split further by the same thread, down to leaves of a grain
+ * size: about kParallelSplits leaves per thread, so a slow leaf or a busy
+ * worker is made up for by the others, never below min_grain elements so
+ * that a leaf is worth a task. The calling thread runs the leftmost leaf
+ * and waits through a TaskGroup: from one of the pool's workers it helps
+ * with the other leaves, so the algorithms nest.
+ *
+ * Iterators are random access. Without running workers everything runs
+ * serially on the caller. The first exception thrown by an element
+ * operation is rethrown once every leaf has finished.
+ */
+
+static const size_t kParallelSplits = 8;      // Leaves per thread.
+static const size_t kParallelGrain = 4096;    // Default min_grain of the element-wise algorithms.
+
+// Leaf size for n elements: kParallelSplits leaves per thread, the caller
+// included, at least min_grain. n when the pool has no worker to help.
+template <typename Executor>
+size_t parallel_grain(Executor &pool, size_t n, size_t min_grain)
+{
+    size_t threads = pool.size();
+    if (threads == 0)
+        return std::max(n, (size_t)1);
+    return std::max(std::max(min_grain, (size_t)1), n / ((threads + 1) * kParallelSplits));
+}
+
+// Runs f and g in parallel, f on the calling thread; returns once both did.
+template <typename Executor, typename F, typename G>
+void parallel_invoke(Executor &pool, F &&f, G &&g)
+{
+    BasicTaskGroup<Executor> group(pool);
+    group.run(std::forward<G>(g));
+    f();
+    group.wait();
+}
+
+namespace parallel_detail {
+
+template <typename Group, typename Body>
+void split(Group &group, size_t first, size_t last, size_t grain, const Body &body)
+{
+    while (last - first > grain) {
+        size_t mid = first + (last - first) / 2;
+        group.run([&group, &body, mid, last, grain] { split(group, mid, last, grain, body); });
+        last = mid;
+    }
+    body(first, last);
+}
+
+// Per-worker partial result, far enough from its neighbours that workers
+// folding into their own never write to a shared cache line.
+template <typename T>
+struct Partial
+{
+    T value;
+    bool set = false;
+    char pad[64];
+};
+
+template <typename Executor, typename InputIt, typename OutputIt, typename Compare>
+void merge(Executor &pool, InputIt x, size_t nx, InputIt y, size_t ny, OutputIt out, Compare comp, size_t grain)
+{
+    // Two elements at least, so that both halves below are smaller.
+    if (nx + ny <= std::max(grain, (size_t)2)) {
+        std::merge(std::make_move_iterator(x), std::make_move_iterator(x + nx),
+                std::make_move_iterator(y), std::make_move_iterator(y + ny), out, comp);
+        return;
+    }
+
+    // Split the longer run in the middle and the other where that middle
+    // element would go; both halves merge independently.
+    size_t mx, my;
+    if (nx >= ny) {
+        mx = nx / 2;
+        my = std::lower_bound(y, y + ny, x[mx], comp) - y;
+    } else {
+        my = ny / 2;
+        mx = std::upper_bound(x, x + nx, y[my], comp) - x;
+    }
+    parallel_invoke(pool,
+            [&] { merge(pool, x, mx, y, my, out, comp, grain); },
+            [&] { merge(pool, x + mx, nx - mx, y + my, ny - my, out + mx + my, comp, grain); });
+}
+
+// Sorts a[0, n), the result ending up in b when into_b, in a otherwise;
+// the other one is scratch space. Levels alternate so nothing is copied
+// back after a merge.
+template <typename Executor, typename RandomIt, typename Buffer, typename Compare>
+void sort(Executor &pool, RandomIt a, Buffer b, size_t n, bool into_b, Compare comp, size_t grain)
+{
+    if (n <= grain) {
+        std::sort(a, a + n, comp);
+        if (into_b)
+            std::move(a, a + n, b);
+        return;
+    }
+
+    size_t half = n / 2;
+    parallel_invoke(pool,
+            [&] { sort(pool, a, b, half, !into_b, comp, grain); },
+            [&] { sort(pool, a + half, b + half, n - half, !into_b, comp, grain); });
+    if (into_b)
+        merge(pool, a, half, a + half, n - half, b, comp, grain);
+    else
+        merge(pool, b, half, b + half, n - half, a, comp, grain);
+}
+
+} // namespace parallel_detail
+
+// body(begin, end) over disjoint blocks covering [first, last).
+template <typename Executor, typename Body>
+void parallel_for_range(Executor &pool, size_t first, size_t last, Body body, size_t min_grain = 1)
+{
+    if (first >= last)
+        return;
+    BasicTaskGroup<Executor> group(pool);
+    parallel_detail::split(group, first, last, parallel_grain(pool, last - first, min_grain), body);
+    group.wait();
+}
+
+// f(i) for every i of [first, last). min_grain: the fewest calls worth a
+// task, 1 by default since f may be expensive.
+template <typename Executor, typename Function>
+void parallel_for(Executor &pool, size_t first, size_t last, Function f, size_t min_grain = 1)
+{
+    parallel_for_range(pool, first, last, [&f](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            f(i);
+    }, min_grain);
+}
+
+/*
+ * std::reduce: init folded with every element by op, in no particular
+ * order, so op must be associative and commutative. Every worker folds the
+ * leaves it runs into its own partial, the caller folds the partials.
+ * T must be default constructible.
+ */
+template <typename Executor, typename RandomIt, typename T, typename BinaryOp>
+T parallel_reduce(Executor &pool, RandomIt first, RandomIt last, T init, BinaryOp op,
+        size_t min_grain = kParallelGrain)
+{
+    std::vector<parallel_detail::Partial<T>> partials(pool.max_size() + 1);
+    parallel_for_range(pool, 0, last - first, [&](size_t begin, size_t end) {
+        T sum = first[begin];
+        for (size_t i = begin + 1; i < end; ++i)
+            sum = op(sum, first[i]);
+
+        int worker = pool.worker_index();
+        parallel_detail::Partial<T> &partial = partials[worker < 0 ? partials.size() - 1 : (size_t)worker];
+        partial.value = partial.set ? op(partial.value, sum) : sum;
+        partial.set = true;
+    }, min_grain);
+
+    for (size_t i = 0; i < partials.size(); ++i) {
+        if (partials[i].set)
+            init = op(init, partials[i].value);
+    }
+    return init;
+}
+
+template <typename Executor, typename RandomIt, typename T>
+T parallel_reduce(Executor &pool, RandomIt first, RandomIt last, T init)
+{
+    return parallel_reduce(pool, first, last, init, std::plus<T>());
+}
+
+// std::transform, out may be first. Returns the end of the output.
+template <typename Executor, typename InputIt, typename OutputIt, typename UnaryOp>
+OutputIt parallel_transform(Executor &pool, InputIt first, InputIt last, OutputIt out, UnaryOp op,
+        size_t min_grain = kParallelGrain)
+{
+    parallel_for_range(pool, 0, last - first, [&](size_t begin, size_t end) {
+        std::transform(first + begin, first + end, out + begin, op);
+    }, min_grain);
+    return out + (last - first);
+}
+
+/*
+ * std::inclusive_scan, out may be first. Two passes over blocks of the
+ * grain size: the sum of every block, then every block scanned again
+ * starting from the sum of the blocks before it. op must be associative.
+ * Returns the end of the output.
+ */
+template <typename Executor, typename InputIt, typename OutputIt, typename BinaryOp>
+OutputIt parallel_scan(Executor &pool, InputIt first, InputIt last, OutputIt out, BinaryOp op,
+        size_t min_grain = kParallelGrain)
+{
+    using T = typename std::iterator_traits<InputIt>::value_type;
+
+    size_t n = last - first;
+    if (n == 0)
+        return out;
+    size_t grain = parallel_grain(pool, n, min_grain);
+    size_t blocks = (n + grain - 1) / grain;
+    if (blocks == 1)
+        return std::partial_sum(first, last, out, op);
+
+    // The last block's sum is never needed.
+    std::vector<T> sums(blocks - 1);
+    parallel_for(pool, 0, blocks - 1, [&](size_t b) {
+        InputIt it = first + b * grain;
+        T sum = *it;
+        for (InputIt end = first + (b + 1) * grain; ++it != end; )
+            sum = op(sum, *it);
+        sums[b] = sum;
+    });
+    for (size_t b = 1; b < sums.size(); ++b)
+        sums[b] = op(sums[b - 1], sums[b]);
+
+    parallel_for(pool, 0, blocks, [&](size_t b) {
+        size_t begin = b * grain;
+        size_t end = std::min(begin + grain, n);
+        if (b == 0) {
+            std::partial_sum(first, first + end, out, op);
+            return;
+        }
+        T sum = sums[b - 1];
+        for (size_t i = begin; i < end; ++i) {
+            sum = op(sum, first[i]);
+            out[i] = sum;
+        }
+    });
+    return out + n;
+}
+
+template <typename Executor, typename InputIt, typename OutputIt>
+OutputIt parallel_scan(Executor &pool, InputIt first, InputIt last, OutputIt out)
+{
+    return parallel_scan(pool, first, last, out, std::plus<typename std::iterator_traits<InputIt>::value_type>());
+}
+
+/*
+ * Merge sort: leaves sorted with std::sort, then merged pairwise, both
+ * halves of a merge in parallel too. Not stable. Needs a scratch buffer of
+ * the input's size, so elements must be default constructible and movable.
+ */
+template <typename Executor, typename RandomIt, typename Compare>
+void parallel_sort(Executor &pool, RandomIt first, RandomIt last, Compare comp, size_t min_grain = kParallelGrain)
+{
+    using T = typename std::iterator_traits<RandomIt>::value_type;
+
+    size_t n = last - first;
+    size_t grain = parallel_grain(pool, n, min_grain);
+    if (n <= grain) {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<T> buffer(n);
+    parallel_detail::sort(pool, first, buffer.begin(), n, false, comp, grain);
+}
+
+template <typename Executor, typename RandomIt>
+void parallel_sort(Executor &pool, RandomIt first, RandomIt last)
+{
+    parallel_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>());
+}
+
+#endif //_PARALLEL_HPP_
@@ -0,0 +1,312 @@
+#ifndef _POOL_METRICS_HPP_
+#define _POOL_METRICS_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "task.hpp"
+
+#if defined(THREAD_POOL_METRICS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
+
+/*
+ * What a pool has been doing, as returned by stats(). Times are in
+ * nanoseconds. Everything but the thread counts and pending stays zero
+ * unless the pool was built with -DTHREAD_POOL_METRICS.
+ *
+ * Histogram bucket i counts samples up to bucket_ns[i], bucket 0 holding
+ * the ones too short to measure.
+ */
+struct PoolStats
+{
+    static const size_t kBuckets = 40;
+
+    struct Worker
+    {
+        uint64_t tasks = 0;
+        uint64_t exec_ns = 0;       // Running tasks.
+        uint64_t idle_ns = 0;       // Spinning or parked with nothing to do.
+        uint64_t lock_ns = 0;       // Inside queue operations: locks, CAS retries, stealing.
+    };
+
+    bool instrumented = false;
+    size_t threads = 0;
+    size_t idle_threads = 0;
+    size_t pending = 0;
+    size_t queue_high_water = 0;   // Sampled, so at most the real peak.
+
+    Worker total;
+    std::vector<Worker> workers;    // Per worker slot.
+
+    double bucket_ns[kBuckets] = { };
+    uint64_t queue_delay[kBuckets] = { };   // Queued until started.
+    uint64_t exec_time[kBuckets] = { };
+
+    // Upper bound of the bucket holding the p-th (0..1) sample of histogram.
+    double percentile(const uint64_t (&histogram)[kBuckets], double p) const
+    {
+        uint64_t count = 0;
+        for (size_t i = 0; i < kBuckets; ++i)
+            count += histogram[i];
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; ++i) {
+            seen += histogram[i];
+            if (count && seen >= p * count)
+                return bucket_ns[i];
+        }
+        return 0;
+    }
+};
+
+#ifdef THREAD_POOL_METRICS
+
+// Cheapest clock we have: the TSC on x86 (a few ns), nanoseconds elsewhere.
+inline uint64_t metrics_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/*
+ * Counters of one worker slot. Only the worker owning the slot writes them,
+ * with plain load/store pairs instead of read-modify-writes, so recording
+ * costs no more than a few cache hits on a line nobody else writes.
+ * Readers get a slightly stale but consistent-enough view.
+ */
+class WorkerMetrics
+{
+public:
+    static const size_t kBuckets = PoolStats::kBuckets;
+
+    // Tasks this worker queued and took out of the queue, queue depth being
+    // what all slots queued less what they took.
+    void queued(uint64_t n) { add(queued_, n); }
+    uint64_t dequeued() { add(dequeued_, 1); return dequeued_.load(std::memory_order_relaxed); }
+    uint64_t queued_count() const { return queued_.load(std::memory_order_relaxed); }
+    uint64_t dequeued_count() const { return dequeued_.load(std::memory_order_relaxed); }
+
+    void sample_depth(uint64_t depth)
+    {
+        if (depth > high_water_.load(std::memory_order_relaxed))
+            high_water_.store(depth, std::memory_order_relaxed);
+    }
+
+    uint64_t high_water() const { return high_water_.load(std::memory_order_relaxed); }
+
+    void task(uint64_t delay, uint64_t exec)
+    {
+        add(tasks_, 1);
+        add(exec_, exec);
+        add(queue_delay_[bucket(delay)], 1);
+        add(exec_time_[bucket(exec)], 1);
+    }
+
+    void idle(uint64_t ticks) { add(idle_, ticks); }
+    void lock(uint64_t ticks) { add(lock_, ticks); }
+
+    void read(PoolStats::Worker &worker, double ns_per_tick, PoolStats &stats) const
+    {
+        worker.tasks = tasks_.load(std::memory_order_relaxed);
+        worker.exec_ns = (uint64_t)(exec_.load(std::memory_order_relaxed) * ns_per_tick);
+        worker.idle_ns = (uint64_t)(idle_.load(std::memory_order_relaxed) * ns_per_tick);
+        worker.lock_ns = (uint64_t)(lock_.load(std::memory_order_relaxed) * ns_per_tick);
+        for (size_t i = 0; i < kBuckets; ++i) {
+            stats.queue_delay[i] += queue_delay_[i].load(std::memory_order_relaxed);
+            stats.exec_time[i] += exec_time_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static void add(std::atomic<uint64_t> &counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // log2 buckets: bucket i holds [2^(i-1), 2^i) ticks.
+    static size_t bucket(uint64_t ticks)
+    {
+        return ticks ? std::min((size_t)(64 - __builtin_clzll(ticks)), kBuckets - 1) : 0;
+    }
+
+private:
+    char padding0_[64];     // Keep the neighbour slot off our cache lines.
+    std::atomic<uint64_t> tasks_ { 0 };
+    std::atomic<uint64_t> exec_ { 0 };
+    std::atomic<uint64_t> idle_ { 0 };
+    std::atomic<uint64_t> lock_ { 0 };
+    std::atomic<uint64_t> queued_ { 0 };
+    std::atomic<uint64_t> dequeued_ { 0 };
+    std::atomic<uint64_t> high_water_ { 0 };
+    std::atomic<uint64_t> queue_delay_[kBuckets] = { };
+    std::atomic<uint64_t> exec_time_[kBuckets] = { };
+    char padding1_[64];
+};
+
+/*
+ * Per-pool side: one WorkerMetrics per worker slot, and striped queued
+ * counters for threads that are not workers. Nothing on the task path is
+ * shared by all threads: queue depth is summed from the slots, and its
+ * high water sampled by every worker each kSampleEvery tasks and by read().
+ */
+class PoolMetrics
+{
+public:
+    static const size_t kSubmitterStripes = 16;
+    static const uint64_t kSampleEvery = 64;
+
+    explicit PoolMetrics(size_t slots)
+        : start_ticks_(metrics_ticks()), start_(std::chrono::steady_clock::now())
+    {
+        for (size_t i = 0; i < slots; ++i)
+            slots_.emplace_back(new WorkerMetrics);
+    }
+
+    static uint64_t ticks() { return metrics_ticks(); }
+
+    WorkerMetrics &slot(size_t id) { return *slots_[id]; }
+
+    // worker: the slot of the queueing thread, -1 if it is not a worker.
+    template <typename T>
+    void queued(T &task, int worker)
+    {
+        task.queued_at = metrics_ticks();
+        count_queued(1, worker);
+    }
+
+    template <typename T>
+    void queued_bulk(std::vector<T> &tasks, int worker)
+    {
+        uint64_t now = metrics_ticks();
+        for (size_t i = 0; i < tasks.size(); ++i)
+            tasks[i].queued_at = now;
+        count_queued(tasks.size(), worker);
+    }
+
+    // Worker took task out of the queue at ticks now.
+    template <typename T>
+    uint64_t dequeued(const T &task, uint64_t now, size_t worker)
+    {
+        WorkerMetrics &slot = *slots_[worker];
+        if (slot.dequeued() % kSampleEvery == 1)
+            slot.sample_depth(depth());
+        return now > task.queued_at ? now - task.queued_at : 0;
+    }
+
+    void read(PoolStats &stats) const
+    {
+        uint64_t high = depth();
+        for (size_t i = 0; i < slots_.size(); ++i)
+            high = std::max(high, slots_[i]->high_water());
+        uint64_t seen = high_water_.load(std::memory_order_relaxed);
+        while (high > seen && !high_water_.compare_exchange_weak(seen, high, std::memory_order_relaxed))
+            ;
+
+        stats.instrumented = true;
+        stats.queue_high_water = (size_t)std::max(high, seen);
+
+        double ns_per_tick = this->ns_per_tick();
+        for (size_t i = 0; i < PoolStats::kBuckets; ++i)
+            stats.bucket_ns[i] = i ? ((uint64_t)1 << i) * ns_per_tick : 0;
+
+        stats.workers.resize(slots_.size());
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            PoolStats::Worker &worker = stats.workers[i];
+            slots_[i]->read(worker, ns_per_tick, stats);
+            stats.total.tasks += worker.tasks;
+            stats.total.exec_ns += worker.exec_ns;
+            stats.total.idle_ns += worker.idle_ns;
+            stats.total.lock_ns += worker.lock_ns;
+        }
+    }
+
+private:
+    // Lines of their own, submitters only contend with the few others
+    // hashed to the same stripe.
+    struct Stripe
+    {
+        char padding0_[64];
+        std::atomic<uint64_t> queued { 0 };
+        char padding1_[64];
+    };
+
+    void count_queued(uint64_t n, int worker)
+    {
+        if (worker >= 0) {
+            slots_[worker]->queued(n);
+        } else {
+            static std::atomic<size_t> next { 0 };
+            static thread_local size_t stripe = next.fetch_add(1, std::memory_order_relaxed) % kSubmitterStripes;
+            stripes_[stripe].queued.fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+
+    // Taken counts first: read after them, queued ones only run ahead.
+    uint64_t depth() const
+    {
+        uint64_t taken = 0, queued = 0;
+        for (size_t i = 0; i < slots_.size(); ++i)
+            taken += slots_[i]->dequeued_count();
+        for (size_t i = 0; i < slots_.size(); ++i)
+            queued += slots_[i]->queued_count();
+        for (size_t i = 0; i < kSubmitterStripes; ++i)
+            queued += stripes_[i].queued.load(std::memory_order_relaxed);
+        return queued > taken ? queued - taken : 0;
+    }
+
+    // Calibrated against steady_clock over the life of the pool.
+    double ns_per_tick() const
+    {
+        uint64_t ticks = metrics_ticks() - start_ticks_;
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_).count();
+        return ticks && ns > 0 ? (double)ns / ticks : 1.0;
+    }
+
+private:
+    std::vector<std::unique_ptr<WorkerMetrics>> slots_;
+    uint64_t start_ticks_;
+    std::chrono::steady_clock::time_point start_;
+    Stripe stripes_[kSubmitterStripes];
+    mutable std::atomic<uint64_t> high_water_ { 0 };     // Highest read() has seen.
+};
+
+#else
+
+// Same interface, compiled away.
+class WorkerMetrics
+{
+public:
+    void task(uint64_t, uint64_t) { }
+    void idle(uint64_t) { }
+    void lock(uint64_t) { }
+};
+
+class PoolMetrics
+{
+public:
+    explicit PoolMetrics(size_t) { }
+
+    static uint64_t ticks() { return 0; }
+
+    WorkerMetrics &slot(size_t) { return slot_; }
+    template <typename T> void queued(T &, int) { }
+    template <typename T> void queued_bulk(std::vector<T> &, int) { }
+    template <typename T> uint64_t dequeued(const T &, uint64_t, size_t) { return 0; }
+    void read(PoolStats &) const { }
+
+private:
+    WorkerMetrics slot_;
+};
+
+#endif
+
+#endif //_POOL_METRICS_HPP_
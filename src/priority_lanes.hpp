@@ -0,0 +1,129 @@
+#ifndef _PRIORITY_LANES_HPP_
+#define _PRIORITY_LANES_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+enum class TaskPriority
+{
+    high,
+    normal,
+    low
+};
+
+/*
+ * One queue per priority class.
+ *
+ * Inside a lane items come out earliest deadline first, items without a
+ * deadline (time_point::max()) in FIFO order after them. Higher lanes win,
+ * but a non-empty lane that has been passed over starvation_limit times in
+ * a row is served next, so background work keeps moving while urgent work
+ * keeps arriving.
+ */
+template <typename T>
+class PriorityLanes {
+public:
+    using clock = std::chrono::steady_clock;
+    static const size_t kLanes = 3;
+
+    explicit PriorityLanes(size_t starvation_limit = 16) : starvation_limit_(starvation_limit) { }
+    PriorityLanes(const PriorityLanes &other) = delete;
+    void operator=(const PriorityLanes &other) = delete;
+
+    // Lock free, exact only when nobody else is using the lanes.
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    bool empty() const { return size() == 0; }
+
+    void push(T &&t, TaskPriority priority = TaskPriority::normal,
+            clock::time_point deadline = clock::time_point::max())
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        insert(std::move(t), priority, deadline);
+    }
+
+    template <typename Iterator>
+    void push_bulk(Iterator first, Iterator last, TaskPriority priority = TaskPriority::normal,
+            clock::time_point deadline = clock::time_point::max())
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (; first != last; ++first)
+            insert(std::move(*first), priority, deadline);
+    }
+
+    bool pop(T &t)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        size_t picked = kLanes;
+        for (size_t i = 0; i < kLanes; ++i) {
+            if (lanes_[i].heap.empty())
+                continue;
+            if (picked == kLanes)
+                picked = i;
+            else if (lanes_[i].skipped >= starvation_limit_ && lanes_[picked].skipped < starvation_limit_)
+                picked = i;
+        }
+        if (picked == kLanes)
+            return false;
+
+        for (size_t i = 0; i < kLanes; ++i) {
+            if (i != picked && !lanes_[i].heap.empty())
+                ++lanes_[i].skipped;
+        }
+
+        Lane &lane = lanes_[picked];
+        lane.skipped = 0;
+        std::pop_heap(lane.heap.begin(), lane.heap.end(), Later());
+        t = std::move(lane.heap.back().item);
+        lane.heap.pop_back();
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        clock::time_point deadline;
+        uint64_t sequence;
+        T item;
+    };
+
+    // Heap order: the root is the earliest deadline, then the oldest entry.
+    struct Later
+    {
+        bool operator()(const Entry &a, const Entry &b) const
+        {
+            if (a.deadline != b.deadline)
+                return a.deadline > b.deadline;
+            return a.sequence > b.sequence;
+        }
+    };
+
+    struct Lane
+    {
+        std::vector<Entry> heap;
+        size_t skipped = 0;
+    };
+
+    void insert(T &&t, TaskPriority priority, clock::time_point deadline)
+    {
+        Lane &lane = lanes_[static_cast<size_t>(priority)];
+        lane.heap.push_back(Entry { deadline, sequence_++, std::move(t) });
+        std::push_heap(lane.heap.begin(), lane.heap.end(), Later());
+        size_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::mutex mutex_;
+    Lane lanes_[kLanes];
+    uint64_t sequence_ = 0;
+    const size_t starvation_limit_;
+    std::atomic<size_t> size_ { 0 };
+};
+
+#endif //_PRIORITY_LANES_HPP_
@@ -0,0 +1,225 @@
+#ifndef _TASK_HPP_
+#define _TASK_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "block_pool.hpp"
+
+/*
+ * Move-only void() callable with inline storage.
+ *
+ * Callables up to kInlineSize bytes (a small lambda, or a bound function
+ * together with its promise) live inside the task itself, so building,
+ * queueing and running a task does not touch the heap. Bigger ones fall
+ * back to a single heap allocation, and so do the rare ones aligned
+ * beyond a pointer. Task, 64 bytes in all (72 with THREAD_POOL_METRICS,
+ * for the queueing timestamp), is the one the pools use unless told
+ * otherwise (see InlineTasks).
+ */
+template <size_t InlineSize>
+class BasicTask
+{
+public:
+    static const size_t kInlineSize = InlineSize;
+
+    BasicTask() { }
+
+    template <typename F, typename = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, BasicTask>::value>::type>
+    BasicTask(F &&f)
+    {
+        using Fn = typename std::decay<F>::type;
+        store<Fn>(std::forward<F>(f), std::integral_constant<bool, fits_inline<Fn>()>());
+    }
+
+    BasicTask(BasicTask &&other) noexcept : ops_(other.ops_)
+    {
+#ifdef THREAD_POOL_METRICS
+        queued_at = other.queued_at;
+#endif
+        if (ops_) {
+            ops_->move(&other.storage_, &storage_);
+            other.ops_ = nullptr;
+        }
+    }
+
+    BasicTask &operator=(BasicTask &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+#ifdef THREAD_POOL_METRICS
+            queued_at = other.queued_at;
+#endif
+            ops_ = other.ops_;
+            if (ops_) {
+                ops_->move(&other.storage_, &storage_);
+                other.ops_ = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    BasicTask(const BasicTask &other) = delete;
+    BasicTask &operator=(const BasicTask &other) = delete;
+
+    ~BasicTask() { reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() { ops_->invoke(&storage_); }
+
+    void reset()
+    {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+#ifdef THREAD_POOL_METRICS
+    uint64_t queued_at = 0;     // Set by PoolMetrics when the task is queued.
+#endif
+
+private:
+    // Pointer aligned: max_align_t would round the storage, and the task,
+    // up to 16 bytes.
+    using Storage = typename std::aligned_storage<kInlineSize, alignof(void *)>::type;
+
+    struct Ops
+    {
+        void (*invoke)(Storage *);
+        void (*move)(Storage *, Storage *);     // Move constructs dst from src, destroys src.
+        void (*destroy)(Storage *);
+    };
+
+    template <typename Fn>
+    static constexpr bool fits_inline()
+    {
+        return sizeof(Fn) <= kInlineSize && alignof(void *) % alignof(Fn) == 0
+            && std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template <typename Fn>
+    struct Inline
+    {
+        static Fn *get(Storage *s) { return reinterpret_cast<Fn *>(s); }
+        static void invoke(Storage *s) { (*get(s))(); }
+        static void move(Storage *src, Storage *dst) { new (dst) Fn(std::move(*get(src))); get(src)->~Fn(); }
+        static void destroy(Storage *s) { get(s)->~Fn(); }
+    };
+
+    template <typename Fn>
+    struct Remote
+    {
+        static Fn *&get(Storage *s) { return *reinterpret_cast<Fn **>(s); }
+        static void invoke(Storage *s) { (*get(s))(); }
+        static void move(Storage *src, Storage *dst) { new (dst) Fn *(get(src)); }
+        static void destroy(Storage *s) { delete get(s); }
+    };
+
+    template <typename Fn, typename F>
+    void store(F &&f, std::true_type)
+    {
+        static const Ops ops = { &Inline<Fn>::invoke, &Inline<Fn>::move, &Inline<Fn>::destroy };
+        new (&storage_) Fn(std::forward<F>(f));
+        ops_ = &ops;
+    }
+
+    template <typename Fn, typename F>
+    void store(F &&f, std::false_type)
+    {
+        static const Ops ops = { &Remote<Fn>::invoke, &Remote<Fn>::move, &Remote<Fn>::destroy };
+        new (&storage_) Fn *(new Fn(std::forward<F>(f)));
+        ops_ = &ops;
+    }
+
+private:
+    const Ops *ops_ = nullptr;
+    Storage storage_;
+};
+
+template <size_t InlineSize> const size_t BasicTask<InlineSize>::kInlineSize;
+
+using Task = BasicTask<56>;
+
+#ifndef THREAD_POOL_METRICS
+static_assert(sizeof(Task) == Task::kInlineSize + sizeof(void *), "Task is its storage and one pointer");
+#endif
+
+/*
+ * Runs a callable once and publishes its result, or its exception,
+ * through a promise.
+ */
+template <typename R, typename F>
+class PromiseInvoker
+{
+public:
+    PromiseInvoker(F &&func, std::promise<R> &&promise) : func_(std::move(func)), promise_(std::move(promise)) { }
+
+    void operator()()
+    {
+        try {
+            promise_.set_value(func_());
+        } catch (...) {
+            promise_.set_exception(std::current_exception());
+        }
+    }
+
+    // Completes the future with error instead of running.
+    void fail(std::exception_ptr error) { promise_.set_exception(error); }
+
+private:
+    F func_;
+    std::promise<R> promise_;
+};
+
+template <typename F>
+class PromiseInvoker<void, F>
+{
+public:
+    PromiseInvoker(F &&func, std::promise<void> &&promise) : func_(std::move(func)), promise_(std::move(promise)) { }
+
+    void operator()()
+    {
+        try {
+            func_();
+            promise_.set_value();
+        } catch (...) {
+            promise_.set_exception(std::current_exception());
+        }
+    }
+
+    // Completes the future with error instead of running.
+    void fail(std::exception_ptr error) { promise_.set_exception(error); }
+
+private:
+    F func_;
+    std::promise<void> promise_;
+};
+
+/*
+ * Packages f(args...) into a task plus the future of its result, the
+ * shared state coming from BlockPool instead of the heap.
+ */
+template <typename TaskType, typename Function, typename...Args>
+auto package_task(TaskType &task, Function &&f, Args&&... args)
+    -> std::future<decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...)())>
+{
+    using bound_type = decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+    using return_type = decltype(std::declval<bound_type &>()());
+
+    std::promise<return_type> promise(std::allocator_arg, PoolAllocator<char>());
+    std::future<return_type> future = promise.get_future();
+    task = TaskType(PromiseInvoker<return_type, bound_type>(
+                std::bind(std::forward<Function>(f), std::forward<Args>(args)...), std::move(promise)));
+    return future;
+}
+
+#endif //_TASK_HPP_
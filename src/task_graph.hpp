@@ -0,0 +1,236 @@
+#ifndef _TASK_GRAPH_HPP_
+#define _TASK_GRAPH_HPP_
+
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "continuation.hpp"
+#include "task.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Dependency graph of tasks, built once and run as often as needed.
+ *
+ *     TaskGraph graph;
+ *     TaskGraph::Node load = graph.emplace(read_input);
+ *     TaskGraph::Node left = graph.emplace(sort_left);
+ *     TaskGraph::Node right = graph.emplace(sort_right);
+ *     TaskGraph::Node merge = graph.emplace(merge_halves);
+ *     graph.precede(load, left);
+ *     graph.precede(load, right);
+ *     graph.precede(left, merge);
+ *     graph.precede(right, merge);
+ *     graph.run(pool).wait();
+ *
+ * Every node counts its unfinished predecessors. The worker that finishes
+ * the last one runs the first successor it released right away, without
+ * going through a queue, and queues the others from its own thread: with
+ * Schedule::work_stealing they stay on its deque until somebody steals them.
+ *
+ * After a node throws, the nodes that have not started yet are skipped and
+ * the run completes with that exception. A node dropped unrun by shutdown()
+ * fails the run the same way, with TaskCancelled. The graph must outlive
+ * the run and must not be changed or run again before the run completes.
+ */
+class TaskGraph
+{
+public:
+    using Node = size_t;
+
+    TaskGraph() { }
+    TaskGraph(const TaskGraph &other) = delete;
+    void operator=(const TaskGraph &other) = delete;
+
+    template <typename Function>
+    Node emplace(Function &&f)
+    {
+        vertices_.emplace_back(new Vertex(Task(std::forward<Function>(f))));
+        return vertices_.size() - 1;
+    }
+
+    // after starts only once before has finished.
+    void precede(Node before, Node after)
+    {
+        vertices_.at(before)->successors.push_back(after);
+        ++vertices_.at(after)->dependencies;
+    }
+
+    size_t size() const { return vertices_.size(); }
+    bool empty() const { return vertices_.empty(); }
+
+    // Queues the nodes without predecessors on pool, any BasicExecutor.
+    // The result is ready once every node has run, and fails with
+    // std::logic_error right away on a cycle.
+    template <typename Executor>
+    Async<void, Executor> run(Executor &pool)
+    {
+        std::shared_ptr<AsyncState<void, Executor>> done = std::make_shared<AsyncState<void, Executor>>(&pool);
+        if (has_cycle()) {
+            done->set_exception(std::make_exception_ptr(std::logic_error("TaskGraph: cycle")));
+            return Async<void, Executor>(done);
+        }
+        if (vertices_.empty()) {
+            done->set_value();
+            return Async<void, Executor>(done);
+        }
+
+        done_ = done;
+        error_ = nullptr;
+        failed_ = false;
+        remaining_ = vertices_.size();
+        for (size_t i = 0; i < vertices_.size(); ++i)
+            vertices_[i]->pending = vertices_[i]->dependencies;
+
+        std::vector<Runner<Executor>> roots;
+        for (size_t i = 0; i < vertices_.size(); ++i) {
+            if (vertices_[i]->dependencies == 0)
+                roots.push_back(Runner<Executor>(this, &pool, i));
+        }
+        pool.submit_bulk(std::make_move_iterator(roots.begin()), std::make_move_iterator(roots.end()));
+        return Async<void, Executor>(done);
+    }
+
+private:
+    struct Vertex
+    {
+        explicit Vertex(Task &&t) : work(std::move(t)) { }
+
+        Task work;
+        std::vector<Node> successors;
+        size_t dependencies = 0;
+        std::atomic<size_t> pending { 0 };
+    };
+
+    // Dropped unrun, it fails the run and finishes its node unrun, releasing
+    // the successors so that the run still completes.
+    template <typename Executor>
+    class Runner
+    {
+    public:
+        Runner(TaskGraph *graph, Executor *pool, Node node) : graph_(graph), pool_(pool), node_(node) { }
+
+        Runner(Runner &&other) noexcept : graph_(other.graph_), pool_(other.pool_), node_(other.node_)
+        {
+            other.graph_ = nullptr;
+        }
+
+        ~Runner()
+        {
+            if (graph_) {
+                graph_->fail(std::make_exception_ptr(TaskCancelled()));
+                graph_->execute(pool_, node_);
+            }
+        }
+
+        void operator()()
+        {
+            TaskGraph *graph = graph_;
+            graph_ = nullptr;
+            graph->execute(pool_, node_);
+        }
+
+    private:
+        TaskGraph *graph_;
+        Executor *pool_;
+        Node node_;
+    };
+
+    void fail(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+            error_ = error;
+        failed_ = true;
+    }
+
+    template <typename Executor>
+    void execute(Executor *pool, Node node)
+    {
+        while (true) {
+            Vertex &vertex = *vertices_[node];
+            if (!failed_.load(std::memory_order_relaxed)) {
+                try {
+                    vertex.work();
+                } catch (...) {
+                    fail(std::current_exception());
+                }
+            }
+
+            Node next = kNone;
+            for (size_t i = 0; i < vertex.successors.size(); ++i) {
+                Node successor = vertex.successors[i];
+                if (vertices_[successor]->pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+                    continue;
+                if (next == kNone)
+                    next = successor;
+                else
+                    pool->enqueue(Runner<Executor>(this, pool, successor));
+            }
+
+            if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                finish<Executor>();
+                return;
+            }
+            if (next == kNone)
+                return;
+            node = next;
+        }
+    }
+
+    // The graph may be destroyed as soon as done is set.
+    template <typename Executor>
+    void finish()
+    {
+        std::shared_ptr<void> erased = std::move(done_);
+        AsyncState<void, Executor> *done = static_cast<AsyncState<void, Executor> *>(erased.get());
+        if (error_)
+            done->set_exception(error_);
+        else
+            done->set_value();
+    }
+
+    // Kahn's algorithm: a cycle leaves nodes that never become ready.
+    bool has_cycle() const
+    {
+        std::vector<size_t> pending(vertices_.size());
+        std::vector<Node> ready;
+        for (size_t i = 0; i < vertices_.size(); ++i) {
+            pending[i] = vertices_[i]->dependencies;
+            if (pending[i] == 0)
+                ready.push_back(i);
+        }
+
+        size_t visited = 0;
+        while (!ready.empty()) {
+            Node node = ready.back();
+            ready.pop_back();
+            ++visited;
+            const std::vector<Node> &successors = vertices_[node]->successors;
+            for (size_t i = 0; i < successors.size(); ++i) {
+                if (--pending[successors[i]] == 0)
+                    ready.push_back(successors[i]);
+            }
+        }
+        return visited != vertices_.size();
+    }
+
+private:
+    static const Node kNone = (Node)-1;
+
+    std::vector<std::unique_ptr<Vertex>> vertices_;
+
+    // State of the current run; done_ is the AsyncState<void, Executor>
+    // of the pool it was given.
+    std::shared_ptr<void> done_;
+    std::atomic<size_t> remaining_ { 0 };
+    std::atomic<bool> failed_ { false };
+    std::mutex mutex_;
+    std::exception_ptr error_;
+};
+
+#endif //_TASK_GRAPH_HPP_
@@ -0,0 +1,162 @@
+#ifndef _TASK_GROUP_HPP_
+#define _TASK_GROUP_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include "cancel.hpp"
+#include "task.hpp"
+#include "thread_pool.hpp"
+
+/*
+ * Fire-and-forget tasks that can be waited for together.
+ *
+ *     TaskGroup group(pool);
+ *     for (size_t i = 0; i < parts; ++i)
+ *         group.run(process, i);
+ *     group.wait();
+ *
+ * Tasks go through the pool's post(), so no future or shared state per
+ * task: one atomic counter tracks the unfinished ones, and only a task
+ * that may be the last takes the lock, to wake the waiters. The first
+ * exception a task throws is rethrown by wait().
+ *
+ * wait() called from one of the pool's workers, a task waiting for its
+ * subtasks, runs queued tasks meanwhile instead of blocking the worker.
+ * run() may be called again after wait(), or by the group's own tasks.
+ * The destructor waits, so the group outlives its tasks.
+ *
+ * BasicTaskGroup<Executor> works on any BasicExecutor, TaskGroup on a
+ * ThreadPool.
+ */
+template <typename Executor>
+class BasicTaskGroup
+{
+public:
+    explicit BasicTaskGroup(Executor &pool) : pool_(pool) { }
+    BasicTaskGroup(const BasicTaskGroup &other) = delete;
+    void operator=(const BasicTaskGroup &other) = delete;
+
+    ~BasicTaskGroup() { join(); }
+
+    template <typename Function, typename...Args>
+    void run(Function &&f, Args&&... args)
+    {
+        using bound_type = decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+
+        pending_.fetch_add(1, std::memory_order_relaxed);
+        pool_.post(Member<bound_type>(this, std::bind(std::forward<Function>(f), std::forward<Args>(args)...)));
+    }
+
+    // Waits for every task run so far, rethrowing the first exception.
+    void wait()
+    {
+        join();
+
+        std::exception_ptr error;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::swap(error, error_);
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+    bool done() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+private:
+    // One task of the group. Dropped unrun by the pool (shutdown()), it
+    // still counts as finished, with TaskCancelled.
+    template <typename F>
+    class Member
+    {
+    public:
+        Member(BasicTaskGroup *group, F &&func) : group_(group), func_(std::move(func)) { }
+
+        Member(Member &&other) noexcept(std::is_nothrow_move_constructible<F>::value)
+            : group_(other.group_), func_(std::move(other.func_))
+        {
+            other.group_ = nullptr;
+        }
+
+        ~Member()
+        {
+            if (group_) {
+                group_->fail(std::make_exception_ptr(TaskCancelled()));
+                group_->finish();
+            }
+        }
+
+        void operator()()
+        {
+            BasicTaskGroup *group = group_;
+            group_ = nullptr;
+            try {
+                func_();
+            } catch (...) {
+                group->fail(std::current_exception());
+            }
+            group->finish();
+        }
+
+    private:
+        BasicTaskGroup *group_;
+        F func_;
+    };
+
+    void fail(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+            error_ = error;
+    }
+
+    void finish()
+    {
+        size_t n = pending_.load(std::memory_order_relaxed);
+        while (n > 1) {
+            if (pending_.compare_exchange_weak(n, n - 1, std::memory_order_acq_rel, std::memory_order_relaxed))
+                return;
+        }
+
+        // Maybe the last one: under the lock, so that the waiter cannot
+        // return, and destroy the group, before we are done notifying.
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            cond_.notify_all();
+    }
+
+    void join()
+    {
+        if (Executor::context().pool == &pool_) {
+            while (!done()) {
+                if (pool_.help())
+                    continue;
+                // Nothing to run: sleep until the group finishes, or look
+                // for newly queued tasks again shortly.
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait_for(lock, std::chrono::milliseconds(1), [this] { return done(); });
+            }
+        }
+
+        // Also pairs with the lock of the last finish() still notifying.
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return done(); });
+    }
+
+private:
+    Executor &pool_;
+    std::atomic<size_t> pending_ { 0 };
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::exception_ptr error_;
+};
+
+using TaskGroup = BasicTaskGroup<ThreadPool>;
+
+#endif //_TASK_GROUP_HPP_
@@ -1,99 +1,911 @@
 #ifndef _THREAD_POOL_H_
 #define _THREAD_POOL_H_
 
-#include <functional> 
-#include <future> 
-#include <mutex> 
-#include <queue> 
-#include <thread> 
-#include <utility> 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
 #include <vector>
-#include "thread_safe_queue.hpp"
+#include "cancel.hpp"
+#include "event_count.hpp"
+#include "executor_policies.hpp"
+#include "pool_metrics.hpp"
+#include "task.hpp"
+#include "timer_wheel.hpp"
+#include "topology.hpp"
 
-class ThreadPool
+#if __cplusplus >= 202002L
+#include <coroutine>
+#endif
+
+template <typename Executor> class BasicTaskGroup;
+
+/*
+ * The pool, built from three policies chosen at compile time (see
+ * executor_policies.hpp): QueuePolicy where tasks wait, WaitPolicy how an
+ * idle worker waits for one, TaskPolicy what a task is. The worker loop
+ * calls them directly, so a pool only pays for the backend it picked:
+ *
+ *     using Tight = BasicExecutor<LockFreeQueue, ParkingIdle, InlineTasks<24>>;
+ *
+ * ThreadPool keeps every schedule selectable at runtime, for a branch on
+ * every push and pop; WorkStealingPool and its siblings below fix one.
+ * ThreadPoll (thread_pool_c11.hpp) is the blocking shared queue. Task
+ * groups, async_on(), co_spawn(), TaskGraph and the parallel algorithms
+ * are templates over the executor and work with any of them.
+ */
+template <template <typename> class QueuePolicy, typename WaitPolicy, typename TaskPolicy>
+class BasicExecutor
 {
 public:
-    ThreadPool(const int max_number_of_threads) : threads_(std::vector<std::thread>(max_number_of_threads))
+    using Schedule = ExecutorSchedule;
+    using Placement = ExecutorPlacement;
+    using Options = ExecutorOptions;
+    using Priority = TaskPriority;
+    using clock = std::chrono::steady_clock;
+    using task_type = typename TaskPolicy::task_type;
+
+    /*
+     * Handle on a timer of schedule_after() or schedule_every(), copyable.
+     * It must not outlive its pool. A default constructed one, or one
+     * returned after shutdown(), refers to no timer.
+     */
+    class Timer
+    {
+    public:
+        Timer() { }
+
+        explicit operator bool() const { return pool_ != nullptr; }
+
+        // Drops the timer before it runs again. False once a one-shot timer
+        // has been queued, or the timer was cancelled already.
+        bool cancel() { return pool_ && pool_->cancel_timer(id_); }
+
+        // Makes the timer due delay from now instead; for a periodic timer,
+        // the next run only. False when cancel() would be.
+        template <typename Rep, typename Period>
+        bool reschedule(const std::chrono::duration<Rep, Period> &delay)
+        {
+            return pool_ && pool_->reschedule_timer(id_, delay);
+        }
+
+    private:
+        friend class BasicExecutor;
+
+        Timer(BasicExecutor *pool, typename TimerWheel<task_type>::Id id) : pool_(pool), id_(id) { }
+
+        BasicExecutor *pool_ = nullptr;
+        typename TimerWheel<task_type>::Id id_ = TimerWheel<task_type>::kNoTimer;
+    };
+
+    // schedule only matters to ScheduledQueue.
+    BasicExecutor(const int max_number_of_threads, Schedule schedule = Schedule::shared_queue,
+            size_t capacity = 4096)
+        : BasicExecutor(max_number_of_threads, make_options(schedule, capacity))
     { }
 
+    BasicExecutor(const int max_number_of_threads, const Options &options)
+        : layout_(WorkerLayout::plan(thread_slots(max_number_of_threads, options), options.placement)),
+        queue_(layout_, options), idle_(layout_, options), grow_depth_(options.grow_depth),
+        grow_delay_(options.grow_delay), idle_timeout_(options.idle_timeout),
+        timer_tick_(std::max(std::chrono::duration_cast<clock::duration>(options.timer_tick), clock::duration(1))),
+        timer_epoch_(clock::now()), timers_(new Timers)
+    {
+        size_t max = layout_.slots();
+        size_t min = options.max_threads || options.min_threads ? std::min(options.min_threads, max) : max;
+        initial_threads_ = std::min(std::max((size_t)std::max(max_number_of_threads, 0), min), max);
+        min_threads_ = min;
+        max_threads_ = max;
+        threads_.resize(max);
+        slot_used_.resize(max);
+        metrics_.reset(new PoolMetrics(max));
+    }
+
+    BasicExecutor(const BasicExecutor &other) = delete;
+    void operator=(const BasicExecutor &other) = delete;
+
+    ~BasicExecutor() { shutdown(); }
+
     void initialize()
     {
-        for (size_t i = 0; i < threads_.size(); ++i) {
-            threads_.at(i) = std::thread(Worker(this, i));
-        }
+        started_ = true;
+        for (size_t i = 0; i < initial_threads_; ++i)
+            spawn();
     }
 
+    // Tasks still queued are dropped: their futures throw TaskCancelled
+    // if they were cancellable, std::future_error (broken_promise) if not.
+    // So are pending timers. Called again, it does nothing.
     void shutdown()
     {
-        shutdown_ = true;
-        conditional_lock_.notify_all(); // Wakeup all worker.
-        for (size_t i = 0; i < threads_.size(); ++i) {
-            if (threads_.at(i).joinable())
-                threads_.at(i).join();
+        stop_timers();
+
+        std::vector<std::thread> threads;
+        {
+            std::lock_guard<std::mutex> lock(threads_mutex_);
+            shutdown_ = true;
+            for (size_t i = 0; i < threads_.size(); ++i) {
+                if (threads_.at(i).joinable())
+                    threads.push_back(std::move(threads_.at(i)));
+            }
         }
+        idle_.notify_all(); // Wakeup all worker.
+        idle_event_.notify_all();
+        for (size_t i = 0; i < threads.size(); ++i)
+            threads.at(i).join();
+
+        task_type task;
+        while (pop_task(0, task))
+            task.reset();
+    }
+
+    // Changes the bounds at runtime, max_threads being capped by the one
+    // given at construction. Missing workers start now, surplus ones leave
+    // as soon as they finish their current task.
+    void resize(size_t min_threads, size_t max_threads)
+    {
+        max_threads = std::max(std::min(max_threads, threads_.size()), (size_t)1);
+        min_threads_ = std::min(min_threads, max_threads);
+        max_threads_ = max_threads;
+
+        while (started_ && running_.load() < min_threads_.load() && spawn())
+            ;
+        idle_.notify_all();
+    }
+
+    void resize(size_t threads) { resize(threads, threads); }
+
+    // Number of running workers.
+    size_t size() const { return running_.load(std::memory_order_relaxed); }
+
+    // Workers the pool may grow to.
+    size_t max_size() const { return threads_.size(); }
+
+    // Index of the calling thread among our workers, below max_size(), or
+    // -1 for any other thread. Lets a task keep per-worker state.
+    int worker_index() const { return context().pool == this ? (int)context().id : -1; }
+
+    // NUMA nodes the workers are spread over, 1 unless placed.
+    size_t nodes() const { return layout_.nodes; }
+
+    // Snapshot taken while the workers keep running, so the counters of
+    // different workers may be a few tasks apart.
+    PoolStats stats()
+    {
+        PoolStats stats;
+        stats.threads = running_.load(std::memory_order_relaxed);
+        stats.idle_threads = idle_workers_.load(std::memory_order_relaxed);
+        stats.pending = queue_.size();
+        metrics_->read(stats);
+        return stats;
     }
 
     template<typename Function, typename...Args>
     auto submit(Function &&f, Args&&... args) -> std::future<decltype(f(args...))>
     {
-        // Create a function with bounded parameters ready to execute.
-        std::function<decltype(f(args...))()> func = std::bind(std::forward<Function>(f), std::forward<Args>(args)...);
+        // Bind the parameters and the promise into one move-only task,
+        // no heap allocation for small callables.
+        task_type task;
+        auto future = package_task(task, std::forward<Function>(f), std::forward<Args>(args)...);
+
+        push_task(std::move(task));
+        return future;
+    }
+
+    // Priority and deadline only steer Schedule::priority, other schedules
+    // take them as plain submit().
+    template<typename Function, typename...Args>
+    auto submit(Priority priority, Function &&f, Args&&... args) -> std::future<decltype(f(args...))>
+    {
+        return submit(priority, clock::time_point::max(), std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+
+    template<typename Function, typename...Args>
+    auto submit(clock::time_point deadline, Function &&f, Args&&... args) -> std::future<decltype(f(args...))>
+    {
+        return submit(Priority::normal, deadline, std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+
+    template<typename Function, typename...Args>
+    auto submit(Priority priority, clock::time_point deadline, Function &&f, Args&&... args)
+        -> std::future<decltype(f(args...))>
+    {
+        task_type task;
+        auto future = package_task(task, std::forward<Function>(f), std::forward<Args>(args)...);
+
+        push_task(std::move(task), priority, deadline);
+        return future;
+    }
+
+    // Queues on the given NUMA node so its own workers run the task, one
+    // of the others only stealing it when the node is busy. Without node
+    // queues (not work stealing, or not placed) this is plain submit().
+    template<typename Function, typename...Args>
+    auto submit_on(size_t node, Function &&f, Args&&... args) -> std::future<decltype(f(args...))>
+    {
+        task_type task;
+        auto future = package_task(task, std::forward<Function>(f), std::forward<Args>(args)...);
+
+        push_task(std::move(task), Priority::normal, clock::time_point::max(), (int)(node % nodes()));
+        return future;
+    }
+
+    // Dropped without running, its future throwing TaskCancelled, if token
+    // is cancelled before a worker takes it (see cancel.hpp).
+    template<typename Function, typename...Args>
+    auto submit(CancelToken token, Function &&f, Args&&... args) -> std::future<decltype(f(args...))>
+    {
+        task_type task;
+        auto future = package_cancellable_task(task, std::move(token), clock::time_point::max(),
+                std::forward<Function>(f), std::forward<Args>(args)...);
+
+        push_task(std::move(task));
+        return future;
+    }
+
+    // Dropped without running, its future throwing TaskExpired, if no worker
+    // takes it before deadline; shedding work whose caller gave up anyway.
+    // Schedule::priority also runs its lane earliest deadline first.
+    template<typename Function, typename...Args>
+    auto submit_with_deadline(clock::time_point deadline, Function &&f, Args&&... args)
+        -> std::future<decltype(f(args...))>
+    {
+        return submit_with_deadline(deadline, CancelToken(), std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+
+    template<typename Function, typename...Args>
+    auto submit_with_deadline(clock::time_point deadline, CancelToken token, Function &&f, Args&&... args)
+        -> std::future<decltype(f(args...))>
+    {
+        task_type task;
+        auto future = package_cancellable_task(task, std::move(token), deadline,
+                std::forward<Function>(f), std::forward<Args>(args)...);
+
+        push_task(std::move(task), Priority::normal, deadline);
+        return future;
+    }
+
+    // Fire and forget: no future, no shared state, nothing allocated for a
+    // small callable. An exception escaping f terminates the program, as it
+    // would on a std::thread; a TaskGroup collects them instead.
+    template<typename Function, typename...Args>
+    void post(Function &&f, Args&&... args)
+    {
+        push_task(task_type(std::bind(std::forward<Function>(f), std::forward<Args>(args)...)));
+    }
+
+    // Returns once nothing is queued and no worker runs a task. Called from
+    // one of our tasks, it helps run the others and returns once its own is
+    // the only one left. A pool that was never initialized with tasks
+    // queued waits for initialize().
+    void wait_idle()
+    {
+        size_t self = context().pool == this ? 1 : 0;
+        while (!idle(self)) {
+            if (self) {
+                if (!help())
+                    std::this_thread::yield();
+                continue;
+            }
+            EventCount::Key key = idle_event_.prepare_wait();
+            if (idle(self))
+                idle_event_.cancel_wait();
+            else
+                idle_event_.wait(key);
+        }
+    }
+
+    /*
+     * Queues f(args...) once delay has passed, as post() would, without
+     * tying up a worker meanwhile: the timer waits in a timing wheel that
+     * one timer thread, started by the first timer, advances. Holding a
+     * timer costs no allocation for a small callable, and the Timer handle
+     * cancels or moves it in O(1). wait_idle() does not wait for timers.
+     */
+    template<typename Rep, typename Period, typename Function, typename...Args>
+    Timer schedule_after(const std::chrono::duration<Rep, Period> &delay, Function &&f, Args&&... args)
+    {
+        task_type task(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+        return add_timer(delay, clock::duration(0), [&task](TimerId) { return std::move(task); });
+    }
+
+    // Queues f(args...) every period, the first time one period from now,
+    // until cancelled. A run late enough to miss beats does not catch up
+    // on them, and the next run is not queued before this one returns.
+    // The period is rounded up to whole ticks. An exception escaping f
+    // goes where post()'s would, the timer rearmed first.
+    template<typename Rep, typename Period, typename Function, typename...Args>
+    Timer schedule_every(const std::chrono::duration<Rep, Period> &period, Function &&f, Args&&... args)
+    {
+        using bound_type = decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+
+        clock::duration every = std::max(std::chrono::duration_cast<clock::duration>(period), timer_tick_);
+        bound_type func(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
+        return add_timer(every, every, [this, &func](TimerId id) {
+            return task_type(Periodic<bound_type>(this, id, std::move(func)));
+        });
+    }
+
+    // Timers not cancelled yet, periodic ones included.
+    size_t timers()
+    {
+        std::lock_guard<std::mutex> lock(timers_->mutex);
+        return timers_->wheel ? timers_->wheel->size() : 0;
+    }
+
+    // Queues a ready-made task: no future, no shared state. The building
+    // block of the continuation and task graph layers.
+    void enqueue(task_type &&task)
+    {
+        push_task(std::move(task));
+    }
+
+#if __cplusplus >= 202002L
+    // co_await pool.schedule() moves the coroutine onto one of our workers.
+    // The queued task is just the coroutine handle, stored inline.
+    struct ScheduleAwaiter
+    {
+        BasicExecutor *pool;
+        bool dropped = false;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) { pool->enqueue(Resume(handle, &dropped)); }
+
+        void await_resume() const
+        {
+            if (dropped)
+                throw TaskCancelled();
+        }
+    };
+
+    /*
+     * Dropped unrun by shutdown(), it still resumes the coroutine, with
+     * *dropped set for its awaiter to throw TaskCancelled: the frames
+     * unwind and free themselves, whoever waits on them sees the exception.
+     * Destroying the handle instead would free a frame its CoTask owns.
+     */
+    class Resume
+    {
+    public:
+        Resume(std::coroutine_handle<> handle, bool *dropped) : handle_(handle), dropped_(dropped) { }
+        Resume(Resume &&other) noexcept : handle_(std::exchange(other.handle_, nullptr)), dropped_(other.dropped_) { }
+
+        ~Resume()
+        {
+            if (handle_) {
+                *dropped_ = true;
+                handle_.resume();
+            }
+        }
+
+        void operator()() { std::exchange(handle_, nullptr).resume(); }
+
+    private:
+        std::coroutine_handle<> handle_;
+        bool *dropped_;
+    };
+
+    ScheduleAwaiter schedule() { return ScheduleAwaiter { this, false }; }
+#endif
+
+    // Queues every callable of [first, last) under one lock acquisition (or
+    // one ring reservation) and wakes the workers for the batch in one go.
+    template <typename Iterator>
+    void submit_bulk(Iterator first, Iterator last)
+    {
+        std::vector<task_type> tasks;
+        for (; first != last; ++first)
+            tasks.emplace_back(*first);
+        push_bulk(tasks);
+    }
+
+    // Runs f(0) ... f(n - 1), all the tasks sharing the one f. The future is
+    // ready once every call has returned and carries the first exception.
+    template <typename Function>
+    std::future<void> submit_bulk(size_t n, Function f)
+    {
+        BulkState<Function> *state = new BulkState<Function>(n, std::move(f));
+        std::future<void> future = state->promise.get_future();
+        if (n == 0) {
+            state->promise.set_value();
+            delete state;
+            return future;
+        }
+
+        std::vector<task_type> tasks;
+        tasks.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+            tasks.emplace_back([state, i] { state->run(i); });
+        push_bulk(tasks);
+        return future;
+    }
+
+private:
+    template <typename Executor> friend class BasicTaskGroup;
+
+    using TimerId = typename TimerWheel<task_type>::Id;
+
+    // The timer thread and the wheel it advances; wheel is gone once the
+    // pool is shut down.
+    struct Timers
+    {
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::unique_ptr<TimerWheel<task_type>> wheel { new TimerWheel<task_type> };
+        std::thread thread;
+        uint64_t wake = 0;      // Tick the thread sleeps until, 0 while it is awake.
+    };
+
+    // The task of a periodic timer, handing itself back to the wheel after
+    // every run, one that threw included: the timer stays armed.
+    template <typename F>
+    struct Periodic
+    {
+        Periodic(BasicExecutor *pool, TimerId id, F &&func) : pool(pool), id(id), func(std::move(func)) { }
+
+        void operator()()
+        {
+            try {
+                func();
+            } catch (...) {
+                pool->rearm_timer(id, task_type(std::move(*this)));
+                throw;
+            }
+            pool->rearm_timer(id, task_type(std::move(*this)));
+        }
+
+        BasicExecutor *pool;
+        TimerId id;
+        F func;
+    };
+
+    struct WorkerContext
+    {
+        BasicExecutor *pool = nullptr;
+        size_t id = 0;
+    };
+
+    // Which pool, if any, the calling thread works for.
+    static WorkerContext &context()
+    {
+        static thread_local WorkerContext ctx;
+        return ctx;
+    }
+
+    template <typename Function>
+    struct BulkState
+    {
+        BulkState(size_t n, Function &&f) : remaining(n), func(std::move(f)) { }
+
+        void run(size_t index)
+        {
+            try {
+                func(index);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+
+            // The last one out publishes the result and frees the batch.
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                if (error)
+                    promise.set_exception(error);
+                else
+                    promise.set_value();
+                delete this;
+            }
+        }
+
+        std::atomic<size_t> remaining;
+        Function func;
+        std::promise<void> promise;
+        std::mutex mutex;
+        std::exception_ptr error;
+    };
+
+    static Options make_options(Schedule schedule, size_t capacity)
+    {
+        Options options;
+        options.schedule = schedule;
+        options.capacity = capacity;
+        return options;
+    }
+
+    // Workers the pool may grow to.
+    static size_t thread_slots(int max_number_of_threads, const Options &options)
+    {
+        return options.max_threads ? options.max_threads : std::max(max_number_of_threads, 1);
+    }
+
+    // First tick at or after time.
+    uint64_t timer_tick(clock::time_point time) const
+    {
+        clock::duration since = time - timer_epoch_;
+        return since.count() <= 0 ? 0 : (uint64_t)((since + timer_tick_ - clock::duration(1)) / timer_tick_);
+    }
+
+    // Ticks since timer_epoch_.
+    uint64_t timer_now() const { return (uint64_t)((clock::now() - timer_epoch_) / timer_tick_); }
+
+    // make(id) builds the task of timer id, under the lock so that the
+    // timer thread cannot take the timer before it has one.
+    template <typename Rep, typename Period, typename Make>
+    Timer add_timer(const std::chrono::duration<Rep, Period> &delay, clock::duration period, Make make)
+    {
+        uint64_t due = timer_tick(clock::now() + std::chrono::duration_cast<clock::duration>(delay));
+        // Rounded up like timer_tick(), a period is never shorter than asked.
+        uint64_t every = period.count()
+            ? std::max((uint64_t)((period + timer_tick_ - clock::duration(1)) / timer_tick_), (uint64_t)1) : 0;
+
+        TimerId id;
+        {
+            std::lock_guard<std::mutex> lock(timers_->mutex);
+            if (!timers_->wheel)
+                return Timer();
+            id = timers_->wheel->add(due, task_type(), every);
+            try {
+                *timers_->wheel->get(id) = make(id);
+            } catch (...) {
+                task_type none;
+                timers_->wheel->cancel(id, none);
+                throw;
+            }
+            if (!timers_->thread.joinable())
+                timers_->thread = std::thread(&BasicExecutor::run_timers, this);
+            if (due >= timers_->wake)
+                return Timer(this, id);
+        }
+        timers_->cond.notify_one();
+        return Timer(this, id);
+    }
+
+    bool cancel_timer(TimerId id)
+    {
+        task_type task;     // Destroyed once unlocked.
+        std::lock_guard<std::mutex> lock(timers_->mutex);
+        return timers_->wheel && timers_->wheel->cancel(id, task);
+    }
+
+    template <typename Rep, typename Period>
+    bool reschedule_timer(TimerId id, const std::chrono::duration<Rep, Period> &delay)
+    {
+        uint64_t due = timer_tick(clock::now() + std::chrono::duration_cast<clock::duration>(delay));
+        {
+            std::lock_guard<std::mutex> lock(timers_->mutex);
+            if (!timers_->wheel || !timers_->wheel->reschedule(id, due))
+                return false;
+            if (due >= timers_->wake)
+                return true;
+        }
+        timers_->cond.notify_one();
+        return true;
+    }
+
+    void rearm_timer(TimerId id, task_type &&task)
+    {
+        {
+            std::lock_guard<std::mutex> lock(timers_->mutex);
+            if (!timers_->wheel || !timers_->wheel->rearm(id, std::move(task)))
+                return;
+            if (timers_->wheel->due(id) >= timers_->wake)
+                return;
+        }
+        timers_->cond.notify_one();
+    }
+
+    // The timer thread: queues what is due as one batch, then sleeps until
+    // the wheel's next tick with something to do, or a nearer timer.
+    void run_timers()
+    {
+        std::vector<task_type> due;
+        std::unique_lock<std::mutex> lock(timers_->mutex);
+        while (timers_->wheel) {
+            timers_->wheel->advance(timer_now(), [&due](TimerId, task_type &&task) { due.push_back(std::move(task)); });
+            if (!due.empty()) {
+                lock.unlock();
+                push_bulk(due);
+                due.clear();
+                lock.lock();
+                continue;
+            }
+
+            uint64_t next = timers_->wheel->next_due();
+            timers_->wake = std::max(next, (uint64_t)1);
+            if (next == TimerWheel<task_type>::kNever)
+                timers_->cond.wait(lock);
+            else
+                timers_->cond.wait_until(lock, timer_epoch_ + timer_tick_ * next);
+            timers_->wake = 0;
+        }
+    }
+
+    void stop_timers()
+    {
+        std::unique_ptr<TimerWheel<task_type>> wheel;
+        std::thread thread;
+        {
+            std::lock_guard<std::mutex> lock(timers_->mutex);
+            std::swap(wheel, timers_->wheel);
+            std::swap(thread, timers_->thread);
+        }
+        timers_->cond.notify_all();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    // Runs one queued task if the calling thread is one of our workers, so
+    // that a task waiting for others lends a hand instead of blocking.
+    bool help()
+    {
+        WorkerContext &ctx = context();
+        task_type task;
+        if (ctx.pool != this || !pop_task(ctx.id, task))
+            return false;
+        metrics_->dequeued(task, 0, ctx.id);
+        task();
+        return true;
+    }
+
+    // Nothing queued and every worker but busy ones idle.
+    bool idle(size_t busy)
+    {
+        return shutdown_ || (!has_task() && idle_workers_.load() + busy >= running_.load());
+    }
+
+    void push_task(task_type &&func, Priority priority = Priority::normal,
+            clock::time_point deadline = clock::time_point::max(), int node = -1)
+    {
+        WorkerContext &ctx = context();
+        int worker = ctx.pool == this ? (int)ctx.id : -1;
+        metrics_->queued(func, worker);
+
+        // Only a bounded queue ever refuses, the loop is gone for the others.
+        while (!queue_.push(std::move(func), worker, node, priority, deadline)) {
+            // Our own worker must not wait for a queue only workers can drain.
+            if (worker >= 0) {
+                metrics_->dequeued(func, 0, worker);
+                func();
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        idle_.notify(1, node);
+        maybe_grow();
+    }
+
+    void push_bulk(std::vector<task_type> &tasks)
+    {
+        WorkerContext &ctx = context();
+        int worker = ctx.pool == this ? (int)ctx.id : -1;
+        metrics_->queued_bulk(tasks, worker);
+
+        int node = -1;
+        size_t done = 0;
+        while (done < tasks.size()) {
+            size_t n = queue_.push_bulk(tasks.data() + done, tasks.size() - done, worker, node);
+            done += n;
+            if (n) {
+                idle_.notify(n, node);  // Let the workers drain while we wait for room.
+            } else if (worker >= 0) {
+                for (; done < tasks.size(); ++done) {
+                    metrics_->dequeued(tasks[done], 0, worker);
+                    tasks[done]();
+                }
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        maybe_grow();
+    }
+
+    bool pop_task(size_t id, task_type &func) { return queue_.pop(id, func); }
+
+    bool has_task() { return !queue_.empty(); }
+
+    static int64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count();
+    }
+
+    // Called after every submit, costs two loads unless the pool is saturated.
+    // The queueing delay is estimated as how long every worker has been busy.
+    void maybe_grow()
+    {
+        if (idle_workers_.load(std::memory_order_relaxed) != 0 || !started_)
+            return;
+
+        size_t running = running_.load(std::memory_order_relaxed);
+        if (running >= max_threads_.load(std::memory_order_relaxed))
+            return;
+
+        int64_t busy_since = busy_since_.load(std::memory_order_relaxed);
+        if (running == 0 || queue_.size() >= grow_depth_ * running
+                || (busy_since && now() - busy_since >= grow_delay_.count() * 1000000))
+            spawn();
+    }
+
+    bool spawn()
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex_);
+        if (shutdown_ || running_.load() >= max_threads_.load())
+            return false;
 
-        // Encapsulate it into a shared ptr in order to be able to copy construct
-        auto task_ptr = std::make_shared<std::packaged_task<decltype(f(args ...))()>>(func);
+        size_t id = std::find(slot_used_.begin(), slot_used_.end(), false) - slot_used_.begin();
+        if (id == slot_used_.size())
+            return false;
 
-        // Wrap packaged task into void function
-        std::function<void()> wrapper_func = [task_ptr]() { (*task_ptr)(); };
+        // The slot may still hold a retired thread on its way out.
+        if (threads_.at(id).joinable())
+            threads_.at(id).join();
 
-        queue_.enqueue(wrapper_func);
+        slot_used_[id] = true;
+        running_.fetch_add(1);
+        busy_since_ = 0;    // Give the newcomer a chance before growing again.
+        threads_.at(id) = std::thread(Worker(this, id));
+        return true;
+    }
+
+    bool over_max() const
+    {
+        return running_.load(std::memory_order_relaxed) > max_threads_.load(std::memory_order_relaxed);
+    }
+
+    // A worker leaves when the pool is above max_threads, or above
+    // min_threads once it timed out idle.
+    bool retire(size_t id, bool timed_out, bool idle)
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex_);
+        size_t running = running_.load();
+        if (shutdown_ || !(running > max_threads_.load() || (timed_out && running > min_threads_.load())))
+            return false;
+
+        running_.fetch_sub(1);
+        if (idle)
+            idle_workers_.fetch_sub(1);
+
+        // A task may have raced in while we were leaving and seen us idle.
+        if (has_task()) {
+            if (running_.load() == 0) {
+                running_.fetch_add(1);
+                if (idle)
+                    idle_workers_.fetch_add(1);
+                return false;
+            }
+            idle_.notify(1, (int)layout_.slot_node[id]);
+        }
+
+        slot_used_[id] = false;
+        idle_event_.notify_all();
+        return true;
+    }
+
+    // Waits as WaitPolicy does until a submit or shutdown() wakes us.
+    // Returns false when the worker has retired.
+    bool wait_for_task(size_t id)
+    {
+        size_t idle = idle_workers_.fetch_add(1) + 1;
+        if (idle == 1)
+            busy_since_ = 0;
+        if (idle >= running_.load(std::memory_order_relaxed))
+            idle_event_.notify_all();   // For wait_idle(), a fence when nobody waits.
+
+        auto ready = [this] { return shutdown_ || has_task() || over_max(); };
 
-        // Weakup a thread whitch was waitting.
-        conditional_lock_.notify_one();
+        bool timed = running_.load() > min_threads_.load();
+        bool timed_out = !idle_.wait(layout_.slot_node[id], ready, timed, idle_timeout_);
 
-        return task_ptr->get_future();
+        if (!shutdown_ && (timed_out || over_max()) && retire(id, timed_out, true))
+            return false;
+
+        // The last worker to leave idle marks the pool saturated, and checks
+        // for a backlog that was queued while it was still counted idle.
+        if (idle_workers_.fetch_sub(1) == 1) {
+            busy_since_ = now();
+            maybe_grow();
+        }
+        return true;
     }
 
 private:
-    bool shutdown_ = false;
-    ThreadSafeQueue<std::function<void()>> queue_;
-    std::vector<std::thread> threads_;
-    std::mutex conditional_mutex_;
-    std::condition_variable conditional_lock_;
+    std::atomic<bool> shutdown_ { false };
+    WorkerLayout layout_;                   // Placement, fixed per slot at construction.
+    QueuePolicy<task_type> queue_;
+    WaitPolicy idle_;
+    EventCount idle_event_;                 // wait_idle() parks here.
+
+    // Elastic sizing.
+    std::atomic<bool> started_ { false };
+    size_t initial_threads_;
+    std::atomic<size_t> min_threads_;
+    std::atomic<size_t> max_threads_;
+    size_t grow_depth_;
+    std::chrono::milliseconds grow_delay_;
+    std::chrono::milliseconds idle_timeout_;
+    std::atomic<size_t> running_ { 0 };
+    std::atomic<size_t> idle_workers_ { 0 };
+    std::atomic<int64_t> busy_since_ { 0 };
+
+    std::unique_ptr<PoolMetrics> metrics_;
+
+    clock::duration timer_tick_;
+    clock::time_point timer_epoch_;             // Tick 0 of the timer wheel.
+    std::unique_ptr<Timers> timers_;
+
+    std::mutex threads_mutex_;
+    std::vector<std::thread> threads_;          // One slot per possible worker.
+    std::vector<bool> slot_used_;
 
 private:
     class Worker
     {
         public:
-            Worker(ThreadPool *pool, const int id):id_(id), pool_(pool)
+            Worker(BasicExecutor *pool, const int id):id_(id), pool_(pool)
             { }
 
             //overload operator '()'
             void operator()()
             {
-                std::function<void()> func;
-                bool dequeued;
+                WorkerContext &ctx = BasicExecutor::context();
+                ctx.pool = pool_;
+                ctx.id = id_;
+
+                if (!pool_->layout_.slot_cpus[id_].empty())
+                    pin_current_thread(pool_->layout_.slot_cpus[id_]);
+
+                task_type func;
+                WorkerMetrics &metrics = pool_->metrics_->slot(id_);
+                uint64_t mark = PoolMetrics::ticks();
+
+                // A backlog big enough to start us may need more of us.
+                pool_->maybe_grow();
 
                 // If the thread pool is not shutdown, repeat get task.
                 while (!pool_->shutdown_) {
-                    {
-                        std::unique_lock<std::mutex> lock(pool_->conditional_mutex_);
-                        if (pool_->queue_.empty()) {
-                            // Waitting for pool notify me to ready to dequeue and run task.
-                            pool_->conditional_lock_.wait(lock);
-                        }
-                        dequeued = pool_->queue_.dequeue(func);
-                    }
-                    if (dequeued)
+                    if (pool_->over_max() && pool_->retire(id_, false, false))
+                        break;
+
+                    bool found = pool_->pop_task(id_, func);
+                    uint64_t start = PoolMetrics::ticks();
+                    metrics.lock(start - mark);
+
+                    if (found) {
+                        uint64_t delay = pool_->metrics_->dequeued(func, start, id_);
                         func();
+                        mark = PoolMetrics::ticks();
+                        metrics.task(delay, mark - start);
+                    } else {
+                        if (!pool_->wait_for_task(id_))
+                            break;
+                        mark = PoolMetrics::ticks();
+                        metrics.idle(mark - start);
+                    }
                 }
+
+                ctx.pool = nullptr;
             }
 
         private:
             int id_;
-            ThreadPool *pool_;
+            BasicExecutor *pool_;
     };
 };
 
+// Every schedule, picked at runtime through Options::schedule.
+using ThreadPool = BasicExecutor<ScheduledQueue, ParkingIdle, InlineTasks<>>;
+
+// One schedule each, fixed at compile time; they ignore Options::schedule.
+using SharedQueuePool = BasicExecutor<SharedQueue, ParkingIdle, InlineTasks<>>;
+using LockFreePool = BasicExecutor<LockFreeQueue, ParkingIdle, InlineTasks<>>;
+using PriorityPool = BasicExecutor<PriorityQueue, ParkingIdle, InlineTasks<>>;
+using WorkStealingPool = BasicExecutor<StealingQueues, ParkingIdle, InlineTasks<>>;
 
 
 #endif //_THREAD_POOL_H_
@@ -1,87 +1,38 @@
-#include <thread>
-#include <queue>
-#include <mutex>
-#include <functional>
-#include <condition_variable>
-#include <future>
-#include <memory>
+#ifndef _THREAD_POOL_C11_HPP_
+#define _THREAD_POOL_C11_HPP_
 
-
-class ThreadPoll
+#include <future>
+#include <thread>
+#include <utility>
+#include "thread_pool.hpp"
+
+/*
+ * The classic pool: one locked queue, workers blocking on a condition
+ * variable, running from construction and finishing every task before the
+ * destructor returns. A BasicExecutor with those policies, so stats(),
+ * post(), wait_idle() and the rest come with it.
+ */
+class ThreadPoll : public BasicExecutor<SharedQueue, BlockingIdle, InlineTasks<>>
 {
 public:
     ThreadPoll(std::size_t thread_size = (std::thread::hardware_concurrency() == 0 ? 1 : std::thread::hardware_concurrency()))
+        : BasicExecutor((int)thread_size, Options())
     {
-        printf("cpu cores:%lu\n", thread_size);
-        // create workers
-        for (size_t i = 0; i < thread_size; ++i) {
-            auto worker = [this] {
-                //1. wait
-                //2. get task
-                //3. excute until stop and all tasks done
-                for (;;) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(this->mu_);
-                        this->cond_.wait(lock, [this]{ return this->stop_ || ! this->tasks_.empty(); });
-
-                        if (this->tasks_.empty() && this->stop_)
-                            return;
-
-                        task = std::move(this->tasks_.front());
-                        this->tasks_.pop();
-                    }
-                    task();
-                }
-            };
-
-            this->workers_.emplace_back(worker);
-        }
+        initialize();
     }
 
     // commit
     template<typename F, typename ...Args>
-    auto commit(F &&function, Args&& ...args) -> std::future<typename std::result_of<F(Args...)>::type>
+    auto commit(F &&function, Args&& ...args) -> std::future<decltype(function(args...))>
     {
-        // package function
-        using return_type = typename std::result_of<F(Args...)>::type;
-        auto task = std::make_shared<std::packaged_task<return_type()>>(std::bind(std::forward<F>(function), std::forward<Args>(args)...));
-        std::future<return_type> result = task->get_future();
-
-        // insert function to tasks queue
-        {
-            std::lock_guard<std::mutex> lock(this->mu_);
-            if (this->stop_)
-                throw std::runtime_error("commit on stopped thread poll!");
-            this->tasks_.emplace([task]{ (*task)(); });
-        }
-
-        // notify worker to do tasks
-        this->cond_.notify_one();
-        return result;
+        return submit(std::forward<F>(function), std::forward<Args>(args)...);
     }
 
-    // destory
+    // destory: join all tasks, then the workers.
     ~ThreadPoll()
     {
-        // stop workers
-        {
-            std::lock_guard<std::mutex> lock(this->mu_);
-            this->stop_ = true;
-        }
-        // wakeup all worker
-        this->cond_.notify_all();
-
-        // join all tasks
-        for (auto &it : this->workers_)
-            if (it.joinable()) it.join();
-
+        wait_idle();
     }
-
-private:
-    std::vector<std::thread> workers_;
-    std::queue<std::function<void()>> tasks_;
-    std::mutex mu_;
-    std::condition_variable cond_;
-    bool stop_ { false };
 };
+
+#endif //_THREAD_POOL_C11_HPP_
@@ -2,9 +2,20 @@
 #define _THREAD_SAFE_THREAD_SAFE_QUEUE_HPP_
 
 
+#include <chrono>
+#include <condition_variable>
 #include <mutex>
 #include <queue>
 
+/*
+ * Mutex-guarded FIFO, usable as a pipeline stage between threads.
+ *
+ * Unbounded by default. With a capacity, push() blocks while the queue is
+ * full, which slows producers down to the pace of the consumers. Both
+ * sides may block (push, wait_pop) or not (try_push, dequeue); pop_bulk
+ * moves out several items for one lock. close() ends the stage: pushes
+ * fail from then on and pops fail once the queue is drained.
+ */
 template <typename T>
 class ThreadSafeQueue {
 private:
@@ -12,11 +23,14 @@ private:
     using type_ref = T &;
 
 public:
-    ThreadSafeQueue() { }
+    // capacity 0: unbounded.
+    explicit ThreadSafeQueue(size_t capacity = 0) : capacity_(capacity) { }
     ThreadSafeQueue(const ThreadSafeQueue &other) = delete;
     void operator=(const ThreadSafeQueue &other) = delete;
     ~ThreadSafeQueue() { }
 
+    size_t capacity() const { return capacity_; }
+
     bool empty()
     {
         std::lock_guard<std::mutex> lock(mutex_);
@@ -29,26 +43,206 @@ public:
         return queue_.size();
     }
 
-    void enqueue(const_type_ref t)
+    // Always succeeds on an open queue, waiting for room when bounded.
+    void enqueue(const_type_ref t) { push(t); }
+    void enqueue(T &&t) { push(std::move(t)); }
+
+    // Moves [first, last) in, under a single lock while there is room.
+    template <typename Iterator>
+    void enqueue_bulk(Iterator first, Iterator last)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
-        queue_.push(t);
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (first != last && wait_for_room(lock)) {
+            size_t n = 0;
+            do {
+                queue_.push(std::move(*first));
+                ++first;
+                ++n;
+            } while (first != last && !full());
+            notify_pop(lock, n);
+            if (first != last)
+                lock.lock();
+        }
+    }
+
+    // Waits while a bounded queue is full. False, t untouched, once closed.
+    bool push(const_type_ref t) { return emplace(t); }
+    bool push(T &&t) { return emplace(std::move(t)); }
+
+    template <typename... Args>
+    bool emplace(Args&&... args)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!wait_for_room(lock))
+            return false;
+        queue_.emplace(std::forward<Args>(args)...);
+        notify_pop(lock, 1);
+        return true;
+    }
+
+    // False when full or closed.
+    bool try_push(const_type_ref t) { return try_push_for(t, std::chrono::nanoseconds(0)); }
+    bool try_push(T &&t) { return try_push_for(std::move(t), std::chrono::nanoseconds(0)); }
+
+    // False when there was no room within timeout, or the queue is closed.
+    template <typename U, typename Rep, typename Period>
+    bool try_push_for(U &&t, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (full() && !closed_) {
+            ++push_waiters_;
+            not_full_.wait_for(lock, timeout, [this] { return !full() || closed_; });
+            --push_waiters_;
+        }
+        if (full() || closed_)
+            return false;
+        queue_.push(std::forward<U>(t));
+        notify_pop(lock, 1);
+        return true;
     }
 
+    // Never waits.
     bool dequeue(type_ref t)
     {
-        std::lock_guard<std::mutex> lock(mutex_);
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty())
+            return false;
+        take(t);
+        notify_push(lock, 1);
+        return true;
+    }
+
+    // Waits for an item. False once the queue is closed and drained.
+    bool wait_pop(type_ref t)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty() && !closed_) {
+            ++pop_waiters_;
+            not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+            --pop_waiters_;
+        }
         if (queue_.empty())
             return false;
+        take(t);
+        notify_push(lock, 1);
+        return true;
+    }
+
+    // wait_pop() giving up after timeout.
+    template <typename Rep, typename Period>
+    bool try_pop_for(type_ref t, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty() && !closed_) {
+            ++pop_waiters_;
+            not_empty_.wait_for(lock, timeout, [this] { return !queue_.empty() || closed_; });
+            --pop_waiters_;
+        }
+        if (queue_.empty())
+            return false;
+        take(t);
+        notify_push(lock, 1);
+        return true;
+    }
 
+    // Moves up to max items to out, an output iterator, under one lock;
+    // returns how many. Never waits.
+    template <typename Output>
+    size_t pop_bulk(Output out, size_t max)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return take_bulk(lock, out, max);
+    }
+
+    // pop_bulk() waiting for the first item. 0 once closed and drained.
+    template <typename Output>
+    size_t wait_pop_bulk(Output out, size_t max)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (queue_.empty() && !closed_) {
+            ++pop_waiters_;
+            not_empty_.wait(lock, [this] { return !queue_.empty() || closed_; });
+            --pop_waiters_;
+        }
+        return take_bulk(lock, out, max);
+    }
+
+    // Fails every push from now on and wakes every waiter; what is queued
+    // can still be popped.
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+    bool closed()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return closed_;
+    }
+
+private:
+    bool full() const { return capacity_ && queue_.size() >= capacity_; }
+
+    // Waits for room; false when closed.
+    bool wait_for_room(std::unique_lock<std::mutex> &lock)
+    {
+        if (full() && !closed_) {
+            ++push_waiters_;
+            not_full_.wait(lock, [this] { return !full() || closed_; });
+            --push_waiters_;
+        }
+        return !closed_;
+    }
+
+    void take(type_ref t)
+    {
         t = std::move(queue_.front());
         queue_.pop();
-        return true;
+    }
+
+    template <typename Output>
+    size_t take_bulk(std::unique_lock<std::mutex> &lock, Output out, size_t max)
+    {
+        size_t n = 0;
+        for (; n < max && !queue_.empty(); ++n) {
+            *out = std::move(queue_.front());
+            ++out;
+            queue_.pop();
+        }
+        notify_push(lock, n);
+        return n;
+    }
+
+    // Wakes as many waiters as items went in or out, only when some wait;
+    // the lock is dropped first so they do not wake up into it.
+    void notify_pop(std::unique_lock<std::mutex> &lock, size_t n)
+    {
+        bool waiting = pop_waiters_ != 0;
+        lock.unlock();
+        if (waiting)
+            n == 1 ? not_empty_.notify_one() : not_empty_.notify_all();
+    }
+
+    void notify_push(std::unique_lock<std::mutex> &lock, size_t n)
+    {
+        bool waiting = push_waiters_ != 0 && n != 0;
+        lock.unlock();
+        if (waiting)
+            n == 1 ? not_full_.notify_one() : not_full_.notify_all();
     }
 
 private:
     std::queue<T> queue_;
     std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    const size_t capacity_;
+    size_t pop_waiters_ = 0;
+    size_t push_waiters_ = 0;
+    bool closed_ = false;
 };
 
 #endif //_THREAD_SAFE_THREAD_SAFE_QUEUE_HPP_
@@ -0,0 +1,321 @@
+#ifndef _TIMER_WHEEL_HPP_
+#define _TIMER_WHEEL_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+ * Hierarchical timing wheel: kLevels wheels of kSlots slots, every slot of
+ * a level spanning a whole turn of the level below, so 4 levels of 256
+ * cover 2^32 ticks (49 days at 1 ms). A timer goes in the lowest level its
+ * delay fits and moves down a level each time the wheel below wraps around
+ * to its slot; it expires from level 0 on its very tick.
+ *
+ * Timers are nodes of one vector, linked into their slot by index, so
+ * adding, cancelling and moving a timer is O(1) whatever the number
+ * pending, and a million of them cost no allocation each. An Id carries
+ * the node's generation, which makes it stale once its timer is gone.
+ *
+ * A periodic timer is not rearmed when it expires: the wheel keeps its
+ * node, without the item, until rearm() hands the item back after it ran,
+ * so the same timer never runs twice at once.
+ *
+ * Time is whatever the caller counts in ticks. Not thread safe.
+ */
+template <typename T>
+class TimerWheel {
+public:
+    using Id = uint64_t;
+
+    static const size_t kLevels = 4;
+    static const size_t kSlotBits = 8;
+    static const size_t kSlots = 1 << kSlotBits;
+    static const Id kNoTimer = 0;
+    static const uint64_t kNever = UINT64_MAX;
+
+    explicit TimerWheel(uint64_t now = 0) : now_(now)
+    {
+        for (size_t i = 0; i < kLevels * kSlots; ++i)
+            heads_[i] = kNil;
+        for (size_t i = 0; i < kLevels; ++i)
+            linked_[i] = 0;
+    }
+
+    TimerWheel(const TimerWheel &other) = delete;
+    void operator=(const TimerWheel &other) = delete;
+
+    // The next tick advance() has to go through.
+    uint64_t now() const { return now_; }
+
+    // Timers not cancelled yet, periodic ones between two runs included.
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    // Expires item at due, a tick already past meaning the next one; then
+    // every period ticks if not 0.
+    Id add(uint64_t due, T &&item, uint64_t period = 0)
+    {
+        uint32_t index = allocate();
+        Node &node = nodes_[index];
+        node.item = std::move(item);
+        node.due = std::max(due, now_);
+        node.period = period;
+        link(index);
+        ++size_;
+        return id_of(index);
+    }
+
+    // The item of a pending timer, nullptr for a stale id or a periodic
+    // timer whose item is out running. Valid until the next add().
+    T *get(Id id)
+    {
+        Node *node = find(id);
+        return node && node->slot != kUnlinked ? &node->item : nullptr;
+    }
+
+    // Drops the timer, moving its item, if it still has it, to item.
+    // False for a stale id: expired, or cancelled already.
+    bool cancel(Id id, T &item)
+    {
+        Node *node = find(id);
+        if (!node)
+            return false;
+        uint32_t index = (uint32_t)id;
+        if (node->slot != kUnlinked) {
+            unlink(index);
+            item = std::move(node->item);
+        }
+        release(index);
+        return true;
+    }
+
+    // Moves the timer to due; for a periodic one whose item is out, the
+    // next run after rearm(). False for a stale id.
+    bool reschedule(Id id, uint64_t due)
+    {
+        Node *node = find(id);
+        if (!node)
+            return false;
+        uint32_t index = (uint32_t)id;
+        node->due = due;
+        if (node->slot != kUnlinked) {
+            unlink(index);
+            link(index);
+        }
+        return true;
+    }
+
+    // Gives a periodic timer its item back once it ran. False, item
+    // untouched, when the timer was cancelled meanwhile.
+    bool rearm(Id id, T &&item)
+    {
+        Node *node = find(id);
+        if (!node || node->slot != kUnlinked)
+            return false;
+        node->item = std::move(item);
+        link((uint32_t)id);
+        return true;
+    }
+
+    // Due tick of a pending timer, kNever for a stale id.
+    uint64_t due(Id id)
+    {
+        Node *node = find(id);
+        return node ? node->due : kNever;
+    }
+
+    /*
+     * Goes through every tick up to and including until, calling
+     * expire(id, item) for each timer due, in due order. A one-shot timer
+     * is gone by then; a periodic one waits for rearm(), its next due set
+     * one period later, periods already missed skipped.
+     */
+    template <typename Expire>
+    void advance(uint64_t until, Expire expire)
+    {
+        while (now_ <= until) {
+            uint64_t next = next_due();
+            if (next > until) {
+                now_ = until + 1;
+                return;
+            }
+            now_ = next;
+            tick(expire);
+        }
+    }
+
+    // The first tick advance() has something to do at, kNever when no
+    // timer is pending: a timer due then, or a higher level to cascade.
+    uint64_t next_due() const
+    {
+        bool higher = false;
+        for (size_t level = 1; level < kLevels; ++level)
+            higher = higher || linked_[level] != 0;
+        if (!higher && linked_[0] == 0)
+            return kNever;
+
+        for (uint64_t t = now_; t < now_ + kSlots; ++t) {
+            if ((higher && (t & kMask) == 0) || heads_[t & kMask] != kNil)
+                return t;
+        }
+        return now_ + kSlots;
+    }
+
+private:
+    static const uint32_t kNil = UINT32_MAX;
+    static const uint16_t kUnlinked = UINT16_MAX;
+    static const uint64_t kMask = kSlots - 1;
+
+    struct Node
+    {
+        T item;
+        uint64_t due = 0;
+        uint64_t period = 0;
+        uint32_t prev = kNil;
+        uint32_t next = kNil;           // Next free node too.
+        uint32_t generation = 0;        // Odd while in use.
+        uint16_t slot = kUnlinked;      // level * kSlots + slot, while in a slot.
+    };
+
+    Id id_of(uint32_t index) const { return (Id)nodes_[index].generation << 32 | index; }
+
+    Node *find(Id id)
+    {
+        uint32_t index = (uint32_t)id;
+        if (id == kNoTimer || index >= nodes_.size() || nodes_[index].generation != (uint32_t)(id >> 32))
+            return nullptr;
+        return &nodes_[index];
+    }
+
+    uint32_t allocate()
+    {
+        uint32_t index = free_;
+        if (index != kNil) {
+            free_ = nodes_[index].next;
+        } else {
+            index = (uint32_t)nodes_.size();
+            nodes_.emplace_back();
+        }
+        ++nodes_[index].generation;
+        return index;
+    }
+
+    void release(uint32_t index)
+    {
+        Node &node = nodes_[index];
+        node.item = T();
+        ++node.generation;
+        node.next = free_;
+        free_ = index;
+        --size_;
+    }
+
+    // Into the slot of the lowest level whose turn still reaches due.
+    void link(uint32_t index)
+    {
+        Node &node = nodes_[index];
+        uint64_t due = node.due < now_ ? now_ : node.due;
+        uint64_t delta = due - now_;
+        size_t level = 0;
+        while (level + 1 < kLevels && delta >= (uint64_t)1 << (kSlotBits * (level + 1)))
+            ++level;
+        if (level + 1 == kLevels && delta >> (kSlotBits * kLevels))
+            due = now_ + ((uint64_t)1 << (kSlotBits * kLevels)) - 1;   // Beyond the wheel: goes round again.
+
+        size_t slot = level * kSlots + ((due >> (kSlotBits * level)) & kMask);
+        node.slot = (uint16_t)slot;
+        node.prev = kNil;
+        node.next = heads_[slot];
+        if (node.next != kNil)
+            nodes_[node.next].prev = index;
+        heads_[slot] = index;
+        ++linked_[level];
+    }
+
+    void unlink(uint32_t index)
+    {
+        Node &node = nodes_[index];
+        if (node.prev != kNil)
+            nodes_[node.prev].next = node.next;
+        else
+            heads_[node.slot] = node.next;
+        if (node.next != kNil)
+            nodes_[node.next].prev = node.prev;
+        --linked_[node.slot / kSlots];
+        node.slot = kUnlinked;
+    }
+
+    // Empties a slot, returning its list.
+    uint32_t detach(size_t slot)
+    {
+        uint32_t head = heads_[slot];
+        heads_[slot] = kNil;
+        for (uint32_t i = head; i != kNil; i = nodes_[i].next) {
+            nodes_[i].slot = kUnlinked;
+            --linked_[slot / kSlots];
+        }
+        return head;
+    }
+
+    // Runs tick now_: the slots above whose turn starts now move down,
+    // then level 0's slot expires.
+    template <typename Expire>
+    void tick(Expire &expire)
+    {
+        for (size_t level = 1; level < kLevels && (now_ >> (kSlotBits * (level - 1)) & kMask) == 0; ++level) {
+            uint32_t i = detach(level * kSlots + (now_ >> (kSlotBits * level) & kMask));
+            while (i != kNil) {
+                uint32_t next = nodes_[i].next;
+                link(i);
+                i = next;
+            }
+        }
+
+        uint32_t i = detach(now_ & kMask);
+        // Linked at the head, so the list is newest first: expire from its tail.
+        uint32_t last = kNil;
+        for (; i != kNil; i = nodes_[i].next)
+            last = i;
+        for (i = last; i != kNil; ) {
+            uint32_t prev = nodes_[i].prev;
+            Node &node = nodes_[i];
+            if (node.due > now_) {
+                link(i);    // Capped beyond the wheel, not due yet.
+            } else if (node.period == 0) {
+                T item = std::move(node.item);
+                Id id = id_of(i);
+                release(i);
+                expire(id, std::move(item));
+            } else {
+                uint64_t late = now_ - node.due;
+                node.due += (late / node.period + 1) * node.period;
+                T item = std::move(node.item);
+                expire(id_of(i), std::move(item));
+            }
+            i = prev;
+        }
+        ++now_;
+    }
+
+private:
+    std::vector<Node> nodes_;
+    uint32_t free_ = kNil;
+    size_t size_ = 0;
+    uint64_t now_;
+    uint32_t heads_[kLevels * kSlots];
+    size_t linked_[kLevels];
+};
+
+template <typename T> const size_t TimerWheel<T>::kLevels;
+template <typename T> const size_t TimerWheel<T>::kSlotBits;
+template <typename T> const size_t TimerWheel<T>::kSlots;
+template <typename T> const typename TimerWheel<T>::Id TimerWheel<T>::kNoTimer;
+template <typename T> const uint64_t TimerWheel<T>::kNever;
+template <typename T> const uint32_t TimerWheel<T>::kNil;
+template <typename T> const uint16_t TimerWheel<T>::kUnlinked;
+template <typename T> const uint64_t TimerWheel<T>::kMask;
+
+#endif //_TIMER_WHEEL_HPP_
@@ -0,0 +1,196 @@
+#ifndef _TOPOLOGY_HPP_
+#define _TOPOLOGY_HPP_
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+ * CPUs and NUMA nodes this process may run on, read from sysfs:
+ *
+ *   /sys/devices/system/node/online                    nodes
+ *   /sys/devices/system/node/nodeN/cpulist             CPUs of node N
+ *   /sys/devices/system/cpu/cpuN/topology/thread_siblings_list
+ *
+ * CPUs outside the process affinity mask (taskset, cgroups) are left out.
+ * Without sysfs everything is one node holding hardware_concurrency() CPUs.
+ */
+class CpuTopology
+{
+public:
+    static const CpuTopology &inst()
+    {
+        static CpuTopology *self = new CpuTopology;
+        return *self;
+    }
+
+    size_t nodes() const { return nodes_.size(); }
+    const std::vector<int> &node_cpus(size_t node) const { return nodes_.at(node); }
+
+    // One CPU per physical core, grouped by node.
+    const std::vector<int> &cores() const { return cores_; }
+
+    int node_of(int cpu) const
+    {
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            if (std::find(nodes_[i].begin(), nodes_[i].end(), cpu) != nodes_[i].end())
+                return (int)i;
+        }
+        return -1;
+    }
+
+    // Node the calling thread runs on right now, -1 if unknown.
+    int current_node() const
+    {
+#if defined(__linux__)
+        int cpu = sched_getcpu();
+        if (cpu >= 0 && (size_t)cpu < cpu_node_.size())
+            return cpu_node_[cpu];
+#endif
+        return -1;
+    }
+
+    // "0-3,8,10-11" -> { 0, 1, 2, 3, 8, 10, 11 }
+    static std::vector<int> parse_list(const std::string &list)
+    {
+        std::vector<int> cpus;
+        const char *p = list.c_str();
+        while (*p) {
+            char *end;
+            long first = strtol(p, &end, 10);
+            if (end == p)
+                break;
+
+            long last = first;
+            p = end;
+            if (*p == '-') {
+                last = strtol(p + 1, &end, 10);
+                p = end;
+            }
+            for (long cpu = first; cpu <= last; ++cpu)
+                cpus.push_back((int)cpu);
+            while (*p == ',' || *p == '\n' || *p == ' ')
+                ++p;
+        }
+        return cpus;
+    }
+
+protected:
+    CpuTopology()
+    {
+        std::vector<int> allowed = allowed_cpus();
+
+        std::string online;
+        if (read_file("/sys/devices/system/node/online", online)) {
+            std::vector<int> ids = parse_list(online);
+            for (size_t i = 0; i < ids.size(); ++i) {
+                char path[128];
+                std::string list;
+                snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", ids[i]);
+                if (!read_file(path, list))
+                    continue;
+
+                std::vector<int> cpus = filter(parse_list(list), allowed);
+                if (!cpus.empty())
+                    nodes_.push_back(cpus);
+            }
+        }
+        if (nodes_.empty())
+            nodes_.push_back(allowed);
+
+        for (size_t i = 0; i < nodes_.size(); ++i) {
+            for (size_t j = 0; j < nodes_[i].size(); ++j) {
+                int cpu = nodes_[i][j];
+                if ((size_t)cpu >= cpu_node_.size())
+                    cpu_node_.resize(cpu + 1, -1);
+                cpu_node_[cpu] = (int)i;
+
+                // A core is represented by the first of its hyperthreads we may use.
+                char path[128];
+                std::string list;
+                snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+                std::vector<int> siblings = read_file(path, list) ? filter(parse_list(list), allowed) : std::vector<int>();
+                if (siblings.empty() || siblings.front() == cpu)
+                    cores_.push_back(cpu);
+            }
+        }
+    }
+
+private:
+    static bool read_file(const char *path, std::string &content)
+    {
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+            return false;
+
+        char buf[4096];
+        size_t n = fread(buf, 1, sizeof(buf) - 1, fp);
+        fclose(fp);
+        content.assign(buf, n);
+        return n > 0;
+    }
+
+    static std::vector<int> filter(const std::vector<int> &cpus, const std::vector<int> &allowed)
+    {
+        std::vector<int> result;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            if (std::find(allowed.begin(), allowed.end(), cpus[i]) != allowed.end())
+                result.push_back(cpus[i]);
+        }
+        return result;
+    }
+
+    static std::vector<int> allowed_cpus()
+    {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+                if (CPU_ISSET(cpu, &set))
+                    cpus.push_back(cpu);
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            unsigned n = std::thread::hardware_concurrency();
+            for (unsigned cpu = 0; cpu < (n ? n : 1); ++cpu)
+                cpus.push_back((int)cpu);
+        }
+        return cpus;
+    }
+
+private:
+    std::vector<std::vector<int>> nodes_;
+    std::vector<int> cores_;
+    std::vector<int> cpu_node_;
+};
+
+// Restricts the calling thread to cpus, false if the system refused.
+inline bool pin_current_thread(const std::vector<int> &cpus)
+{
+#if defined(__linux__)
+    if (cpus.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < cpus.size(); ++i)
+        CPU_SET(cpus[i], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+#endif //_TOPOLOGY_HPP_
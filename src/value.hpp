@@ -1,7 +1,13 @@
 #ifndef _VALUE_HPP_
 #define _VALUE_HPP_
 
-#include <iostream>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 
 enum class value_t : std::uint8_t
 {
@@ -15,29 +21,297 @@ enum class value_t : std::uint8_t
     discarded
 };
 
-using StringType = char *;
-using BoolenType = bool;
-using NumberIntegerType = int64_t;
-using NumberUnsignedType = uint64_t;
-using NumberFloatType = double;
-using BinaryType = uint8_t;
-using Null
+using null_t = std::nullptr_t;
+using boolean_t = bool;
+using number_integer_t = int64_t;
+using number_unsigned_t = uint64_t;
+using number_float_t = double;
 
-using string_t = StringType;
-
-union value
+/*
+ * Dynamic value for task parameters and results, 16 bytes whatever it
+ * holds.
+ *
+ * Fifteen bytes of payload and one tag byte: the low nibble is the
+ * value_t, the high one the length of a string or binary held inline (up
+ * to kSmall bytes) or kExternal. Longer ones live in a heap block,
+ * their length in front of the bytes, and the payload holds the pointer.
+ * Strings are NUL terminated either way. Copies are deep; a move copies
+ * the 16 bytes and leaves a null behind.
+ *
+ * Nothing points into the value itself, so it is trivially relocatable:
+ * memcpy to a new place and forgetting the old one is a valid move, see
+ * value::relocate().
+ */
+class value
 {
-    /// string (stored with pointer to save storage)
-    
+public:
+    static const size_t kSmall = 14;    // Longest string or binary stored inline.
 
-};
+    value() noexcept { this->meta_ = (uint8_t)value_t::null; }
+    value(null_t) noexcept : value() { }
+
+    value(boolean_t b) noexcept
+    {
+        this->store(b);
+        this->meta_ = (uint8_t)value_t::boolean;
+    }
+
+    // Signed integers become number_integer, unsigned ones number_unsigned.
+    template <typename T, typename std::enable_if<std::is_integral<T>::value
+            && !std::is_same<T, bool>::value, int>::type = 0>
+    value(T n) noexcept
+    {
+        if (std::is_signed<T>::value) {
+            this->store((number_integer_t)n);
+            this->meta_ = (uint8_t)value_t::number_integer;
+        } else {
+            this->store((number_unsigned_t)n);
+            this->meta_ = (uint8_t)value_t::number_unsigned;
+        }
+    }
+
+    value(number_float_t d) noexcept
+    {
+        this->store(d);
+        this->meta_ = (uint8_t)value_t::number_float;
+    }
+
+    value(float f) noexcept : value((number_float_t)f) { }
+
+    value(const char *s) { this->assign(value_t::string, s, strlen(s)); }
+    value(const char *s, size_t size) { this->assign(value_t::string, s, size); }
+    value(const std::string &s) { this->assign(value_t::string, s.data(), s.size()); }
+
+    static value binary(const void *data, size_t size)
+    {
+        value v;
+        v.assign(value_t::binary, data, size);
+        return v;
+    }
+
+    value(const value &other)
+    {
+        if (other.external())
+            this->assign(other.type(), other.data(), other.size());
+        else
+            this->raw_copy(other);
+    }
+
+    value(value &&other) noexcept
+    {
+        this->raw_copy(other);
+        other.meta_ = (uint8_t)value_t::null;
+    }
+
+    value &operator=(const value &other)
+    {
+        if (this != &other) {
+            value copy(other);
+            this->swap(copy);
+        }
+        return *this;
+    }
+
+    value &operator=(value &&other) noexcept
+    {
+        if (this != &other) {
+            this->release();
+            this->raw_copy(other);
+            other.meta_ = (uint8_t)value_t::null;
+        }
+        return *this;
+    }
+
+    ~value() { this->release(); }
+
+    void swap(value &other) noexcept
+    {
+        value tmp(std::move(other));
+        other.raw_copy(*this);
+        this->raw_copy(tmp);
+        tmp.meta_ = (uint8_t)value_t::null;
+    }
+
+    // Moves count values to uninitialized memory at to; what was at from
+    // is left as raw memory, no destructor to run.
+    static void relocate(value *to, value *from, size_t count)
+    {
+        if (count)
+            memcpy(static_cast<void *>(to), static_cast<const void *>(from), count * sizeof(value));
+    }
+
+    value_t type() const { return (value_t)(this->meta_ & 0x0f); }
+
+    bool is_null() const { return this->type() == value_t::null; }
+    bool is_boolean() const { return this->type() == value_t::boolean; }
+    bool is_string() const { return this->type() == value_t::string; }
+    bool is_binary() const { return this->type() == value_t::binary; }
+    bool is_number() const
+    {
+        return this->type() == value_t::number_integer || this->type() == value_t::number_unsigned
+            || this->type() == value_t::number_float;
+    }
 
+    boolean_t as_bool() const
+    {
+        this->expect(this->is_boolean(), "not a boolean");
+        return this->load<boolean_t>();
+    }
 
+    // Integers of either sign as long as the value fits.
+    number_integer_t as_int() const
+    {
+        if (this->type() == value_t::number_unsigned) {
+            this->expect(this->load<number_unsigned_t>() <= (number_unsigned_t)INT64_MAX, "out of int64 range");
+            return (number_integer_t)this->load<number_unsigned_t>();
+        }
+        this->expect(this->type() == value_t::number_integer, "not an integer");
+        return this->load<number_integer_t>();
+    }
 
+    number_unsigned_t as_uint() const
+    {
+        if (this->type() == value_t::number_integer) {
+            this->expect(this->load<number_integer_t>() >= 0, "out of uint64 range");
+            return (number_unsigned_t)this->load<number_integer_t>();
+        }
+        this->expect(this->type() == value_t::number_unsigned, "not an integer");
+        return this->load<number_unsigned_t>();
+    }
 
+    // Any number.
+    number_float_t as_double() const
+    {
+        switch (this->type()) {
+        case value_t::number_integer:   return (number_float_t)this->load<number_integer_t>();
+        case value_t::number_unsigned:  return (number_float_t)this->load<number_unsigned_t>();
+        case value_t::number_float:     return this->load<number_float_t>();
+        default:                        this->expect(false, "not a number"); return 0;
+        }
+    }
 
+    // Bytes of a string or binary, 0 for anything else.
+    size_t size() const
+    {
+        if (this->type() != value_t::string && this->type() != value_t::binary)
+            return 0;
+        if (this->external()) {
+            uint64_t size;
+            memcpy(&size, this->block(), sizeof(size));
+            return (size_t)size;
+        }
+        return this->meta_ >> 4;
+    }
+
+    // A string's or binary's bytes, nullptr for anything else.
+    const char *data() const
+    {
+        if (this->type() != value_t::string && this->type() != value_t::binary)
+            return nullptr;
+        return this->external() ? this->block() + sizeof(uint64_t) : reinterpret_cast<const char *>(this->bytes_);
+    }
+
+    const char *c_str() const
+    {
+        this->expect(this->is_string(), "not a string");
+        return this->data();
+    }
+
+    std::string str() const { return std::string(this->c_str(), this->size()); }
+
+    // Numbers compare by value across their three kinds.
+    bool operator==(const value &other) const
+    {
+        if (this->is_number() && other.is_number()) {
+            if (this->type() == value_t::number_float || other.type() == value_t::number_float)
+                return this->as_double() == other.as_double();
+            if (this->type() == other.type())
+                return this->load<uint64_t>() == other.load<uint64_t>();
+            // Mixed signs: equal only when neither is out of the other's range.
+            const value &s = this->type() == value_t::number_integer ? *this : other;
+            const value &u = this->type() == value_t::number_integer ? other : *this;
+            return s.load<number_integer_t>() >= 0
+                && (number_unsigned_t)s.load<number_integer_t>() == u.load<number_unsigned_t>();
+        }
+        if (this->type() != other.type())
+            return false;
+        switch (this->type()) {
+        case value_t::boolean:  return this->as_bool() == other.as_bool();
+        case value_t::string:
+        case value_t::binary:   return this->size() == other.size() && memcmp(this->data(), other.data(), this->size()) == 0;
+        default:                return true;
+        }
+    }
+
+    bool operator!=(const value &other) const { return !(*this == other); }
+
+private:
+    static const uint8_t kExternal = 0x0f;  // Length nibble of a value held in a block.
+
+    template <typename T>
+    T load() const
+    {
+        T v;
+        memcpy(&v, this->bytes_, sizeof(T));
+        return v;
+    }
+
+    template <typename T>
+    void store(T v) { memcpy(this->bytes_, &v, sizeof(T)); }
+
+    bool external() const { return (this->meta_ >> 4) == kExternal; }
+
+    const char *block() const { return this->load<const char *>(); }
+
+    void assign(value_t type, const void *data, size_t size)
+    {
+        char *bytes;
+        if (size <= kSmall) {
+            bytes = reinterpret_cast<char *>(this->bytes_);
+            this->meta_ = (uint8_t)((size << 4) | (uint8_t)type);
+        } else {
+            char *block = static_cast<char *>(::operator new(sizeof(uint64_t) + size + 1));
+            uint64_t length = size;
+            memcpy(block, &length, sizeof(length));
+            this->store(block);
+            this->meta_ = (uint8_t)((kExternal << 4) | (uint8_t)type);
+            bytes = block + sizeof(uint64_t);
+        }
+        if (size)
+            memcpy(bytes, data, size);
+        bytes[size] = '\0';
+    }
+
+    void release()
+    {
+        if (this->external())
+            ::operator delete(const_cast<char *>(this->block()));
+    }
+
+    void raw_copy(const value &other)
+    {
+        memcpy(this->bytes_, other.bytes_, sizeof(this->bytes_));
+        this->meta_ = other.meta_;
+    }
+
+    void expect(bool ok, const char *what) const
+    {
+        if (!ok)
+            throw std::runtime_error(std::string("value: ") + what);
+    }
+
+private:
+    alignas(8) unsigned char bytes_[15];
+    uint8_t meta_;
+};
 
+static_assert(sizeof(value) == 16, "value must stay 16 bytes");
 
+// Types whose objects may be moved with memcpy, the source then forgotten.
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> { };
 
+template <>
+struct is_trivially_relocatable<value> : std::true_type { };
 
 #endif // _VALUE_HPP_
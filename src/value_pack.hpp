@@ -0,0 +1,502 @@
+#ifndef _VALUE_PACK_HPP_
+#define _VALUE_PACK_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "value.hpp"
+
+/*
+ * Binary encoding of value, a subset of MessagePack: any MessagePack
+ * reader reads it back, and this decoder reads the scalar, string and
+ * binary formats of any writer. Strings and binaries are limited to 4 GiB
+ * each, the largest MessagePack length.
+ *
+ *     null        c0                  bool        c2 false, c3 true
+ *     integer     00-7f, e0-ff fixint, cc-cf uint8..uint64, d0-d3 int8..int64
+ *     double      cb, ca (float, read only)
+ *     string      a0-bf fixstr, d9-db str8..str32
+ *     binary      c4-c6 bin8..bin32
+ *
+ * Multi-byte numbers are big endian. Integers take the shortest format
+ * for their value, so a non-negative int64 may come back as a uint64 of
+ * the same value, which value's operator== treats as equal. A stream is
+ * values one after the other; arrays, maps and extensions are not read.
+ */
+
+namespace value_pack {
+
+inline uint16_t big16(uint16_t v) { return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? __builtin_bswap16(v) : v; }
+inline uint32_t big32(uint32_t v) { return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? __builtin_bswap32(v) : v; }
+inline uint64_t big64(uint64_t v) { return __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? __builtin_bswap64(v) : v; }
+
+}
+
+/*
+ * Encodes values into a buffer of the caller's. With a flush callback a
+ * full buffer is handed to it and filled again, so strings and binaries
+ * of any size stream through a small buffer; without one, a value that
+ * does not fit is not written at all and pack() returns false.
+ */
+class ValueEncoder
+{
+public:
+    // Takes the bytes written so far; false stops the encoder.
+    typedef bool (*flush_t)(const char *data, size_t size, void *user);
+
+    static const size_t kMaxHeader = 9;     // Format byte and a 64-bit number.
+
+    // With flush, capacity must hold kMaxHeader bytes at least.
+    ValueEncoder(char *buffer, size_t capacity, flush_t flush = nullptr, void *user = nullptr)
+        : buffer_(buffer), capacity_(capacity), flush_(flush), user_(user) { }
+
+    bool pack(const value &v)
+    {
+        switch (v.type()) {
+        case value_t::null:             return this->pack_null();
+        case value_t::boolean:          return this->pack_bool(v.as_bool());
+        case value_t::number_integer:   return this->pack_int(v.as_int());
+        case value_t::number_unsigned:  return this->pack_uint(v.as_uint());
+        case value_t::number_float:     return this->pack_double(v.as_double());
+        case value_t::string:           return this->pack_string(v.data(), v.size());
+        case value_t::binary:           return this->pack_binary(v.data(), v.size());
+        default:                        return false;
+        }
+    }
+
+    bool pack_null()
+    {
+        uint8_t head = 0xc0;
+        return this->put(&head, 1, nullptr, 0);
+    }
+
+    bool pack_bool(bool b)
+    {
+        uint8_t head = b ? 0xc3 : 0xc2;
+        return this->put(&head, 1, nullptr, 0);
+    }
+
+    bool pack_int(int64_t n)
+    {
+        if (n >= 0)
+            return this->pack_uint((uint64_t)n);
+
+        uint8_t head[kMaxHeader];
+        size_t size;
+        if (n >= -32) {
+            head[0] = (uint8_t)n;
+            size = 1;
+        } else if (n >= INT8_MIN) {
+            head[0] = 0xd0;
+            head[1] = (uint8_t)n;
+            size = 2;
+        } else if (n >= INT16_MIN) {
+            size = number(head, 0xd1, value_pack::big16((uint16_t)n));
+        } else if (n >= INT32_MIN) {
+            size = number(head, 0xd2, value_pack::big32((uint32_t)n));
+        } else {
+            size = number(head, 0xd3, value_pack::big64((uint64_t)n));
+        }
+        return this->put(head, size, nullptr, 0);
+    }
+
+    bool pack_uint(uint64_t n)
+    {
+        uint8_t head[kMaxHeader];
+        size_t size;
+        if (n < 0x80) {
+            head[0] = (uint8_t)n;
+            size = 1;
+        } else if (n <= UINT8_MAX) {
+            head[0] = 0xcc;
+            head[1] = (uint8_t)n;
+            size = 2;
+        } else if (n <= UINT16_MAX) {
+            size = number(head, 0xcd, value_pack::big16((uint16_t)n));
+        } else if (n <= UINT32_MAX) {
+            size = number(head, 0xce, value_pack::big32((uint32_t)n));
+        } else {
+            size = number(head, 0xcf, value_pack::big64(n));
+        }
+        return this->put(head, size, nullptr, 0);
+    }
+
+    bool pack_double(double d)
+    {
+        uint64_t bits;
+        memcpy(&bits, &d, sizeof(bits));
+        uint8_t head[kMaxHeader];
+        return this->put(head, number(head, 0xcb, value_pack::big64(bits)), nullptr, 0);
+    }
+
+    bool pack_string(const char *s, size_t size)
+    {
+        if (size > UINT32_MAX)
+            return false;
+        uint8_t head[kMaxHeader];
+        size_t n;
+        if (size < 32) {
+            head[0] = (uint8_t)(0xa0 | size);
+            n = 1;
+        } else {
+            n = length(head, 0xd9, size);
+        }
+        return this->put(head, n, s, size);
+    }
+
+    bool pack_binary(const void *data, size_t size)
+    {
+        if (size > UINT32_MAX)
+            return false;
+        uint8_t head[kMaxHeader];
+        return this->put(head, length(head, 0xc4, size), data, size);
+    }
+
+    // Hands what is buffered to the flush callback.
+    bool flush()
+    {
+        if (this->failed_)
+            return false;
+        if (this->size_ == 0 || !this->flush_)
+            return true;
+        if (!this->flush_(this->buffer_, this->size_, this->user_)) {
+            this->failed_ = true;
+            return false;
+        }
+        this->size_ = 0;
+        return true;
+    }
+
+    // Bytes in the buffer, not flushed yet.
+    const char *data() const { return this->buffer_; }
+    size_t size() const { return this->size_; }
+
+    // Starts over at the beginning of the buffer.
+    void reset()
+    {
+        this->size_ = 0;
+        this->failed_ = false;
+    }
+
+private:
+    // The format byte and n in the bytes after it, returns the size.
+    template <typename T>
+    static size_t number(uint8_t *head, uint8_t format, T n)
+    {
+        head[0] = format;
+        memcpy(head + 1, &n, sizeof(n));
+        return 1 + sizeof(n);
+    }
+
+    // str8/bin8 at format, the 16 and 32-bit lengths at the next two.
+    static size_t length(uint8_t *head, uint8_t format, size_t size)
+    {
+        if (size <= UINT8_MAX) {
+            head[0] = format;
+            head[1] = (uint8_t)size;
+            return 2;
+        }
+        if (size <= UINT16_MAX)
+            return number(head, format + 1, value_pack::big16((uint16_t)size));
+        return number(head, format + 2, value_pack::big32((uint32_t)size));
+    }
+
+    bool put(const void *head, size_t head_size, const void *payload, size_t payload_size)
+    {
+        if (this->failed_)
+            return false;
+
+        if (!this->flush_) {
+            if (this->capacity_ - this->size_ < head_size + payload_size)
+                return false;
+            this->append(head, head_size);
+            this->append(payload, payload_size);
+            return true;
+        }
+
+        if (this->capacity_ - this->size_ < head_size && !this->flush())
+            return false;
+        this->append(head, head_size);
+
+        const char *p = static_cast<const char *>(payload);
+        while (payload_size) {
+            if (this->size_ == this->capacity_ && !this->flush())
+                return false;
+            size_t n = std::min(payload_size, this->capacity_ - this->size_);
+            this->append(p, n);
+            p += n;
+            payload_size -= n;
+        }
+        return true;
+    }
+
+    void append(const void *data, size_t size)
+    {
+        if (size)
+            memcpy(this->buffer_ + this->size_, data, size);
+        this->size_ += size;
+    }
+
+private:
+    char *buffer_;
+    size_t capacity_;
+    size_t size_ = 0;
+    flush_t flush_;
+    void *user_;
+    bool failed_ = false;
+};
+
+/*
+ * A decoded value. Strings and binaries point into the decoder's input,
+ * valid as long as it is.
+ */
+struct ValueView
+{
+    value_t type = value_t::null;
+    union
+    {
+        bool boolean;
+        int64_t integer;
+        uint64_t unsigned_integer;
+        double number;
+    };
+    const char *data = nullptr;     // string and binary only.
+    size_t size = 0;
+
+    ValueView() : unsigned_integer(0) { }
+
+    // A value of its own, strings and binaries copied.
+    value to_value() const
+    {
+        switch (this->type) {
+        case value_t::boolean:          return value(this->boolean);
+        case value_t::number_integer:   return value(this->integer);
+        case value_t::number_unsigned:  return value(this->unsigned_integer);
+        case value_t::number_float:     return value(this->number);
+        case value_t::string:           return value(this->data, this->size);
+        case value_t::binary:           return value::binary(this->data, this->size);
+        default:                        return value();
+        }
+    }
+};
+
+/*
+ * Reads values out of a buffer, e.g. a MappedFile, one at a time. It
+ * never allocates or copies: a view of a string or binary points into
+ * the buffer.
+ */
+class ValueDecoder
+{
+public:
+    ValueDecoder(const void *data, size_t size)
+        : begin_(static_cast<const uint8_t *>(data)), p_(begin_), end_(begin_ + size) { }
+
+    // The next value, false at the end of the input or on a value that
+    // can not be read, error() tells which.
+    bool next(ValueView &view)
+    {
+        if (this->p_ == this->end_)
+            return false;
+
+        const uint8_t *p = this->p_;
+        uint8_t head = *p++;
+        view.data = nullptr;
+        view.size = 0;
+        if (head < 0x80) {
+            view.type = value_t::number_integer;
+            view.integer = head;
+        } else if (head >= 0xe0) {
+            view.type = value_t::number_integer;
+            view.integer = (int8_t)head;
+        } else if ((head & 0xe0) == 0xa0) {
+            return this->bytes(view, value_t::string, p, head & 0x1f);
+        } else {
+            switch (head) {
+            case 0xc0:  view.type = value_t::null; break;
+            case 0xc2:
+            case 0xc3:  view.type = value_t::boolean; view.boolean = head == 0xc3; break;
+            case 0xcc:  return this->unsigned_number<uint8_t>(view, p);
+            case 0xcd:  return this->unsigned_number<uint16_t>(view, p);
+            case 0xce:  return this->unsigned_number<uint32_t>(view, p);
+            case 0xcf:  return this->unsigned_number<uint64_t>(view, p);
+            case 0xd0:  return this->signed_number<int8_t>(view, p);
+            case 0xd1:  return this->signed_number<int16_t>(view, p);
+            case 0xd2:  return this->signed_number<int32_t>(view, p);
+            case 0xd3:  return this->signed_number<int64_t>(view, p);
+            case 0xca: {
+                uint32_t bits;
+                if (!this->read(p, bits))
+                    return false;
+                float f;
+                memcpy(&f, &bits, sizeof(f));
+                view.type = value_t::number_float;
+                view.number = f;
+                break;
+            }
+            case 0xcb: {
+                uint64_t bits;
+                if (!this->read(p, bits))
+                    return false;
+                view.type = value_t::number_float;
+                memcpy(&view.number, &bits, sizeof(bits));
+                break;
+            }
+            case 0xd9:  return this->sized<uint8_t>(view, value_t::string, p);
+            case 0xda:  return this->sized<uint16_t>(view, value_t::string, p);
+            case 0xdb:  return this->sized<uint32_t>(view, value_t::string, p);
+            case 0xc4:  return this->sized<uint8_t>(view, value_t::binary, p);
+            case 0xc5:  return this->sized<uint16_t>(view, value_t::binary, p);
+            case 0xc6:  return this->sized<uint32_t>(view, value_t::binary, p);
+            default:
+                this->error_ = "unsupported format";
+                return false;
+            }
+        }
+        this->p_ = p;
+        return true;
+    }
+
+    // Bytes read so far, where a failed next() stopped.
+    size_t offset() const { return this->p_ - this->begin_; }
+
+    bool done() const { return this->p_ == this->end_; }
+
+    // nullptr at a clean end of the input.
+    const char *error() const { return this->error_; }
+
+private:
+    // Reads a big-endian T at p, advancing it.
+    template <typename T>
+    bool read(const uint8_t *&p, T &v)
+    {
+        if ((size_t)(this->end_ - p) < sizeof(T))
+            return this->truncated();
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        if (sizeof(T) == 2)
+            v = (T)value_pack::big16((uint16_t)v);
+        else if (sizeof(T) == 4)
+            v = (T)value_pack::big32((uint32_t)v);
+        else if (sizeof(T) == 8)
+            v = (T)value_pack::big64((uint64_t)v);
+        return true;
+    }
+
+    template <typename T>
+    bool unsigned_number(ValueView &view, const uint8_t *p)
+    {
+        T n;
+        if (!this->read(p, n))
+            return false;
+        view.type = value_t::number_unsigned;
+        view.unsigned_integer = n;
+        this->p_ = p;
+        return true;
+    }
+
+    template <typename T>
+    bool signed_number(ValueView &view, const uint8_t *p)
+    {
+        typename std::make_unsigned<T>::type bits;
+        if (!this->read(p, bits))
+            return false;
+        view.type = value_t::number_integer;
+        view.integer = (T)bits;
+        this->p_ = p;
+        return true;
+    }
+
+    template <typename T>
+    bool sized(ValueView &view, value_t type, const uint8_t *p)
+    {
+        T size;
+        if (!this->read(p, size))
+            return false;
+        return this->bytes(view, type, p, size);
+    }
+
+    bool bytes(ValueView &view, value_t type, const uint8_t *p, size_t size)
+    {
+        if ((size_t)(this->end_ - p) < size)
+            return this->truncated();
+        view.type = type;
+        view.data = reinterpret_cast<const char *>(p);
+        view.size = size;
+        this->p_ = p + size;
+        return true;
+    }
+
+    bool truncated()
+    {
+        this->error_ = "truncated input";
+        return false;
+    }
+
+private:
+    const uint8_t *begin_;
+    const uint8_t *p_;
+    const uint8_t *end_;
+    const char *error_ = nullptr;
+};
+
+/*
+ * A file mapped read-only, for ValueDecoder to walk without reading it
+ * into memory first.
+ */
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &other) = delete;
+    void operator=(const MappedFile &other) = delete;
+
+    ~MappedFile() { this->close(); }
+
+    // False, errno set, when the file can not be opened or mapped.
+    bool open(const std::string &path)
+    {
+        this->close();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            return false;
+
+        struct stat st;
+        bool ok = fstat(fd, &st) == 0;
+        if (ok && st.st_size > 0) {
+            void *data = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ok = data != MAP_FAILED;
+            if (ok) {
+                this->data_ = static_cast<const char *>(data);
+                this->size_ = (size_t)st.st_size;
+                // Read front to back, once.
+                madvise(data, this->size_, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    void close()
+    {
+        if (this->data_)
+            munmap(const_cast<char *>(this->data_), this->size_);
+        this->data_ = nullptr;
+        this->size_ = 0;
+    }
+
+    const char *data() const { return this->data_; }
+    size_t size() const { return this->size_; }
+
+private:
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif //_VALUE_PACK_HPP_
@@ -0,0 +1,205 @@
+#ifndef _WORK_STEALING_QUEUE_HPP_
+#define _WORK_STEALING_QUEUE_HPP_
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ * Per-worker double ended queue, after Chase and Lev.
+ *
+ * The owner pushes and pops at the bottom (LIFO, keeps the cache hot)
+ * with plain loads and stores, racing the thieves with a CAS only for the
+ * last task. Idle workers steal from the top (FIFO, takes the oldest and
+ * usually the biggest piece of work) with one CAS. The ring is allocated
+ * once. Unlike the paper's, a slot is claimed before it is moved out of,
+ * so a Task is never copied speculatively, and each slot carries a
+ * sequence number (its index while free, index + 1 while holding it) that
+ * tells the owner whether the thief of its last lap is done with it.
+ *
+ * Other threads, and the owner once its ring is full, push to an overflow
+ * list under a lock, which the owner pops after its ring and thieves steal
+ * from after the ring.
+ */
+template <typename T>
+class WorkStealingQueue {
+private:
+    using type_ref = T &;
+
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+        T *data() { return reinterpret_cast<T *>(&storage); }
+    };
+
+    static size_t round_up(size_t value)
+    {
+        size_t power = 1;
+        while (power < value)
+            power <<= 1;
+        return power;
+    }
+
+public:
+    static const size_t kDefaultCapacity = 1024;
+
+    // capacity: of the ring, a queue nobody owns only needs the overflow.
+    explicit WorkStealingQueue(size_t capacity = kDefaultCapacity)
+        : mask_(round_up(capacity) - 1), cells_(new Cell[mask_ + 1])
+    {
+        for (size_t i = 0; i <= mask_; ++i)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    WorkStealingQueue(const WorkStealingQueue &other) = delete;
+    void operator=(const WorkStealingQueue &other) = delete;
+
+    ~WorkStealingQueue()
+    {
+        size_t bottom = bottom_.load(std::memory_order_relaxed);
+        for (size_t i = top_.load(std::memory_order_relaxed); i < bottom; ++i)
+            cell(i).data()->~T();
+    }
+
+    // Lock free, so idle workers can poll every deque cheaply.
+    bool empty() const { return size() == 0; }
+
+    size_t size() const
+    {
+        size_t top = top_.load(std::memory_order_relaxed);
+        size_t bottom = bottom_.load(std::memory_order_relaxed);
+        return (bottom > top ? bottom - top : 0) + overflow_size_.load(std::memory_order_relaxed);
+    }
+
+    // Owner side.
+    void push(T &&t)
+    {
+        if (!push_ring(t))
+            push_shared(std::move(t));
+    }
+
+    template <typename Iterator>
+    void push_bulk(Iterator first, Iterator last)
+    {
+        for (; first != last && push_ring(*first); ++first)
+            ;
+        push_shared_bulk(first, last);
+    }
+
+    bool pop(type_ref t)
+    {
+        size_t bottom = bottom_.load(std::memory_order_relaxed);
+        if (top_.load(std::memory_order_relaxed) < bottom) {
+            size_t b = bottom - 1;
+            bottom_.store(b, std::memory_order_seq_cst);
+            size_t top = top_.load(std::memory_order_seq_cst);
+            if (top < b) {
+                take(b, t, b);
+                return true;
+            }
+            // The last one, or a thief was quicker: it goes to the CAS winner.
+            bool won = top == b && top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst);
+            bottom_.store(bottom, std::memory_order_release);
+            if (won) {
+                take(b, t, b + mask_ + 1);
+                return true;
+            }
+        }
+        return pop_shared(t);
+    }
+
+    // Any thread.
+    void push_shared(T &&t)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        overflow_.push_back(std::move(t));
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+    }
+
+    template <typename Iterator>
+    void push_shared_bulk(Iterator first, Iterator last)
+    {
+        if (first == last)
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (; first != last; ++first)
+            overflow_.push_back(std::move(*first));
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+    }
+
+    // Thief side.
+    bool steal(type_ref t)
+    {
+        size_t top = top_.load(std::memory_order_seq_cst);
+        while (top < bottom_.load(std::memory_order_seq_cst)) {
+            if (top_.compare_exchange_weak(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                take(top, t, top + mask_ + 1);
+                return true;
+            }
+        }
+        return pop_shared(t);
+    }
+
+private:
+    Cell &cell(size_t index) const { return cells_[index & mask_]; }
+
+    // Owner only. Fails, leaving t alone, when the slot at the bottom still
+    // holds a task or its thief is moving out.
+    bool push_ring(T &t)
+    {
+        size_t bottom = bottom_.load(std::memory_order_relaxed);
+        Cell &c = cell(bottom);
+        if (c.sequence.load(std::memory_order_acquire) != bottom)
+            return false;
+        new (c.data()) T(std::move(t));
+        c.sequence.store(bottom + 1, std::memory_order_relaxed);
+        bottom_.store(bottom + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves index out of its slot, claimed already, and frees the slot for
+    // index next.
+    void take(size_t index, type_ref t, size_t next)
+    {
+        Cell &c = cell(index);
+        t = std::move(*c.data());
+        c.data()->~T();
+        c.sequence.store(next, std::memory_order_release);
+    }
+
+    bool pop_shared(type_ref t)
+    {
+        if (overflow_size_.load(std::memory_order_relaxed) == 0)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (overflow_.empty())
+            return false;
+
+        t = std::move(overflow_.front());
+        overflow_.pop_front();
+        overflow_size_.store(overflow_.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+private:
+    const size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    char pad0_[64];
+    std::atomic<size_t> bottom_ { 0 };      // Written by the owner only.
+    char pad1_[64];
+    std::atomic<size_t> top_ { 0 };
+    char pad2_[64];
+    std::atomic<size_t> overflow_size_ { 0 };
+    std::deque<T> overflow_;
+    std::mutex mutex_;
+    char pad3_[64];     // Keep neighbour queues off our cache lines.
+};
+
+#endif //_WORK_STEALING_QUEUE_HPP_
@@ -0,0 +1,52 @@
+/*
+ * Turns binary logs written by Logger in structured mode back into the
+ * lines the text logger would have printed.
+ *
+ *     logdecode [FILE...]      reads standard input without a file
+ */
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "log_record.hpp"
+
+static bool decode(FILE *fp, const char *name)
+{
+    LogDecoder decoder(fp);
+    if (!decoder.open()) {
+        fprintf(stderr, "logdecode: %s: %s\n", name, decoder.error());
+        return false;
+    }
+
+    std::string line;
+    while (decoder.next(line)) {
+        line += '\n';
+        fwrite(line.data(), 1, line.size(), stdout);
+        line.clear();
+    }
+    if (decoder.error()) {
+        fprintf(stderr, "logdecode: %s: %s\n", name, decoder.error());
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        return decode(stdin, "stdin") ? EXIT_SUCCESS : EXIT_FAILURE;
+
+    bool ok = true;
+    for (int i = 1; i < argc; ++i) {
+        FILE *fp = fopen(argv[i], "rb");
+        if (!fp) {
+            fprintf(stderr, "logdecode: %s: %s\n", argv[i], strerror(errno));
+            ok = false;
+            continue;
+        }
+        ok = decode(fp, argv[i]) && ok;
+        fclose(fp);
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}